@@ -1,9 +1,49 @@
 #include "BitArray.h"
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 #pragma warning( disable : 4319) //~ zero extending unsigned long to size_t of greater size
 #pragma warning( disable : 4334) //<< result of 32 bit shift implicity converted to 64 bits
 #pragma warning( disable : 4267) //conversion from size_t to unsigned long
 
+//Number of words summarized by each entry of the rank index
+const size_t WORDS_PER_SUPERBLOCK = 8;
+
+//Counts the set bits in a single word
+static inline size_t PopCount(size_t i_word)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+	return __popcnt64(i_word);
+#elif defined(_MSC_VER)
+	return __popcnt(i_word);
+#else
+	return __builtin_popcountll(i_word);
+#endif
+}
+
+//Gets the position of the i_k-th (0-based) set bit within a single word
+static inline uint8_t SelectInWord(size_t i_word, size_t i_k)
+{
+	for (size_t i = 0; i < i_k; i++)
+	{
+		i_word &= i_word - 1; //drop the lowest set bit
+	}
+
+#if defined(_MSC_VER) && defined(_WIN64)
+	unsigned long bitLocation;
+	_BitScanForward64(&bitLocation, i_word);
+	return static_cast<uint8_t>(bitLocation);
+#elif defined(_MSC_VER)
+	unsigned long bitLocation;
+	_BitScanForward(&bitLocation, i_word);
+	return static_cast<uint8_t>(bitLocation);
+#else
+	return static_cast<uint8_t>(__builtin_ctzll(i_word));
+#endif
+}
+
 BitArray::BitArray()
 {
 }
@@ -19,12 +59,19 @@ BitArray::BitArray(size_t i_numBits)
 
 	assert(st_bits);
 
+	ownsBits = true;
+	rankCounts = nullptr;
+	numSuperblocks = 0;
+	rankIndexEnabled = false;
+
 	ClearAll();
 }
 
 BitArray::~BitArray()
 {
-	delete[] st_bits;
+	if (ownsBits)
+		delete[] st_bits;
+	delete[] rankCounts;
 }
 
 void BitArray::SetInfo(size_t i_numBits)
@@ -38,9 +85,40 @@ void BitArray::SetInfo(size_t i_numBits)
 
 	assert(st_bits);
 
+	ownsBits = true;
+	rankCounts = nullptr;
+	numSuperblocks = 0;
+	rankIndexEnabled = false;
+
 	ClearAll();
 }
 
+//Sets up the bit array over words someone else owns, e.g. a bitmap inside a mapped pool image.
+//The words are left as they are and are not freed with the bit array.
+void BitArray::SetInfo(size_t i_numBits, size_t* i_externalBits)
+{
+	numBytes = i_numBits / BITS_PER_BYTE;
+	st_bits = i_externalBits;
+
+	assert(st_bits);
+
+	ownsBits = false;
+	rankCounts = nullptr;
+	numSuperblocks = 0;
+	rankIndexEnabled = false;
+}
+
+//Gets the raw words, for saving the bits out as-is
+const size_t* BitArray::GetWords(void) const
+{
+	return st_bits;
+}
+
+size_t BitArray::GetNumWords(void) const
+{
+	return numBytes;
+}
+
 void BitArray::ClearAll(void)
 {
 	for (unsigned int i = 0; i < numBytes; i++)
@@ -50,6 +128,9 @@ void BitArray::ClearAll(void)
 			st_bits[i] &= ~(1UL << j); //clear bit at i's jth index
 		}
 	}
+
+	if (rankIndexEnabled)
+		RebuildRankIndex();
 }
 
 void BitArray::SetAll(void)
@@ -61,6 +142,9 @@ void BitArray::SetAll(void)
 			st_bits[i] |= 1UL << j; //set bit at i's jth index
 		}
 	}
+
+	if (rankIndexEnabled)
+		RebuildRankIndex();
 }
 
 bool BitArray::AreAllClear(void) const
@@ -112,6 +196,9 @@ void BitArray::SetBit(size_t i_bitNumber)
 	unsigned long index = i_bitNumber / BITS_PER_BYTE;
 	uint8_t bitLocation = i_bitNumber % BITS_PER_BYTE;
 
+	if (rankIndexEnabled && !((st_bits[index] >> bitLocation) & 1UL))
+		AdjustRank(index, 1);
+
 	st_bits[index] |= 1UL << bitLocation;
 }
 
@@ -120,6 +207,9 @@ void BitArray::ClearBit(size_t i_bitNumber)
 	unsigned long index = i_bitNumber / BITS_PER_BYTE;
 	uint8_t bitLocation = i_bitNumber % BITS_PER_BYTE;
 
+	if (rankIndexEnabled && ((st_bits[index] >> bitLocation) & 1UL))
+		AdjustRank(index, -1);
+
 	st_bits[index] &= ~(1UL << bitLocation);
 }
 
@@ -175,6 +265,247 @@ bool BitArray::GetFirstSetBit(size_t & o_bitNumber) const
 	return false;
 }
 
+//Builds the optional rank/select index. The index keeps a Fenwick tree of popcounts per superblock,
+//so SetBit/ClearBit only touch log(superblocks) counters and Rank/Select never scan the whole array.
+void BitArray::EnableRankIndex(void)
+{
+	if (rankIndexEnabled)
+		return;
+
+	numSuperblocks = (numBytes + WORDS_PER_SUPERBLOCK - 1) / WORDS_PER_SUPERBLOCK;
+#ifdef USE_MEMORY_MANAGER
+	rankCounts = reinterpret_cast<size_t*>(globalMemoryManager->alloc(sizeof(size_t) * (numSuperblocks + 1)));
+#else
+	rankCounts = new size_t[numSuperblocks + 1];
+#endif
+
+	assert(rankCounts);
+
+	rankIndexEnabled = true;
+	RebuildRankIndex();
+}
+
+//Recounts every superblock and rebuilds the Fenwick tree in linear time
+void BitArray::RebuildRankIndex(void)
+{
+	rankCounts[0] = 0;
+
+	for (size_t s = 0; s < numSuperblocks; s++)
+	{
+		size_t count = 0;
+		size_t wordEnd = (s + 1) * WORDS_PER_SUPERBLOCK;
+		if (wordEnd > numBytes)
+			wordEnd = numBytes;
+
+		for (size_t i = s * WORDS_PER_SUPERBLOCK; i < wordEnd; i++)
+			count += PopCount(st_bits[i]);
+
+		rankCounts[s + 1] = count;
+	}
+
+	for (size_t node = 1; node <= numSuperblocks; node++)
+	{
+		size_t parent = node + (node & (~node + 1));
+		if (parent <= numSuperblocks)
+			rankCounts[parent] += rankCounts[node];
+	}
+}
+
+//Adds i_delta to the count of the superblock holding the given word
+void BitArray::AdjustRank(size_t i_wordIndex, int i_delta)
+{
+	for (size_t node = i_wordIndex / WORDS_PER_SUPERBLOCK + 1; node <= numSuperblocks; node += node & (~node + 1))
+		rankCounts[node] += i_delta;
+}
+
+//Gets the number of set bits in every superblock before i_superblock
+size_t BitArray::SuperblockPrefix(size_t i_superblock) const
+{
+	size_t count = 0;
+
+	for (size_t node = i_superblock; node > 0; node -= node & (~node + 1))
+		count += rankCounts[node];
+
+	return count;
+}
+
+//Gets the number of bits in the superblocks [i_first, i_first + i_count), accounting for a short last superblock
+size_t BitArray::SuperblockCapacity(size_t i_first, size_t i_count) const
+{
+	size_t wordEnd = (i_first + i_count) * WORDS_PER_SUPERBLOCK;
+	if (wordEnd > numBytes)
+		wordEnd = numBytes;
+
+	return (wordEnd - i_first * WORDS_PER_SUPERBLOCK) * BITS_PER_BYTE;
+}
+
+//Gets the number of set bits in total
+size_t BitArray::CountSet(void) const
+{
+	assert(rankIndexEnabled);
+
+	return SuperblockPrefix(numSuperblocks);
+}
+
+//Gets the number of clear bits in total
+size_t BitArray::CountClear(void) const
+{
+	return (numBytes * BITS_PER_BYTE) - CountSet();
+}
+
+//Gets the number of set bits strictly below i_bitNumber
+size_t BitArray::Rank(size_t i_bitNumber) const
+{
+	assert(rankIndexEnabled);
+
+	unsigned long index = i_bitNumber / BITS_PER_BYTE;
+	uint8_t bitLocation = i_bitNumber % BITS_PER_BYTE;
+	size_t superblock = index / WORDS_PER_SUPERBLOCK;
+
+	size_t count = SuperblockPrefix(superblock);
+
+	for (size_t i = superblock * WORDS_PER_SUPERBLOCK; i < index; i++)
+		count += PopCount(st_bits[i]);
+
+	if (bitLocation > 0 && index < numBytes)
+		count += PopCount(st_bits[index] & (~static_cast<size_t>(0) >> (BITS_PER_BYTE - bitLocation)));
+
+	return count;
+}
+
+//Finds the i_k-th (0-based) set bit
+bool BitArray::Select(size_t i_k, size_t & o_bitNumber) const
+{
+	assert(rankIndexEnabled);
+
+	if (i_k >= CountSet())
+		return false;
+
+	//walk down the Fenwick tree to find the superblock holding the bit
+	size_t superblock = 0;
+	size_t step = 1;
+	while ((step << 1) <= numSuperblocks)
+		step <<= 1;
+
+	for (; step > 0; step >>= 1)
+	{
+		if (superblock + step <= numSuperblocks && rankCounts[superblock + step] <= i_k)
+		{
+			superblock += step;
+			i_k -= rankCounts[superblock];
+		}
+	}
+
+	for (size_t i = superblock * WORDS_PER_SUPERBLOCK; i < numBytes; i++)
+	{
+		size_t count = PopCount(st_bits[i]);
+		if (i_k < count)
+		{
+			o_bitNumber = (i * BITS_PER_BYTE) + SelectInWord(st_bits[i], i_k);
+			return true;
+		}
+		i_k -= count;
+	}
+
+	return false;
+}
+
+//Finds the i_k-th (0-based) clear bit
+bool BitArray::SelectClear(size_t i_k, size_t & o_bitNumber) const
+{
+	assert(rankIndexEnabled);
+
+	if (i_k >= CountClear())
+		return false;
+
+	//same walk as Select, but a node's clear count is its capacity minus its set count
+	size_t superblock = 0;
+	size_t step = 1;
+	while ((step << 1) <= numSuperblocks)
+		step <<= 1;
+
+	for (; step > 0; step >>= 1)
+	{
+		if (superblock + step <= numSuperblocks)
+		{
+			size_t clearCount = SuperblockCapacity(superblock, step) - rankCounts[superblock + step];
+			if (clearCount <= i_k)
+			{
+				superblock += step;
+				i_k -= clearCount;
+			}
+		}
+	}
+
+	for (size_t i = superblock * WORDS_PER_SUPERBLOCK; i < numBytes; i++)
+	{
+		size_t count = BITS_PER_BYTE - PopCount(st_bits[i]);
+		if (i_k < count)
+		{
+			o_bitNumber = (i * BITS_PER_BYTE) + SelectInWord(~st_bits[i], i_k);
+			return true;
+		}
+		i_k -= count;
+	}
+
+	return false;
+}
+
+//Picks a clear bit uniformly from all clear bits, given any random number
+bool BitArray::GetRandomClearBit(size_t i_random, size_t & o_bitNumber) const
+{
+	size_t clearCount = CountClear();
+	if (clearCount == 0)
+		return false;
+
+	return SelectClear(i_random % clearCount, o_bitNumber);
+}
+
+//Clears every bit here that is set in i_other, a whole word at a time. Both arrays must be the same size.
+void BitArray::ClearBits(const BitArray & i_other)
+{
+	for (unsigned int i = 0; i < numBytes; i++)
+	{
+		size_t removed = st_bits[i] & i_other.st_bits[i];
+		if (removed == 0)
+			continue;
+
+		if (rankIndexEnabled)
+			AdjustRank(i, -static_cast<int>(PopCount(removed)));
+
+		st_bits[i] &= ~removed;
+	}
+}
+
+//Finds the first bit at or after i_startBit that is clear here and whose bit in i_mask equals i_maskSet,
+//a whole word at a time. Both arrays must be the same size.
+bool BitArray::GetFirstClearBitMasked(const BitArray & i_mask, bool i_maskSet, size_t i_startBit, size_t & o_bitNumber) const
+{
+	unsigned long index = i_startBit / BITS_PER_BYTE;
+	uint8_t bitLocation = i_startBit % BITS_PER_BYTE;
+
+	for (; index < numBytes; index++)
+	{
+		size_t maskWord = i_maskSet ? i_mask.st_bits[index] : ~i_mask.st_bits[index];
+		size_t candidates = ~st_bits[index] & maskWord;
+
+		//ignore bits before the start in the first word
+		if (bitLocation > 0)
+		{
+			candidates &= ~static_cast<size_t>(0) << bitLocation;
+			bitLocation = 0;
+		}
+
+		if (candidates != 0)
+		{
+			o_bitNumber = (index * BITS_PER_BYTE) + SelectInWord(candidates, 0);
+			return true;
+		}
+	}
+
+	return false;
+}
+
 bool BitArray::operator[](size_t i_index) const
 {
 	return false;
@@ -0,0 +1,184 @@
+#include "EpochManager.h"
+#include "FixedSizeAllocator.h"
+
+#include <stdio.h>
+
+//Slot of the calling thread in globalEpochManager, or INVALID_EPOCH_SLOT if it never registered
+static thread_local size_t t_epochSlot = INVALID_EPOCH_SLOT;
+
+EpochManager globalEpochManager;
+
+
+EpochManager::EpochManager()
+{
+	globalEpoch.store(EPOCH_START, std::memory_order_relaxed);
+
+	for (size_t i = 0; i < MAX_EPOCH_THREADS; i++)
+	{
+		threadRecords[i].inUse.store(false, std::memory_order_relaxed);
+		threadRecords[i].online.store(false, std::memory_order_relaxed);
+		threadRecords[i].localEpoch.store(EPOCH_START, std::memory_order_relaxed);
+	}
+}
+
+EpochManager::~EpochManager()
+{
+	//static destruction may already have taken the pools down, so whatever is still in limbo is simply dropped
+	for (size_t i = 0; i < MAX_EPOCH_THREADS; i++)
+	{
+		threadRecords[i].limbo.clear();
+	}
+
+	orphanedLimbo.clear();
+}
+
+//Registers the calling thread. Until it unregisters, retired blocks are only reclaimed after
+//this thread has passed a quiescent point (or gone offline).
+bool EpochManager::RegisterThread()
+{
+	if (t_epochSlot != INVALID_EPOCH_SLOT)
+		return true;
+
+	for (size_t i = 0; i < MAX_EPOCH_THREADS; i++)
+	{
+		bool expected = false;
+		if (threadRecords[i].inUse.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+		{
+			threadRecords[i].localEpoch.store(globalEpoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+			threadRecords[i].online.store(true, std::memory_order_seq_cst);
+			t_epochSlot = i;
+			return true;
+		}
+	}
+
+	printf("Too many threads registered with the epoch manager.\n");
+	return false;
+}
+
+void EpochManager::UnregisterThread()
+{
+	if (t_epochSlot == INVALID_EPOCH_SLOT)
+		return;
+
+	ThreadRecord& record = threadRecords[t_epochSlot];
+	record.online.store(false, std::memory_order_seq_cst);
+
+	//our leftovers still have to wait out the other threads, so hand them to whoever calls Quiescent next
+	if (!record.limbo.empty())
+	{
+		std::lock_guard<std::mutex> lock(orphanMutex);
+		orphanedLimbo.insert(orphanedLimbo.end(), record.limbo.begin(), record.limbo.end());
+		record.limbo.clear();
+	}
+
+	record.inUse.store(false, std::memory_order_release);
+	t_epochSlot = INVALID_EPOCH_SLOT;
+}
+
+//Announces that the calling thread holds no pointers into pooled blocks right now.
+//Call once per frame/loop iteration from every registered thread.
+void EpochManager::Quiescent()
+{
+	if (t_epochSlot == INVALID_EPOCH_SLOT)
+		return;
+
+	ThreadRecord& record = threadRecords[t_epochSlot];
+	record.localEpoch.store(globalEpoch.load(std::memory_order_acquire), std::memory_order_seq_cst);
+
+	TryAdvanceEpoch();
+
+	//a block retired in epoch e can't be seen by anyone once the epoch has moved two past it
+	uint64_t safeEpoch = globalEpoch.load(std::memory_order_acquire) - 2;
+	ReclaimList(record.limbo, safeEpoch);
+
+	if (orphanMutex.try_lock())
+	{
+		ReclaimList(orphanedLimbo, safeEpoch);
+		orphanMutex.unlock();
+	}
+}
+
+//Marks the calling thread as not reading anything until GoOnline, e.g. while it sleeps or waits on vsync,
+//so it doesn't hold the epoch back
+void EpochManager::GoOffline()
+{
+	if (t_epochSlot == INVALID_EPOCH_SLOT)
+		return;
+
+	threadRecords[t_epochSlot].online.store(false, std::memory_order_seq_cst);
+}
+
+void EpochManager::GoOnline()
+{
+	if (t_epochSlot == INVALID_EPOCH_SLOT)
+		return;
+
+	ThreadRecord& record = threadRecords[t_epochSlot];
+	record.localEpoch.store(globalEpoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+	record.online.store(true, std::memory_order_seq_cst);
+}
+
+//Queues a block to go back to its pool once no registered thread can still be reading it.
+//The pool frees it on its own thread, see FixedSizeAllocator::FreeDeferred.
+void EpochManager::Retire(FixedSizeAllocator* i_owner, void* i_ptr)
+{
+	RetiredBlock retired;
+	retired.owner = i_owner;
+	retired.ptr = i_ptr;
+	retired.epoch = globalEpoch.load(std::memory_order_acquire);
+
+	if (t_epochSlot == INVALID_EPOCH_SLOT)
+	{
+		//unregistered threads don't have their own list
+		std::lock_guard<std::mutex> lock(orphanMutex);
+		orphanedLimbo.push_back(retired);
+		return;
+	}
+
+	threadRecords[t_epochSlot].limbo.push_back(retired);
+}
+
+uint64_t EpochManager::GetEpoch() const
+{
+	return globalEpoch.load(std::memory_order_acquire);
+}
+
+//Moves the global epoch forward if every online thread has seen the current one
+bool EpochManager::TryAdvanceEpoch()
+{
+	uint64_t epoch = globalEpoch.load(std::memory_order_acquire);
+
+	for (size_t i = 0; i < MAX_EPOCH_THREADS; i++)
+	{
+		const ThreadRecord& record = threadRecords[i];
+
+		if (record.inUse.load(std::memory_order_acquire) && record.online.load(std::memory_order_seq_cst) &&
+			record.localEpoch.load(std::memory_order_seq_cst) != epoch)
+		{
+			return false;
+		}
+	}
+
+	return globalEpoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_acq_rel);
+}
+
+//Hands every block in the list that was retired at or before i_safeEpoch back to its pool.
+//This can run on any thread, so the pools don't free them here; their own threads do.
+void EpochManager::ReclaimList(std::vector<RetiredBlock>& io_list, uint64_t i_safeEpoch)
+{
+	size_t kept = 0;
+
+	for (size_t i = 0; i < io_list.size(); i++)
+	{
+		if (io_list[i].epoch <= i_safeEpoch)
+		{
+			io_list[i].owner->HandBackDeferred(io_list[i].ptr);
+		}
+		else
+		{
+			io_list[kept++] = io_list[i];
+		}
+	}
+
+	io_list.resize(kept);
+}
@@ -1,6 +1,54 @@
 #include "FixedSizeAllocator.h"
+#include "EpochManager.h"
+#include "HeapProfiler.h"
 
 #include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const uint32_t POOL_IMAGE_MAGIC = 0x47495346; //"FSIG"
+const uint32_t POOL_IMAGE_VERSION = 1;
+const size_t POOL_IMAGE_ALIGNMENT = 4096;
+
+//Layout of a pool image file: [PoolImageHeader][bitmap words][relocation offsets][padding][blocks]
+//The blocks start on a page boundary so they can be mapped straight from the file.
+struct PoolImageHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t blockSize;
+	uint64_t numBlocks;
+	uint64_t numWords;
+	uint64_t numRelocations;
+	uint64_t bitmapOffset;
+	uint64_t relocationsOffset;
+	uint64_t blocksOffset;
+	uint64_t fileSize;
+};
+
+//True if i_count elements of i_elementSize bytes starting at i_offset lie inside an image of i_imageSize bytes.
+//Written so a corrupt header can't make it overflow.
+static bool ImageRangeFits(uint64_t i_offset, uint64_t i_count, uint64_t i_elementSize, uint64_t i_imageSize)
+{
+	return i_offset <= i_imageSize && i_count <= (i_imageSize - i_offset) / i_elementSize;
+}
+
+static void UnmapImageRegion(void* i_base, size_t i_size)
+{
+#if defined(_WIN32)
+	UnmapViewOfFile(i_base);
+#else
+	munmap(i_base, i_size);
+#endif
+}
 
 
 
@@ -9,6 +57,20 @@
 FixedSizeAllocator::FixedSizeAllocator()
 {
 	printf("testing");
+
+	memoryStart = nullptr;
+	blockSize = 0;
+	numBlocks = 0;
+	fsaBitArray = nullptr;
+	imageBase = nullptr;
+	imageSize = 0;
+	sampledBitArray = nullptr;
+	zeroBitArray = nullptr;
+	zeroCursor = 0;
+	memset(&stats, 0, sizeof(stats));
+	currentGeneration = NO_POOL_GENERATION;
+	memset(generationBitArrays, 0, sizeof(generationBitArrays));
+	hasDeferredFrees.store(false, std::memory_order_relaxed);
 }
 
 //The constructor for normal use of the fixed size allocator.
@@ -24,6 +86,15 @@ FixedSizeAllocator::FixedSizeAllocator(void* i_memoryStart, size_t i_blockSize)
 	numBlocks = GetNumBlocksFromAllocSize(i_blockSize);
 
 	memoryStart = i_memoryStart;
+	imageBase = nullptr;
+	imageSize = 0;
+	sampledBitArray = nullptr;
+	zeroBitArray = nullptr;
+	zeroCursor = 0;
+	memset(&stats, 0, sizeof(stats));
+	currentGeneration = NO_POOL_GENERATION;
+	memset(generationBitArrays, 0, sizeof(generationBitArrays));
+	hasDeferredFrees.store(false, std::memory_order_relaxed);
 #ifdef USE_MEMORY_MANAGER
 	fsaBitArray = reinterpret_cast<BitArray*>(globalMemoryManager->alloc(sizeof(BitArray)));
 	fsaBitArray->SetInfo(numBlocks);
@@ -35,12 +106,14 @@ FixedSizeAllocator::FixedSizeAllocator(void* i_memoryStart, size_t i_blockSize)
 
 FixedSizeAllocator::~FixedSizeAllocator()
 {
-	if (!fsaBitArray->AreAllClear())
+	if (fsaBitArray != nullptr && !fsaBitArray->AreAllClear())
 	{
 #if defined(_DEBUG)
 		printf("WARNING: There were outstanding allocations for FixedSizeAllocator of block size %d. Deleting.\n", blockSize);
 #endif
 	}
+
+	UnmapImage();
 }
 
 
@@ -50,6 +123,15 @@ void FixedSizeAllocator::SetInfo(size_t i_blockSize, void* i_memoryStart)
 	numBlocks = GetNumBlocksFromAllocSize(i_blockSize);
 
 	memoryStart = i_memoryStart;
+	imageBase = nullptr;
+	imageSize = 0;
+	sampledBitArray = nullptr;
+	zeroBitArray = nullptr;
+	zeroCursor = 0;
+	memset(&stats, 0, sizeof(stats));
+	currentGeneration = NO_POOL_GENERATION;
+	memset(generationBitArrays, 0, sizeof(generationBitArrays));
+	hasDeferredFrees.store(false, std::memory_order_relaxed);
 
 #ifdef USE_MEMORY_MANAGER
 	fsaBitArray = reinterpret_cast<BitArray*>(globalMemoryManager->alloc(sizeof(BitArray)));
@@ -73,11 +155,23 @@ void* FixedSizeAllocator::Allocate()
 {
 	size_t i_firstAvailable;
 
+	FreeDeferred();
+
 	if (fsaBitArray->GetFirstClearBit(i_firstAvailable))
 	{
 		// mark it in use because we're going to allocate it to user
 		fsaBitArray->SetBit(i_firstAvailable);
 
+		if (sampledBitArray != nullptr)
+			SampleBlock(i_firstAvailable);
+
+		// the user is going to write over it, so it no longer counts as zeroed
+		if (zeroBitArray != nullptr)
+			zeroBitArray->ClearBit(i_firstAvailable);
+
+		if (currentGeneration != NO_POOL_GENERATION)
+			generationBitArrays[currentGeneration]->SetBit(i_firstAvailable);
+
 		// calculate its address and return it to user
 		return static_cast<char*>(memoryStart) + (i_firstAvailable * blockSize);
 	}
@@ -87,6 +181,72 @@ void* FixedSizeAllocator::Allocate()
 	}
 }
 
+//Allocates a block picked uniformly from the free blocks, to spread allocations across the pool.
+//Requires the rank index, see EnableRankIndex.
+void* FixedSizeAllocator::AllocateRandom(size_t i_random)
+{
+	size_t i_available;
+
+	FreeDeferred();
+
+	if (fsaBitArray->GetRandomClearBit(i_random, i_available))
+	{
+		fsaBitArray->SetBit(i_available);
+
+		if (sampledBitArray != nullptr)
+			SampleBlock(i_available);
+
+		if (zeroBitArray != nullptr)
+			zeroBitArray->ClearBit(i_available);
+
+		if (currentGeneration != NO_POOL_GENERATION)
+			generationBitArrays[currentGeneration]->SetBit(i_available);
+
+		return static_cast<char*>(memoryStart) + (i_available * blockSize);
+	}
+	else
+	{
+		return nullptr;
+	}
+}
+
+//Allocates a block that is guaranteed to be all zeroes. Blocks known to be zero already are handed out
+//first, so the memset only happens when the pool has none left.
+void* FixedSizeAllocator::AllocateZeroed()
+{
+	FreeDeferred();
+
+	if (zeroBitArray != nullptr)
+	{
+		size_t i_zeroAvailable;
+
+		if (fsaBitArray->GetFirstClearBitMasked(*zeroBitArray, true, 0, i_zeroAvailable))
+		{
+			fsaBitArray->SetBit(i_zeroAvailable);
+			zeroBitArray->ClearBit(i_zeroAvailable);
+
+			if (sampledBitArray != nullptr)
+				SampleBlock(i_zeroAvailable);
+
+			if (currentGeneration != NO_POOL_GENERATION)
+				generationBitArrays[currentGeneration]->SetBit(i_zeroAvailable);
+
+			stats.zeroedAllocationsSkipped++;
+			return static_cast<char*>(memoryStart) + (i_zeroAvailable * blockSize);
+		}
+	}
+
+	void* block = Allocate();
+	if (block != nullptr)
+	{
+		memset(block, 0, blockSize);
+		stats.zeroedAllocationsMemset++;
+		stats.bytesZeroedOnAllocate += blockSize;
+	}
+
+	return block;
+}
+
 void FixedSizeAllocator::Free(void* i_ptr)
 {
 	if (!IsPointerInRange(i_ptr))
@@ -104,9 +264,237 @@ void FixedSizeAllocator::Free(void* i_ptr)
 		return;
 	}
 
+	//only blocks the profiler sampled need to be looked up on free
+	if (sampledBitArray != nullptr && sampledBitArray->IsBitSet(bitOffset))
+	{
+		sampledBitArray->ClearBit(bitOffset);
+		globalHeapProfiler.RecordFree(i_ptr);
+	}
+
+	for (size_t g = 0; g < MAX_POOL_GENERATIONS; g++)
+	{
+		if (generationBitArrays[g] != nullptr)
+			generationBitArrays[g]->ClearBit(bitOffset);
+	}
+
 	fsaBitArray->ClearBit(bitOffset);
 }
 
+//Tags every block allocated from now on with generation i_generation (e.g. the current round),
+//so ReleaseGeneration can free them all at once. NO_POOL_GENERATION stops tagging.
+void FixedSizeAllocator::SetCurrentGeneration(size_t i_generation)
+{
+	if (i_generation != NO_POOL_GENERATION && i_generation >= MAX_POOL_GENERATIONS)
+	{
+		printf("Generation %zu is out of range.\n", i_generation);
+		return;
+	}
+
+	if (i_generation != NO_POOL_GENERATION && generationBitArrays[i_generation] == nullptr)
+	{
+#ifdef USE_MEMORY_MANAGER
+		generationBitArrays[i_generation] = reinterpret_cast<BitArray*>(globalMemoryManager->alloc(sizeof(BitArray)));
+		generationBitArrays[i_generation]->SetInfo(numBlocks);
+#else
+		generationBitArrays[i_generation] = new BitArray(numBlocks);
+#endif
+	}
+
+	currentGeneration = i_generation;
+}
+
+size_t FixedSizeAllocator::GetCurrentGeneration() const
+{
+	return currentGeneration;
+}
+
+//Frees every block still live from generation i_generation with word-wide bitmap operations,
+//without walking the objects. Nothing is destructed, so only use this for trivially destructible data.
+//Don't also RetireDeferred blocks from a generation you release; the deferred Free could hit a reused block.
+void FixedSizeAllocator::ReleaseGeneration(size_t i_generation)
+{
+	if (i_generation >= MAX_POOL_GENERATIONS || generationBitArrays[i_generation] == nullptr)
+		return;
+
+	BitArray* generation = generationBitArrays[i_generation];
+
+	//the profiler still has to hear about each sampled block, which is rare enough to do one by one
+	if (sampledBitArray != nullptr)
+	{
+		const size_t* generationWords = generation->GetWords();
+		const size_t* sampledWords = sampledBitArray->GetWords();
+
+		for (size_t i = 0; i < generation->GetNumWords(); i++)
+		{
+			size_t sampled = generationWords[i] & sampledWords[i];
+
+			for (size_t j = 0; sampled != 0; j++, sampled >>= 1)
+			{
+				if (sampled & 1)
+					globalHeapProfiler.RecordFree(static_cast<char*>(memoryStart) + ((i * BITS_PER_BYTE + j) * blockSize));
+			}
+		}
+
+		sampledBitArray->ClearBits(*generation);
+	}
+
+	fsaBitArray->ClearBits(*generation);
+	generation->ClearAll();
+}
+
+//Lets globalHeapProfiler sample this pool's allocations. Sampled blocks are remembered in a bitmap
+//so Free only has to talk to the profiler for those.
+void FixedSizeAllocator::EnableProfiling()
+{
+	if (sampledBitArray != nullptr)
+		return;
+
+#ifdef USE_MEMORY_MANAGER
+	sampledBitArray = reinterpret_cast<BitArray*>(globalMemoryManager->alloc(sizeof(BitArray)));
+	sampledBitArray->SetInfo(numBlocks);
+#else
+	sampledBitArray = new BitArray(numBlocks);
+#endif
+}
+
+//Counts a freshly allocated block against the sampling budget and records it if it was picked
+void FixedSizeAllocator::SampleBlock(size_t i_block)
+{
+	if (globalHeapProfiler.ShouldSample(blockSize))
+	{
+		sampledBitArray->SetBit(i_block);
+		globalHeapProfiler.RecordAllocation(static_cast<char*>(memoryStart) + (i_block * blockSize), blockSize);
+	}
+}
+
+//Frees the block once every thread registered with globalEpochManager has passed a quiescent point,
+//so lock-free readers on other threads never see it reused under them. The pool must outlive the block's retirement.
+void FixedSizeAllocator::RetireDeferred(void* i_ptr)
+{
+	if (!IsPointerInRange(i_ptr))
+	{
+		printf("Pointer is not in range.\n");
+		return;
+	}
+
+	globalEpochManager.Retire(this, i_ptr);
+}
+
+//Called by the epoch manager, from whichever thread is reclaiming, once a retired block is safe to reuse.
+//The pool isn't thread safe, so the block only gets queued here and the thread using the pool frees it.
+void FixedSizeAllocator::HandBackDeferred(void* i_ptr)
+{
+	std::lock_guard<std::mutex> lock(deferredMutex);
+	deferredFrees.push_back(i_ptr);
+	hasDeferredFrees.store(true, std::memory_order_release);
+}
+
+//Frees the blocks the epoch manager handed back. Must run on the thread using the pool; Allocate does it for you.
+void FixedSizeAllocator::FreeDeferred()
+{
+	if (!hasDeferredFrees.load(std::memory_order_acquire))
+		return;
+
+	std::lock_guard<std::mutex> lock(deferredMutex);
+
+	for (size_t i = 0; i < deferredFrees.size(); i++)
+		Free(deferredFrees[i]);
+
+	deferredFrees.clear();
+	hasDeferredFrees.store(false, std::memory_order_relaxed);
+}
+
+//Starts tracking which free blocks are known to be zero. Pass true when the pool's memory is fresh
+//from the OS (mmap/VirtualAlloc), since those pages are zero without anyone touching them.
+void FixedSizeAllocator::EnableZeroTracking(bool i_memoryIsZero)
+{
+	if (zeroBitArray != nullptr)
+		return;
+
+#ifdef USE_MEMORY_MANAGER
+	zeroBitArray = reinterpret_cast<BitArray*>(globalMemoryManager->alloc(sizeof(BitArray)));
+	zeroBitArray->SetInfo(numBlocks);
+#else
+	zeroBitArray = new BitArray(numBlocks);
+#endif
+
+	if (i_memoryIsZero)
+	{
+		//live blocks have already been handed out, only the free ones are still untouched
+		for (size_t i = 0; i < numBlocks; i++)
+		{
+			if (fsaBitArray->IsBitClear(i))
+				zeroBitArray->SetBit(i);
+		}
+	}
+}
+
+//Zeroes up to i_maxBlocks free, dirty blocks so later AllocateZeroed calls don't have to.
+//Meant for idle time at the end of a frame; picks up where the last call left off.
+//Returns how many blocks were zeroed.
+size_t FixedSizeAllocator::ZeroFreeBlocks(size_t i_maxBlocks)
+{
+	if (zeroBitArray == nullptr)
+		return 0;
+
+	size_t zeroed = 0;
+	bool wrapped = false;
+
+	while (zeroed < i_maxBlocks)
+	{
+		size_t i_dirty;
+
+		if (!fsaBitArray->GetFirstClearBitMasked(*zeroBitArray, false, zeroCursor, i_dirty))
+		{
+			if (wrapped || zeroCursor == 0)
+				break;
+
+			zeroCursor = 0;
+			wrapped = true;
+			continue;
+		}
+
+		memset(static_cast<char*>(memoryStart) + (i_dirty * blockSize), 0, blockSize);
+		zeroBitArray->SetBit(i_dirty);
+		zeroCursor = i_dirty + 1;
+		zeroed++;
+	}
+
+	stats.blocksZeroedInBackground += zeroed;
+	stats.bytesZeroedInBackground += zeroed * blockSize;
+
+	return zeroed;
+}
+
+const FixedSizeAllocator::PoolStats& FixedSizeAllocator::GetStats() const
+{
+	return stats;
+}
+
+//Builds the rank/select index over the block bitmap so random allocation and live counts are cheap
+void FixedSizeAllocator::EnableRankIndex()
+{
+	fsaBitArray->EnableRankIndex();
+}
+
+//Gets how many blocks are live below the given address, e.g. for deciding whether to compact
+size_t FixedSizeAllocator::GetLiveBlocksBelow(void* i_ptr)
+{
+	if (static_cast<char*>(i_ptr) <= memoryStart)
+		return 0;
+
+	if (!IsPointerInRange(i_ptr))
+		return fsaBitArray->CountSet();
+
+	size_t pointerDifference = static_cast<char*>(i_ptr) - static_cast<char*>(memoryStart);
+	return fsaBitArray->Rank(pointerDifference / blockSize);
+}
+
+size_t FixedSizeAllocator::GetBlockSize() const
+{
+	return blockSize;
+}
+
 //Gets the size that we set aside for this FSA
 size_t FixedSizeAllocator::GetReservedSize()
 {
@@ -127,6 +515,220 @@ bool FixedSizeAllocator::IsPointerInRange(void* i_ptr)
 	}
 }
 
+//Registers a pointer field inside one of our blocks that points at another of our blocks.
+//SaveImage stores these as offsets and LoadImage turns them back into pointers. The field is always
+//treated as 8 bytes, so on 32 bit builds pointer fields have to be padded out to 64 bits.
+void FixedSizeAllocator::AddRelocation(void** i_field)
+{
+	if (!IsPointerInRange(i_field))
+	{
+		printf("Relocation field is not in range.\n");
+		return;
+	}
+
+	relocations.push_back(reinterpret_cast<char*>(i_field) - static_cast<char*>(memoryStart));
+}
+
+void FixedSizeAllocator::ClearRelocations()
+{
+	relocations.clear();
+}
+
+//Writes the block memory and bitmap out so LoadImage can map them back in one call
+bool FixedSizeAllocator::SaveImage(const char* i_path)
+{
+	FILE* file = fopen(i_path, "wb");
+	if (file == nullptr)
+	{
+		printf("Could not open pool image %s for writing.\n", i_path);
+		return false;
+	}
+
+	PoolImageHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = POOL_IMAGE_MAGIC;
+	header.version = POOL_IMAGE_VERSION;
+	header.blockSize = blockSize;
+	header.numBlocks = numBlocks;
+	header.numWords = fsaBitArray->GetNumWords();
+	header.numRelocations = relocations.size();
+	header.bitmapOffset = sizeof(PoolImageHeader);
+	header.relocationsOffset = header.bitmapOffset + header.numWords * sizeof(size_t);
+	header.blocksOffset = (header.relocationsOffset + header.numRelocations * sizeof(uint64_t) + POOL_IMAGE_ALIGNMENT - 1) & ~(POOL_IMAGE_ALIGNMENT - 1);
+	header.fileSize = header.blocksOffset + GetReservedSize();
+
+	//pointer fields are written as (offset + 1) so that nullptr stays 0
+	std::vector<char> blocks(static_cast<char*>(memoryStart), static_cast<char*>(memoryStart) + GetReservedSize());
+
+	for (size_t i = 0; i < relocations.size(); i++)
+	{
+		uint64_t field;
+		memcpy(&field, &blocks[relocations[i]], sizeof(field));
+		char* target = reinterpret_cast<char*>(static_cast<uintptr_t>(field));
+		uint64_t stored = 0;
+
+		if (target != nullptr)
+		{
+			if (IsPointerInRange(target))
+				stored = (target - static_cast<char*>(memoryStart)) + 1;
+			else
+				printf("Relocation at offset %zu points outside the pool. Saving as null.\n", relocations[i]);
+		}
+
+		memcpy(&blocks[relocations[i]], &stored, sizeof(stored));
+	}
+
+	std::vector<uint64_t> relocationTable(relocations.begin(), relocations.end());
+
+	char padding[POOL_IMAGE_ALIGNMENT] = {};
+	size_t paddingSize = header.blocksOffset - (header.relocationsOffset + header.numRelocations * sizeof(uint64_t));
+
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(fsaBitArray->GetWords(), sizeof(size_t), header.numWords, file) == header.numWords &&
+		fwrite(relocationTable.data(), sizeof(uint64_t), header.numRelocations, file) == header.numRelocations &&
+		fwrite(padding, 1, paddingSize, file) == paddingSize &&
+		fwrite(blocks.data(), 1, GetReservedSize(), file) == GetReservedSize();
+
+	fclose(file);
+
+	if (!written)
+		printf("Failed writing pool image %s.\n", i_path);
+
+	return written;
+}
+
+//Maps a saved pool image in as this allocator's memory. The mapping is copy-on-write, so pages are only
+//read from disk when touched and the file is never modified. Whatever the allocator had mapped before is
+//dropped. Turn on profiling, zero tracking or generations after loading, as they are sized to the pool.
+bool FixedSizeAllocator::LoadImage(const char* i_path)
+{
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(i_path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(file, &fileSize);
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (mapping == nullptr)
+		return false;
+
+	void* mapped = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping);
+	if (mapped == nullptr)
+		return false;
+
+	size_t mappedSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+	int fd = open(i_path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat fileInfo;
+	if (fstat(fd, &fileInfo) != 0 || fileInfo.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	size_t mappedSize = fileInfo.st_size;
+	void* mapped = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+		return false;
+#endif
+
+	//check everything the header points at before touching the image, so a corrupt or foreign file can't make us write out of bounds
+	const PoolImageHeader* header = static_cast<const PoolImageHeader*>(mapped);
+	bool valid = mappedSize >= sizeof(PoolImageHeader) && header->magic == POOL_IMAGE_MAGIC &&
+		header->version == POOL_IMAGE_VERSION && header->fileSize == mappedSize &&
+		header->blockSize != 0 && header->numBlocks != 0 && header->numWords == header->numBlocks / BITS_PER_BYTE &&
+		header->bitmapOffset >= sizeof(PoolImageHeader) && header->bitmapOffset % sizeof(size_t) == 0 &&
+		ImageRangeFits(header->bitmapOffset, header->numWords, sizeof(size_t), mappedSize) &&
+		header->relocationsOffset % sizeof(uint64_t) == 0 &&
+		ImageRangeFits(header->relocationsOffset, header->numRelocations, sizeof(uint64_t), mappedSize) &&
+		ImageRangeFits(header->blocksOffset, header->numBlocks, header->blockSize, mappedSize);
+
+	char* blocks = static_cast<char*>(mapped) + (valid ? header->blocksOffset : 0);
+	const uint64_t* relocationTable = reinterpret_cast<const uint64_t*>(static_cast<char*>(mapped) + (valid ? header->relocationsOffset : 0));
+	uint64_t reservedSize = valid ? header->blockSize * header->numBlocks : 0;
+
+	//every fixup must be an 8 byte field inside the blocks, pointing at a block or null
+	for (uint64_t i = 0; valid && i < header->numRelocations; i++)
+	{
+		valid = reservedSize >= sizeof(uint64_t) && relocationTable[i] <= reservedSize - sizeof(uint64_t);
+
+		if (valid)
+		{
+			uint64_t stored;
+			memcpy(&stored, blocks + relocationTable[i], sizeof(stored));
+			valid = stored <= reservedSize;
+		}
+	}
+
+	if (!valid)
+	{
+		printf("Pool image %s is invalid.\n", i_path);
+		UnmapImageRegion(mapped, mappedSize);
+		return false;
+	}
+
+	//the new image replaces what we had
+	if (fsaBitArray == nullptr)
+	{
+#ifdef USE_MEMORY_MANAGER
+		fsaBitArray = reinterpret_cast<BitArray*>(globalMemoryManager->alloc(sizeof(BitArray)));
+#else
+		fsaBitArray = new BitArray();
+#endif
+	}
+	else
+	{
+		//reuse the old bit array, its words are freed here unless they lived in the old image
+		fsaBitArray->~BitArray();
+	}
+
+	UnmapImage();
+
+	imageBase = mapped;
+	imageSize = mappedSize;
+	blockSize = header->blockSize;
+	numBlocks = header->numBlocks;
+	memoryStart = blocks;
+
+	fsaBitArray->SetInfo(numBlocks, reinterpret_cast<size_t*>(static_cast<char*>(imageBase) + header->bitmapOffset));
+
+	//turn the stored offsets back into pointers for wherever the image landed this time
+	relocations.clear();
+
+	for (size_t i = 0; i < header->numRelocations; i++)
+	{
+		char* field = blocks + relocationTable[i];
+		uint64_t stored;
+		memcpy(&stored, field, sizeof(stored));
+
+		uint64_t target = stored ? reinterpret_cast<uintptr_t>(blocks) + (stored - 1) : 0;
+		memcpy(field, &target, sizeof(target));
+
+		relocations.push_back(relocationTable[i]);
+	}
+
+	return true;
+}
+
+void FixedSizeAllocator::UnmapImage()
+{
+	if (imageBase == nullptr)
+		return;
+
+	UnmapImageRegion(imageBase, imageSize);
+
+	imageBase = nullptr;
+	imageSize = 0;
+}
+
 //This gets the number of blocks based on alloc size
 size_t FixedSizeAllocator::GetNumBlocksFromAllocSize(size_t l_blockSize)
 {
@@ -0,0 +1,319 @@
+#include "HeapProfiler.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#include <execinfo.h>
+#endif
+
+#pragma warning( disable : 4267) //conversion from size_t to unsigned long
+
+//t_bytesUntilSample holds this before a thread's first interval is drawn
+const int64_t SAMPLE_INTERVAL_NOT_DRAWN = INT64_MIN;
+
+//Bytes left before this thread takes its next sample
+static thread_local int64_t t_bytesUntilSample = SAMPLE_INTERVAL_NOT_DRAWN;
+static thread_local uint64_t t_randomState = 0;
+
+//Set while a thread is inside the profiler so allocations the profiler itself makes aren't sampled
+static thread_local bool t_insideProfiler = false;
+
+HeapProfiler globalHeapProfiler;
+
+
+HeapProfiler::HeapProfiler()
+{
+	enabled.store(false, std::memory_order_relaxed);
+	sampleInterval.store(DEFAULT_SAMPLE_INTERVAL, std::memory_order_relaxed);
+	liveSamples.store(0, std::memory_order_relaxed);
+}
+
+HeapProfiler::~HeapProfiler()
+{
+}
+
+//Starts sampling roughly once every i_sampleInterval allocated bytes
+void HeapProfiler::Enable(size_t i_sampleInterval)
+{
+	sampleInterval.store(i_sampleInterval, std::memory_order_relaxed);
+	enabled.store(true, std::memory_order_release);
+}
+
+void HeapProfiler::Disable()
+{
+	enabled.store(false, std::memory_order_release);
+}
+
+bool HeapProfiler::IsEnabled() const
+{
+	return enabled.load(std::memory_order_relaxed);
+}
+
+//The hot path. Counts i_size bytes against this thread's sampling budget and says whether this
+//allocation should be recorded. Intervals are exponentially distributed, so samples form a Poisson
+//process over allocated bytes and small allocations can't hide behind a fixed stride.
+bool HeapProfiler::ShouldSample(size_t i_size)
+{
+	if (!enabled.load(std::memory_order_relaxed) || t_insideProfiler)
+		return false;
+
+	//a thread's first allocation counts against a random interval too, or every thread would start with a sample
+	if (t_bytesUntilSample == SAMPLE_INTERVAL_NOT_DRAWN)
+		t_bytesUntilSample = NextSampleInterval();
+
+	t_bytesUntilSample -= static_cast<int64_t>(i_size);
+	if (t_bytesUntilSample >= 0)
+		return false;
+
+	t_bytesUntilSample = NextSampleInterval();
+	return true;
+}
+
+//Records a sampled allocation with the current call stack
+void HeapProfiler::RecordAllocation(void* i_ptr, size_t i_size)
+{
+	if (i_ptr == nullptr)
+		return;
+
+	t_insideProfiler = true;
+
+	void* frames[MAX_STACK_DEPTH];
+	size_t depth = CaptureStack(frames, MAX_STACK_DEPTH);
+
+	//each sample stands in for all the bytes that could have been sampled instead of it
+	double interval = static_cast<double>(sampleInterval.load(std::memory_order_relaxed));
+	double scale = 1.0 / (1.0 - exp(-static_cast<double>(i_size) / interval));
+
+	{
+		std::lock_guard<std::mutex> lock(profileMutex);
+
+		size_t stackIndex = FindOrAddStack(frames, depth);
+		StackRecord& record = stacks[stackIndex];
+		record.liveCount += scale;
+		record.liveBytes += scale * i_size;
+		record.totalCount += scale;
+		record.totalBytes += scale * i_size;
+
+		LiveSample sample;
+		sample.stackIndex = stackIndex;
+		sample.size = i_size;
+		sample.scale = scale;
+		liveAllocations[i_ptr] = sample;
+	}
+
+	liveSamples.fetch_add(1, std::memory_order_relaxed);
+	t_insideProfiler = false;
+}
+
+//Tells the profiler a pointer was freed. Callers that track which blocks were sampled (like
+//FixedSizeAllocator) only call this for those, others can call it for everything.
+void HeapProfiler::RecordFree(void* i_ptr)
+{
+	if (liveSamples.load(std::memory_order_relaxed) == 0)
+		return;
+
+	t_insideProfiler = true;
+
+	{
+		std::lock_guard<std::mutex> lock(profileMutex);
+
+		std::unordered_map<void*, LiveSample>::iterator it = liveAllocations.find(i_ptr);
+		if (it != liveAllocations.end())
+		{
+			StackRecord& record = stacks[it->second.stackIndex];
+			record.liveCount -= it->second.scale;
+			record.liveBytes -= it->second.scale * it->second.size;
+
+			liveAllocations.erase(it);
+			liveSamples.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+
+	t_insideProfiler = false;
+}
+
+//Drops all recorded samples, e.g. between matches
+void HeapProfiler::Reset()
+{
+	std::lock_guard<std::mutex> lock(profileMutex);
+
+	stacks.clear();
+	stackLookup.clear();
+	liveAllocations.clear();
+	liveSamples.store(0, std::memory_order_relaxed);
+}
+
+//Writes one line per call stack, "outermost;...;innermost bytes", for flame graph tools.
+//i_live picks the live view (what is allocated now) over the cumulative view (everything ever allocated).
+bool HeapProfiler::WriteFoldedStacks(const char* i_path, bool i_live)
+{
+	FILE* file = fopen(i_path, "w");
+	if (file == nullptr)
+		return false;
+
+	t_insideProfiler = true;
+	std::lock_guard<std::mutex> lock(profileMutex);
+
+	char symbol[256];
+
+	for (size_t i = 0; i < stacks.size(); i++)
+	{
+		const StackRecord& record = stacks[i];
+		double bytes = i_live ? record.liveBytes : record.totalBytes;
+		if (bytes < 0.5)
+			continue;
+
+		//frames are captured innermost first
+		for (size_t f = record.depth; f > 0; f--)
+		{
+			SymbolizeFrame(record.frames[f - 1], symbol, sizeof(symbol));
+			fprintf(file, f == record.depth ? "%s" : ";%s", symbol);
+		}
+
+		fprintf(file, " %llu\n", static_cast<unsigned long long>(bytes + 0.5));
+	}
+
+	fclose(file);
+	t_insideProfiler = false;
+	return true;
+}
+
+//Writes the legacy pprof heap profile text format, which `pprof <binary> <file>` reads and symbolizes
+bool HeapProfiler::WritePprofHeapProfile(const char* i_path)
+{
+	FILE* file = fopen(i_path, "w");
+	if (file == nullptr)
+		return false;
+
+	t_insideProfiler = true;
+	std::lock_guard<std::mutex> lock(profileMutex);
+
+	double liveCount = 0.0, liveBytes = 0.0, totalCount = 0.0, totalBytes = 0.0;
+	for (size_t i = 0; i < stacks.size(); i++)
+	{
+		liveCount += stacks[i].liveCount;
+		liveBytes += stacks[i].liveBytes;
+		totalCount += stacks[i].totalCount;
+		totalBytes += stacks[i].totalBytes;
+	}
+
+	fprintf(file, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%llu\n",
+		static_cast<unsigned long long>(liveCount + 0.5), static_cast<unsigned long long>(liveBytes + 0.5),
+		static_cast<unsigned long long>(totalCount + 0.5), static_cast<unsigned long long>(totalBytes + 0.5),
+		static_cast<unsigned long long>(sampleInterval.load(std::memory_order_relaxed)));
+
+	for (size_t i = 0; i < stacks.size(); i++)
+	{
+		const StackRecord& record = stacks[i];
+
+		fprintf(file, "%llu: %llu [%llu: %llu] @",
+			static_cast<unsigned long long>(record.liveCount + 0.5), static_cast<unsigned long long>(record.liveBytes + 0.5),
+			static_cast<unsigned long long>(record.totalCount + 0.5), static_cast<unsigned long long>(record.totalBytes + 0.5));
+
+		for (size_t f = 0; f < record.depth; f++)
+			fprintf(file, " %p", record.frames[f]);
+
+		fprintf(file, "\n");
+	}
+
+#if defined(__linux__)
+	//pprof needs the mappings to turn addresses into symbols
+	fprintf(file, "\nMAPPED_LIBRARIES:\n");
+	FILE* maps = fopen("/proc/self/maps", "r");
+	if (maps != nullptr)
+	{
+		char line[512];
+		while (fgets(line, sizeof(line), maps) != nullptr)
+			fputs(line, file);
+
+		fclose(maps);
+	}
+#endif
+
+	fclose(file);
+	t_insideProfiler = false;
+	return true;
+}
+
+//Draws the next distance between samples from an exponential distribution with mean sampleInterval
+int64_t HeapProfiler::NextSampleInterval()
+{
+	if (t_randomState == 0)
+		t_randomState = reinterpret_cast<uint64_t>(&t_randomState) ^ 0x9E3779B97F4A7C15ULL;
+
+	//xorshift64*, good enough for spacing samples
+	t_randomState ^= t_randomState >> 12;
+	t_randomState ^= t_randomState << 25;
+	t_randomState ^= t_randomState >> 27;
+	uint64_t random = t_randomState * 0x2545F4914F6CDD1DULL;
+
+	//53 random bits into (0, 1]
+	double uniform = (static_cast<double>(random >> 11) + 1.0) / 9007199254740992.0;
+	double interval = -log(uniform) * static_cast<double>(sampleInterval.load(std::memory_order_relaxed));
+
+	return static_cast<int64_t>(interval);
+}
+
+size_t HeapProfiler::CaptureStack(void** o_frames, size_t i_maxDepth)
+{
+#if defined(_WIN32)
+	return CaptureStackBackTrace(STACK_FRAMES_TO_SKIP, static_cast<DWORD>(i_maxDepth), o_frames, nullptr);
+#else
+	void* frames[MAX_STACK_DEPTH + STACK_FRAMES_TO_SKIP];
+	int depth = backtrace(frames, static_cast<int>(i_maxDepth + STACK_FRAMES_TO_SKIP));
+
+	if (depth <= static_cast<int>(STACK_FRAMES_TO_SKIP))
+		return 0;
+
+	memcpy(o_frames, frames + STACK_FRAMES_TO_SKIP, (depth - STACK_FRAMES_TO_SKIP) * sizeof(void*));
+	return depth - STACK_FRAMES_TO_SKIP;
+#endif
+}
+
+//Interns a call stack so identical stacks share one record. Expects profileMutex to be held.
+size_t HeapProfiler::FindOrAddStack(void** i_frames, size_t i_depth)
+{
+	uint64_t hash = 14695981039346656037ULL; //FNV-1a over the frame addresses
+	for (size_t i = 0; i < i_depth; i++)
+	{
+		hash ^= reinterpret_cast<uint64_t>(i_frames[i]);
+		hash *= 1099511628211ULL;
+	}
+
+	std::unordered_multimap<uint64_t, size_t>::iterator it = stackLookup.find(hash);
+	for (; it != stackLookup.end() && it->first == hash; ++it)
+	{
+		const StackRecord& record = stacks[it->second];
+		if (record.depth == i_depth && memcmp(record.frames, i_frames, i_depth * sizeof(void*)) == 0)
+			return it->second;
+	}
+
+	StackRecord record;
+	memset(&record, 0, sizeof(record));
+	memcpy(record.frames, i_frames, i_depth * sizeof(void*));
+	record.depth = i_depth;
+
+	stacks.push_back(record);
+	stackLookup.insert(std::make_pair(hash, stacks.size() - 1));
+	return stacks.size() - 1;
+}
+
+void HeapProfiler::SymbolizeFrame(void* i_frame, char* o_symbol, size_t i_symbolSize)
+{
+#if !defined(_WIN32)
+	Dl_info info;
+	if (dladdr(i_frame, &info) != 0 && info.dli_sname != nullptr)
+	{
+		snprintf(o_symbol, i_symbolSize, "%s", info.dli_sname);
+		return;
+	}
+#endif
+
+	snprintf(o_symbol, i_symbolSize, "%p", i_frame);
+}
@@ -0,0 +1,197 @@
+#include "PoolMemoryResource.h"
+#include "FixedSizeAllocator.h"
+
+#include <stdio.h>
+
+//Blocks come back at multiples of the block size from the pool's start, so they can serve any
+//alignment the block size is a multiple of (up to the pool's own alignment)
+static inline bool BlockFitsAlignment(size_t i_blockSize, size_t i_alignment)
+{
+	return i_alignment <= alignof(std::max_align_t) && (i_blockSize % i_alignment) == 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// FixedSizePoolResource
+
+FixedSizePoolResource::FixedSizePoolResource(FixedSizeAllocator* i_pool, std::pmr::memory_resource* i_upstream)
+{
+	pool = i_pool;
+	upstream = i_upstream;
+}
+
+void* FixedSizePoolResource::do_allocate(size_t i_bytes, size_t i_alignment)
+{
+	if (i_bytes <= pool->GetBlockSize() && BlockFitsAlignment(pool->GetBlockSize(), i_alignment))
+	{
+		void* block = pool->Allocate();
+		if (block != nullptr)
+			return block;
+	}
+
+	//too big, oddly aligned or the pool ran dry
+	return upstream->allocate(i_bytes, i_alignment);
+}
+
+void FixedSizePoolResource::do_deallocate(void* i_ptr, size_t i_bytes, size_t i_alignment)
+{
+	if (pool->IsPointerInRange(i_ptr))
+	{
+		pool->Free(i_ptr);
+	}
+	else
+	{
+		upstream->deallocate(i_ptr, i_bytes, i_alignment);
+	}
+}
+
+bool FixedSizePoolResource::do_is_equal(const std::pmr::memory_resource& i_other) const noexcept
+{
+	return this == &i_other;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// SizeClassMemoryResource
+
+//i_pools must be sorted by block size, smallest first, e.g. the 16/32/96 byte size classes
+SizeClassMemoryResource::SizeClassMemoryResource(FixedSizeAllocator** i_pools, size_t i_numPools, std::pmr::memory_resource* i_upstream)
+{
+	if (i_numPools > MAX_SIZE_CLASSES)
+	{
+		printf("Too many size classes, only using the first %zu.\n", MAX_SIZE_CLASSES);
+		i_numPools = MAX_SIZE_CLASSES;
+	}
+
+	numPools = i_numPools;
+	for (size_t i = 0; i < numPools; i++)
+		pools[i] = i_pools[i];
+
+	upstream = i_upstream;
+}
+
+void* SizeClassMemoryResource::do_allocate(size_t i_bytes, size_t i_alignment)
+{
+	//first class that fits; if it's full, the next class up can still take it
+	for (size_t i = 0; i < numPools; i++)
+	{
+		size_t blockSize = pools[i]->GetBlockSize();
+
+		if (i_bytes <= blockSize && BlockFitsAlignment(blockSize, i_alignment))
+		{
+			void* block = pools[i]->Allocate();
+			if (block != nullptr)
+				return block;
+		}
+	}
+
+	return upstream->allocate(i_bytes, i_alignment);
+}
+
+void SizeClassMemoryResource::do_deallocate(void* i_ptr, size_t i_bytes, size_t i_alignment)
+{
+	for (size_t i = 0; i < numPools; i++)
+	{
+		if (pools[i]->IsPointerInRange(i_ptr))
+		{
+			pools[i]->Free(i_ptr);
+			return;
+		}
+	}
+
+	upstream->deallocate(i_ptr, i_bytes, i_alignment);
+}
+
+bool SizeClassMemoryResource::do_is_equal(const std::pmr::memory_resource& i_other) const noexcept
+{
+	return this == &i_other;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// FrameMemoryResource
+
+//Bump allocates out of i_buffer and throws everything away at once with Reset, e.g. every frame.
+//If the buffer runs out, extra chunks come from upstream and are given back on Reset.
+FrameMemoryResource::FrameMemoryResource(void* i_buffer, size_t i_bufferSize, std::pmr::memory_resource* i_upstream)
+{
+	bufferStart = static_cast<char*>(i_buffer);
+	bufferSize = i_bufferSize;
+	upstream = i_upstream;
+
+	current = bufferStart;
+	end = bufferStart + bufferSize;
+	overflowChunks = nullptr;
+	overflowBytes = 0;
+	highWaterMark = 0;
+}
+
+FrameMemoryResource::~FrameMemoryResource()
+{
+	Reset();
+}
+
+//Releases everything allocated since the last Reset. Nothing is destructed.
+void FrameMemoryResource::Reset()
+{
+	//once we've overflowed, current points into a chunk and says nothing about the buffer
+	size_t used = (overflowChunks == nullptr) ? static_cast<size_t>(current - bufferStart) : bufferSize + overflowBytes;
+	if (used > highWaterMark)
+		highWaterMark = used;
+	overflowBytes = 0;
+
+	while (overflowChunks != nullptr)
+	{
+		OverflowChunk* next = overflowChunks->next;
+		upstream->deallocate(overflowChunks, overflowChunks->size, alignof(std::max_align_t));
+		overflowChunks = next;
+	}
+
+	current = bufferStart;
+	end = bufferStart + bufferSize;
+}
+
+//Gets the most buffer space any frame has used, to help size the buffer.
+//Frames that overflowed count as the whole buffer plus what they took from the overflow chunks.
+size_t FrameMemoryResource::GetHighWaterMark() const
+{
+	return highWaterMark;
+}
+
+void* FrameMemoryResource::do_allocate(size_t i_bytes, size_t i_alignment)
+{
+	char* aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(current) + i_alignment - 1) & ~(static_cast<uintptr_t>(i_alignment) - 1));
+
+	if (aligned + i_bytes > end)
+	{
+		//start a new chunk at least as big as the original buffer so overflow stays rare
+		size_t chunkSize = sizeof(OverflowChunk) + i_bytes + i_alignment;
+		if (chunkSize < bufferSize)
+			chunkSize = bufferSize;
+
+		OverflowChunk* chunk = static_cast<OverflowChunk*>(upstream->allocate(chunkSize, alignof(std::max_align_t)));
+		chunk->next = overflowChunks;
+		chunk->size = chunkSize;
+		overflowChunks = chunk;
+
+		current = reinterpret_cast<char*>(chunk + 1);
+		end = reinterpret_cast<char*>(chunk) + chunkSize;
+		aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(current) + i_alignment - 1) & ~(static_cast<uintptr_t>(i_alignment) - 1));
+	}
+
+	if (overflowChunks != nullptr)
+		overflowBytes += static_cast<size_t>(aligned + i_bytes - current);
+
+	current = aligned + i_bytes;
+	return aligned;
+}
+
+void FrameMemoryResource::do_deallocate(void* i_ptr, size_t i_bytes, size_t i_alignment)
+{
+	//individual frees are no-ops, Reset releases everything
+}
+
+bool FrameMemoryResource::do_is_equal(const std::pmr::memory_resource& i_other) const noexcept
+{
+	return this == &i_other;
+}
@@ -0,0 +1,383 @@
+#include "SharedFixedSizeAllocator.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#pragma warning( disable : 4334) //<< result of 32 bit shift implicity converted to 64 bits
+
+//The bitmap lives inside the shared region, so the atomics must not rely on a process-local lock
+static_assert(std::atomic<size_t>::is_always_lock_free, "Shared pool bitmap needs lock-free atomics");
+
+const uint32_t SHARED_POOL_MAGIC = 0x4C4F4F50; //"POOL"
+const uint32_t SHARED_POOL_VERSION = 1;
+
+//Everything in the header is an offset or a count, never a pointer, so every process can map the region anywhere.
+//Layout of the region: [SharedPoolHeader][bitmap words][blocks]
+//magic is written last, so a process that sees it also sees the rest of the header.
+struct SharedPoolHeader
+{
+	std::atomic<uint32_t> magic;
+	uint32_t version;
+	size_t blockSize;
+	size_t numBlocks;
+	size_t numWords;
+	size_t bitmapOffset;
+	size_t blocksOffset;
+	size_t regionSize;
+	std::atomic<size_t> liveBlocks;
+};
+
+//Rounds up to the next multiple of i_alignment (power of two)
+static inline size_t AlignUp(size_t i_value, size_t i_alignment)
+{
+	return (i_value + i_alignment - 1) & ~(i_alignment - 1);
+}
+
+
+SharedFixedSizeAllocator::SharedFixedSizeAllocator()
+{
+	header = nullptr;
+	regionBase = nullptr;
+	regionSize = 0;
+	nextWordHint = 0;
+	ownsName = false;
+	name[0] = '\0';
+#if defined(_WIN32)
+	mappingHandle = nullptr;
+#else
+	fd = -1;
+#endif
+}
+
+SharedFixedSizeAllocator::~SharedFixedSizeAllocator()
+{
+	Close();
+}
+
+//Creates a new shared pool. If i_name is null the region is anonymous (memfd) and can be handed to
+//another process through GetFileDescriptor, otherwise other processes can attach with Open(i_name).
+bool SharedFixedSizeAllocator::Create(const char* i_name, size_t i_blockSize, size_t i_numBlocks)
+{
+	if (i_blockSize == 0 || i_numBlocks == 0)
+		return false;
+
+	size_t numWords = (i_numBlocks + BITS_PER_BYTE - 1) / BITS_PER_BYTE;
+	size_t bitmapOffset = AlignUp(sizeof(SharedPoolHeader), CACHE_LINE_SIZE);
+	size_t blocksOffset = AlignUp(bitmapOffset + numWords * sizeof(size_t), CACHE_LINE_SIZE);
+	size_t totalSize = blocksOffset + i_blockSize * i_numBlocks;
+
+	if (!MapRegion(i_name, totalSize, true))
+		return false;
+
+	//the region comes back zero-filled, so the bitmap already reads as all-free
+	header = new (regionBase) SharedPoolHeader;
+	header->version = SHARED_POOL_VERSION;
+	header->blockSize = i_blockSize;
+	header->numBlocks = i_numBlocks;
+	header->numWords = numWords;
+	header->bitmapOffset = bitmapOffset;
+	header->blocksOffset = blocksOffset;
+	header->regionSize = totalSize;
+	header->liveBlocks.store(0, std::memory_order_relaxed);
+
+	//bits past the last block are marked used so Allocate never hands them out
+	size_t tailBits = numWords * BITS_PER_BYTE - i_numBlocks;
+	if (tailBits > 0)
+	{
+		size_t tailMask = ~static_cast<size_t>(0) << (BITS_PER_BYTE - tailBits);
+		GetBitmap()[numWords - 1].store(tailMask, std::memory_order_relaxed);
+	}
+
+	//publish, pairs with the acquire load in ValidateHeader
+	header->magic.store(SHARED_POOL_MAGIC, std::memory_order_release);
+	return true;
+}
+
+//Attaches to a pool another process created with a name
+bool SharedFixedSizeAllocator::Open(const char* i_name)
+{
+	if (i_name == nullptr)
+		return false;
+
+	if (!MapRegion(i_name, 0, false))
+		return false;
+
+	return ValidateHeader();
+}
+
+#if !defined(_WIN32)
+//Attaches to a pool through a descriptor inherited or received from the creating process
+bool SharedFixedSizeAllocator::OpenFileDescriptor(int i_fd)
+{
+	struct stat fileInfo;
+	if (fstat(i_fd, &fileInfo) != 0 || fileInfo.st_size < static_cast<off_t>(sizeof(SharedPoolHeader)))
+		return false;
+
+	void* mapped = mmap(nullptr, fileInfo.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, i_fd, 0);
+	if (mapped == MAP_FAILED)
+		return false;
+
+	fd = dup(i_fd);
+	regionBase = mapped;
+	regionSize = fileInfo.st_size;
+
+	return ValidateHeader();
+}
+
+int SharedFixedSizeAllocator::GetFileDescriptor() const
+{
+	return fd;
+}
+#endif
+
+void SharedFixedSizeAllocator::Close()
+{
+	if (regionBase == nullptr)
+		return;
+
+#if defined(_WIN32)
+	UnmapViewOfFile(regionBase);
+	CloseHandle(mappingHandle);
+	mappingHandle = nullptr;
+#else
+	munmap(regionBase, regionSize);
+	close(fd);
+	fd = -1;
+
+	if (ownsName)
+		shm_unlink(name);
+#endif
+
+	header = nullptr;
+	regionBase = nullptr;
+	regionSize = 0;
+	ownsName = false;
+	name[0] = '\0';
+}
+
+//Allocates a block. Safe to call from any thread in any process that has the region mapped.
+void* SharedFixedSizeAllocator::Allocate()
+{
+	std::atomic<size_t>* bitmap = GetBitmap();
+	size_t numWords = header->numWords;
+
+	//start where this process last found space so processes don't all fight over word 0
+	for (size_t n = 0; n < numWords; n++)
+	{
+		size_t index = (nextWordHint + n) % numWords;
+		size_t word = bitmap[index].load(std::memory_order_relaxed);
+
+		while (word != HEX_BYTE_MAX_SIZE)
+		{
+			size_t bitLocation = 0;
+			while ((word >> bitLocation) & static_cast<size_t>(1))
+				bitLocation++;
+
+			size_t bit = static_cast<size_t>(1) << bitLocation;
+			if (bitmap[index].compare_exchange_weak(word, word | bit, std::memory_order_acquire, std::memory_order_relaxed))
+			{
+				nextWordHint = index;
+				header->liveBlocks.fetch_add(1, std::memory_order_relaxed);
+				return GetBlocks() + ((index * BITS_PER_BYTE + bitLocation) * header->blockSize);
+			}
+			//word was reloaded by the failed exchange, try again
+		}
+	}
+
+	return nullptr;
+}
+
+void SharedFixedSizeAllocator::Free(void* i_ptr)
+{
+	if (!IsPointerInRange(i_ptr))
+	{
+		printf("Pointer is not in range.\n");
+		return;
+	}
+
+	size_t blockIndex = (static_cast<char*>(i_ptr) - GetBlocks()) / header->blockSize;
+	size_t bit = static_cast<size_t>(1) << (blockIndex % BITS_PER_BYTE);
+
+	//release so the block's contents are published before another process can reuse it
+	size_t previous = GetBitmap()[blockIndex / BITS_PER_BYTE].fetch_and(~bit, std::memory_order_release);
+
+	//If our bit was not set, then we didn't have anything to free
+	if (previous & bit)
+		header->liveBlocks.fetch_sub(1, std::memory_order_relaxed);
+}
+
+//Converts a block pointer into an offset that means the same block in every process
+size_t SharedFixedSizeAllocator::ToOffset(const void* i_ptr) const
+{
+	return static_cast<const char*>(i_ptr) - static_cast<const char*>(regionBase);
+}
+
+//Converts an offset received from another process back into a local pointer
+void* SharedFixedSizeAllocator::FromOffset(size_t i_offset) const
+{
+	if (i_offset < header->blocksOffset || i_offset >= header->regionSize)
+		return nullptr;
+
+	return static_cast<char*>(regionBase) + i_offset;
+}
+
+bool SharedFixedSizeAllocator::IsPointerInRange(const void* i_ptr) const
+{
+	const char* blocks = GetBlocks();
+
+	return static_cast<const char*>(i_ptr) >= blocks &&
+		static_cast<const char*>(i_ptr) < blocks + (header->blockSize * header->numBlocks);
+}
+
+size_t SharedFixedSizeAllocator::GetBlockSize() const
+{
+	return header->blockSize;
+}
+
+size_t SharedFixedSizeAllocator::GetLiveBlocks() const
+{
+	return header->liveBlocks.load(std::memory_order_relaxed);
+}
+
+std::atomic<size_t>* SharedFixedSizeAllocator::GetBitmap() const
+{
+	return reinterpret_cast<std::atomic<size_t>*>(static_cast<char*>(regionBase) + header->bitmapOffset);
+}
+
+char* SharedFixedSizeAllocator::GetBlocks() const
+{
+	return static_cast<char*>(regionBase) + header->blocksOffset;
+}
+
+//Checks that the region we mapped really is a pool we understand, and that its layout fits in what we mapped
+bool SharedFixedSizeAllocator::ValidateHeader()
+{
+	header = static_cast<SharedPoolHeader*>(regionBase);
+
+	bool valid = header->magic.load(std::memory_order_acquire) == SHARED_POOL_MAGIC && header->version == SHARED_POOL_VERSION;
+
+	if (valid)
+	{
+		size_t poolSize = header->regionSize;
+		size_t blockSize = header->blockSize;
+		size_t numBlocks = header->numBlocks;
+		size_t numWords = header->numWords;
+		size_t bitmapOffset = header->bitmapOffset;
+		size_t blocksOffset = header->blocksOffset;
+
+		//written this way round so none of the checks can overflow
+		valid = poolSize <= regionSize && blockSize != 0 && numBlocks != 0 &&
+			numWords == (numBlocks + BITS_PER_BYTE - 1) / BITS_PER_BYTE &&
+			bitmapOffset >= sizeof(SharedPoolHeader) && bitmapOffset % sizeof(size_t) == 0 &&
+			bitmapOffset <= blocksOffset && numWords <= (blocksOffset - bitmapOffset) / sizeof(size_t) &&
+			blocksOffset <= poolSize && numBlocks <= (poolSize - blocksOffset) / blockSize;
+	}
+
+	if (!valid)
+	{
+		printf("Shared pool header is invalid.\n");
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+//Creates or opens the backing object and maps it. i_size is ignored when opening.
+bool SharedFixedSizeAllocator::MapRegion(const char* i_name, size_t i_size, bool i_create)
+{
+	if (i_name != nullptr)
+	{
+		strncpy(name, i_name, sizeof(name) - 1);
+		name[sizeof(name) - 1] = '\0';
+	}
+
+#if defined(_WIN32)
+	if (i_create)
+	{
+		mappingHandle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+			static_cast<DWORD>(static_cast<uint64_t>(i_size) >> 32), static_cast<DWORD>(i_size), i_name);
+	}
+	else
+	{
+		mappingHandle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, i_name);
+	}
+
+	if (mappingHandle == nullptr)
+		return false;
+
+	regionBase = MapViewOfFile(mappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, i_size);
+	if (regionBase == nullptr)
+	{
+		CloseHandle(mappingHandle);
+		mappingHandle = nullptr;
+		return false;
+	}
+
+	MEMORY_BASIC_INFORMATION info;
+	VirtualQuery(regionBase, &info, sizeof(info));
+	regionSize = info.RegionSize;
+#else
+	if (i_name == nullptr)
+	{
+		fd = memfd_create("FixedSizeAllocator", MFD_CLOEXEC);
+	}
+	else
+	{
+		fd = shm_open(i_name, i_create ? (O_CREAT | O_EXCL | O_RDWR) : O_RDWR, 0600);
+		ownsName = i_create && fd >= 0;
+	}
+
+	if (fd < 0)
+		return false;
+
+	if (i_create)
+	{
+		if (ftruncate(fd, i_size) != 0)
+		{
+			close(fd);
+			fd = -1;
+			if (ownsName)
+				shm_unlink(name);
+			ownsName = false;
+			return false;
+		}
+	}
+	else
+	{
+		struct stat fileInfo;
+		if (fstat(fd, &fileInfo) != 0 || fileInfo.st_size < static_cast<off_t>(sizeof(SharedPoolHeader)))
+		{
+			close(fd);
+			fd = -1;
+			return false;
+		}
+		i_size = fileInfo.st_size;
+	}
+
+	void* mapped = mmap(nullptr, i_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mapped == MAP_FAILED)
+	{
+		close(fd);
+		fd = -1;
+		if (ownsName)
+			shm_unlink(name);
+		ownsName = false;
+		return false;
+	}
+
+	regionBase = mapped;
+	regionSize = i_size;
+#endif
+
+	return true;
+}
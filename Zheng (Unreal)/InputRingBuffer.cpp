@@ -0,0 +1,73 @@
+#include "InputRingBuffer.h"
+
+//////////////////////////////////////////////////////////////////////////
+// InputRingBuffer
+//
+// Fixed-capacity single-producer/single-consumer queue of input events. The producer (the player
+// controller, or an input thread) only writes tail and the consumer (the character's tick) only writes
+// head, so neither side ever takes a lock or allocates.
+
+InputRingBuffer::InputRingBuffer()
+{
+	head.store(0, std::memory_order_relaxed);
+	tail.store(0, std::memory_order_relaxed);
+}
+
+//Producer side. Returns false if the ring is full and the input was dropped.
+bool InputRingBuffer::Push(const ControllerInput& i_input)
+{
+	const uint32_t currentTail = tail.load(std::memory_order_relaxed);
+
+	if (currentTail - head.load(std::memory_order_acquire) >= INPUT_RING_CAPACITY)
+	{
+		return false;
+	}
+
+	events[currentTail & (INPUT_RING_CAPACITY - 1)] = i_input;
+
+	//publish the event before the consumer can see the new tail
+	tail.store(currentTail + 1, std::memory_order_release);
+	return true;
+}
+
+//Consumer side. Pops the oldest input, returns false if there is none.
+bool InputRingBuffer::Pop(ControllerInput& o_input)
+{
+	const uint32_t currentHead = head.load(std::memory_order_relaxed);
+
+	if (currentHead == tail.load(std::memory_order_acquire))
+	{
+		return false;
+	}
+
+	o_input = events[currentHead & (INPUT_RING_CAPACITY - 1)];
+
+	//hand the slot back to the producer only after we've copied it out
+	head.store(currentHead + 1, std::memory_order_release);
+	return true;
+}
+
+//Consumer side. Looks at the oldest input without popping it, returns false if there is none.
+bool InputRingBuffer::Peek(ControllerInput& o_input) const
+{
+	const uint32_t currentHead = head.load(std::memory_order_relaxed);
+
+	if (currentHead == tail.load(std::memory_order_acquire))
+	{
+		return false;
+	}
+
+	o_input = events[currentHead & (INPUT_RING_CAPACITY - 1)];
+	return true;
+}
+
+//Consumer side. Drops everything queued, e.g. when resetting for a round.
+void InputRingBuffer::Clear()
+{
+	head.store(tail.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+bool InputRingBuffer::IsEmpty() const
+{
+	return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+}
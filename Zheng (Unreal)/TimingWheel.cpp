@@ -0,0 +1,218 @@
+#include "TimingWheel.h"
+
+#include <stdio.h>
+
+//////////////////////////////////////////////////////////////////////////
+// TimingWheel
+//
+// Hierarchical timing wheel for tick deadlines. Level 0 has a slot per tick for the next
+// TIMER_WHEEL_SLOTS ticks, each level above covers TIMER_WHEEL_SLOTS times more ticks per slot.
+// Timers live in intrusive lists, so scheduling and cancelling are O(1). A tick only touches the timers
+// firing in it, plus every TIMER_WHEEL_SLOTS ticks one slot of the level above is spread back down.
+
+const uint32_t TIMER_WHEEL_MASK = TIMER_WHEEL_SLOTS - 1;
+const uint32_t TIMER_INDEX_MASK = (1 << TIMER_INDEX_BITS) - 1;
+const int32_t TIMER_NO_NODE = -1;
+const int32_t TIMER_FIRING_SLOT = TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS; //the timers AdvanceTo is firing right now, past the wheel's own slots
+
+TimingWheel::TimingWheel()
+{
+	nextTick = 0;
+	freeList = TIMER_NO_NODE;
+	numScheduled = 0;
+
+	for (int i = 0; i <= TIMER_FIRING_SLOT; i++)
+		slots[i] = TIMER_NO_NODE;
+}
+
+//Makes room for i_capacity timers at once. i_startTick is the first tick AdvanceTo will fire.
+void TimingWheel::Initialize(uint32_t i_capacity, uint32_t i_startTick)
+{
+	if (i_capacity > TIMER_INDEX_MASK)
+	{
+		printf("Timing wheel capacity too large, clamping.\n");
+		i_capacity = TIMER_INDEX_MASK;
+	}
+
+	nodes.resize(i_capacity);
+	for (uint32_t i = 0; i < i_capacity; i++)
+		nodes[i].generation = 0;
+
+	Reset(i_startTick);
+}
+
+//Drops every timer. Handles from before the reset become stale, so cancelling them does nothing.
+void TimingWheel::Reset(uint32_t i_startTick)
+{
+	for (int i = 0; i <= TIMER_FIRING_SLOT; i++)
+		slots[i] = TIMER_NO_NODE;
+
+	freeList = TIMER_NO_NODE;
+	for (size_t i = nodes.size(); i > 0; i--)
+	{
+		TimerNode& node = nodes[i - 1];
+		node.generation++;
+		node.next = freeList;
+		node.slot = TIMER_NO_NODE;
+		freeList = static_cast<int32_t>(i - 1);
+	}
+
+	nextTick = i_startTick;
+	numScheduled = 0;
+}
+
+//Schedules i_payload to be handed to the callback when AdvanceTo reaches i_deadline. Deadlines already
+//passed fire on the next AdvanceTo. Returns TIMER_INVALID_HANDLE if the wheel is full.
+uint32_t TimingWheel::Schedule(uint32_t i_deadline, uint32_t i_payload)
+{
+	if (freeList == TIMER_NO_NODE)
+	{
+		printf("Timing wheel is full.\n");
+		return TIMER_INVALID_HANDLE;
+	}
+
+	int32_t index = freeList;
+	TimerNode& node = nodes[index];
+	freeList = node.next;
+
+	node.deadline = (i_deadline < nextTick) ? nextTick : i_deadline;
+	node.payload = i_payload;
+	Link(index);
+	numScheduled++;
+
+	return (static_cast<uint32_t>(node.generation) << TIMER_INDEX_BITS) | static_cast<uint32_t>(index);
+}
+
+//Cancels a timer that hasn't fired yet. Stale handles (fired, cancelled or reset) are ignored.
+void TimingWheel::Cancel(uint32_t i_handle)
+{
+	if (i_handle == TIMER_INVALID_HANDLE)
+		return;
+
+	uint32_t index = i_handle & TIMER_INDEX_MASK;
+	if (index >= nodes.size())
+		return;
+
+	TimerNode& node = nodes[index];
+	if (node.generation != static_cast<uint16_t>(i_handle >> TIMER_INDEX_BITS) || node.slot == TIMER_NO_NODE)
+		return;
+
+	Unlink(static_cast<int32_t>(index));
+	Free(static_cast<int32_t>(index));
+}
+
+//Fires every timer due up to and including i_tick, in tick order
+void TimingWheel::AdvanceTo(uint32_t i_tick, TimerCallback i_callback, void* i_context)
+{
+	while (nextTick <= i_tick)
+	{
+		//nothing scheduled, nothing to cascade either
+		if (numScheduled == 0)
+		{
+			nextTick = i_tick + 1;
+			return;
+		}
+
+		uint32_t index = nextTick & TIMER_WHEEL_MASK;
+
+		//level 0 wrapped, bring down the next block of timers from above
+		for (int level = 1; level < TIMER_WHEEL_LEVELS && index == 0; level++)
+		{
+			index = (nextTick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+			Cascade(level * TIMER_WHEEL_SLOTS + index);
+		}
+
+		//move the due timers to their own list, so a callback scheduling a timer a full turn of level 0 ahead puts it
+		//back in the wheel rather than in the list being fired, and cancelling one that is still waiting unlinks it from here
+		int32_t slot = nextTick & TIMER_WHEEL_MASK;
+		nextTick++;
+
+		if (slots[slot] == TIMER_NO_NODE)
+			continue;
+
+		slots[TIMER_FIRING_SLOT] = slots[slot];
+		slots[slot] = TIMER_NO_NODE;
+		for (int32_t i = slots[TIMER_FIRING_SLOT]; i != TIMER_NO_NODE; i = nodes[i].next)
+			nodes[i].slot = TIMER_FIRING_SLOT;
+
+		while (slots[TIMER_FIRING_SLOT] != TIMER_NO_NODE)
+		{
+			int32_t current = slots[TIMER_FIRING_SLOT];
+			uint32_t payload = nodes[current].payload;
+
+			//unlink and free first, the callback may want to schedule again
+			Unlink(current);
+			Free(current);
+			i_callback(i_context, payload);
+		}
+	}
+}
+
+uint32_t TimingWheel::GetNumScheduled() const
+{
+	return numScheduled;
+}
+
+//Puts a node in the slot for its deadline: the lowest level whose range still reaches it
+void TimingWheel::Link(int32_t i_index)
+{
+	TimerNode& node = nodes[i_index];
+	uint32_t delta = node.deadline - nextTick;
+	uint32_t deadline = node.deadline;
+	int level = 0;
+
+	while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1u << (TIMER_WHEEL_BITS * (level + 1))))
+		level++;
+
+	//too far out even for the top level, park it as far as we can reach and it gets re-sorted on the way down
+	if (level == TIMER_WHEEL_LEVELS - 1 && delta >= (1u << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+		deadline = nextTick + (1u << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+
+	int32_t slot = level * TIMER_WHEEL_SLOTS + ((deadline >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+
+	node.slot = slot;
+	node.prev = TIMER_NO_NODE;
+	node.next = slots[slot];
+	if (node.next != TIMER_NO_NODE)
+		nodes[node.next].prev = i_index;
+	slots[slot] = i_index;
+}
+
+void TimingWheel::Unlink(int32_t i_index)
+{
+	TimerNode& node = nodes[i_index];
+
+	if (node.prev != TIMER_NO_NODE)
+		nodes[node.prev].next = node.next;
+	else
+		slots[node.slot] = node.next;
+
+	if (node.next != TIMER_NO_NODE)
+		nodes[node.next].prev = node.prev;
+
+	node.slot = TIMER_NO_NODE;
+}
+
+void TimingWheel::Free(int32_t i_index)
+{
+	TimerNode& node = nodes[i_index];
+	node.generation++;
+	node.slot = TIMER_NO_NODE;
+	node.next = freeList;
+	freeList = i_index;
+	numScheduled--;
+}
+
+//Re-sorts every timer in a slot of an upper level into the levels below it
+void TimingWheel::Cascade(int32_t i_slot)
+{
+	int32_t current = slots[i_slot];
+	slots[i_slot] = TIMER_NO_NODE;
+
+	while (current != TIMER_NO_NODE)
+	{
+		int32_t next = nodes[current].next;
+		Link(current);
+		current = next;
+	}
+}
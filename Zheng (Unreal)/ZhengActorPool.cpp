@@ -0,0 +1,161 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "ZhengActorPool.h"
+#include "Engine/World.h"
+#include "GameFramework/ProjectileMovementComponent.h"
+
+//////////////////////////////////////////////////////////////////////////
+// ZhengActorPool
+//
+// Keeps spawned actors of one class around for reuse instead of destroying them. Free actors sit
+// hidden, out of the way, with collision and ticking off, so handing one out is a teleport and a few
+// flags rather than a spawn. Giving one back leaves nothing behind for the garbage collector.
+// The actors stay owned by the level, so the pool only has to forget them when play ends. The pool
+// isn't a UObject, so it holds them weakly: one destroyed while parked just reads back as null.
+// Nothing here gives an actor a lifespan; whoever acquires one is the one who hands it back.
+
+const FVector POOL_PARKING_LOCATION(0.0f, 0.0f, -100000.0f);
+
+ZhengActorPool::ZhengActorPool()
+{
+	world = nullptr;
+	actorClass = nullptr;
+}
+
+//Spawns i_count hidden actors of i_actorClass up front
+void ZhengActorPool::Initialize(UWorld* i_world, TSubclassOf<AActor> i_actorClass, int i_count)
+{
+	Shutdown();
+
+	world = i_world;
+	actorClass = i_actorClass;
+
+	if (world == nullptr || actorClass == nullptr)
+		return;
+
+	freeActors.Reserve(i_count);
+	for (int i = 0; i < i_count; i++)
+	{
+		AActor* actor = SpawnParked();
+		if (actor != nullptr)
+		{
+			freeActors.Push(actor);
+			parkedActors.Add(actor);
+		}
+	}
+}
+
+//Forgets every free actor. The level destroys them along with everything else.
+void ZhengActorPool::Shutdown()
+{
+	freeActors.Reset();
+	parkedActors.Reset();
+	world = nullptr;
+	actorClass = nullptr;
+}
+
+//Hands out a free actor placed at i_location, spawning another if they're all in use.
+//Returns nullptr only if the pool was never initialized.
+AActor* ZhengActorPool::Acquire(const FVector& i_location, const FRotator& i_rotation, AActor* i_owner)
+{
+	AActor* actor = nullptr;
+
+	while (actor == nullptr && freeActors.Num() > 0)
+	{
+		TWeakObjectPtr<AActor> parked = freeActors.Pop(false);
+		parkedActors.Remove(parked);
+		actor = parked.Get();
+
+		//something destroyed it while it was parked
+		if (!IsValid(actor))
+			actor = nullptr;
+	}
+
+	if (actor == nullptr)
+	{
+		if (world == nullptr || actorClass == nullptr)
+			return nullptr;
+
+		actor = SpawnParked();
+		if (actor == nullptr)
+			return nullptr;
+	}
+
+	actor->SetOwner(i_owner);
+	actor->SetActorLocationAndRotation(i_location, i_rotation, false, nullptr, ETeleportType::TeleportPhysics);
+	actor->SetActorHiddenInGame(false);
+	actor->SetActorEnableCollision(true);
+	actor->SetActorTickEnabled(true);
+
+	UProjectileMovementComponent* movement = actor->FindComponentByClass<UProjectileMovementComponent>();
+	if (movement != nullptr)
+	{
+		//stopping the simulation let go of the root, so hook it back up
+		movement->SetUpdatedComponent(actor->GetRootComponent());
+		movement->Activate(true);
+	}
+
+	return actor;
+}
+
+//Takes an actor back. It's reset right away, so it must not be touched again until handed out anew.
+void ZhengActorPool::Release(AActor* i_actor)
+{
+	if (!IsValid(i_actor))
+		return;
+
+	//already parked, e.g. given back twice in one frame
+	bool alreadyParked = false;
+	parkedActors.Add(i_actor, &alreadyParked);
+	if (alreadyParked)
+		return;
+
+	Park(i_actor);
+	freeActors.Push(i_actor);
+}
+
+//Free actors that are still around to hand out
+int ZhengActorPool::GetNumFree() const
+{
+	int numFree = 0;
+	for (const TWeakObjectPtr<AActor>& actor : freeActors)
+	{
+		if (actor.IsValid())
+			numFree++;
+	}
+
+	return numFree;
+}
+
+AActor* ZhengActorPool::SpawnParked()
+{
+	FActorSpawnParameters spawnParams;
+	spawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+
+	AActor* actor = world->SpawnActor<AActor>(actorClass, POOL_PARKING_LOCATION, FRotator::ZeroRotator, spawnParams);
+	if (actor != nullptr)
+	{
+		Park(actor);
+	}
+
+	return actor;
+}
+
+//Puts an actor back the way a fresh one waits: still, hidden, untouchable and not ticking
+void ZhengActorPool::Park(AActor* i_actor)
+{
+	UProjectileMovementComponent* movement = i_actor->FindComponentByClass<UProjectileMovementComponent>();
+	if (movement != nullptr)
+	{
+		movement->StopMovementImmediately();
+		movement->HomingTargetComponent = nullptr;
+		movement->Deactivate();
+	}
+
+	i_actor->SetLifeSpan(0.0f);
+	i_actor->SetActorTickEnabled(false);
+	i_actor->SetActorEnableCollision(false);
+	i_actor->SetActorHiddenInGame(true);
+	i_actor->SetActorLocation(POOL_PARKING_LOCATION, false, nullptr, ETeleportType::TeleportPhysics);
+	i_actor->SetOwner(nullptr);
+}
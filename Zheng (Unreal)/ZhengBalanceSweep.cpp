@@ -0,0 +1,612 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+//////////////////////////////////////////////////////////////////////////
+// Balance sweep
+//
+// Standalone program, built outside the game module together with ZhengSimulation.cpp and ZhengPackedState.cpp.
+// Plays bot-vs-bot matches headless for every combination of tuning values in a parameter grid, spread over
+// all cores, and writes win rates, round lengths and damage numbers to CSV.
+//
+// usage: ZhengBalanceSweep <grid file> <output.csv> [matches per setting] [threads]
+//
+// The grid file has one parameter per line, either a list of values or first:last:step, e.g.
+//     DashWalkSpeed 600 800 1000
+//     DashCooldownTime 0.2:1.0:0.1
+//     Bot1Skill 0.25 0.5
+// Lines starting with # are ignored. Besides the ZhengTuning fields, Bot0Skill and Bot1Skill (0 to 1) set how
+// sharp each bot plays. Next to output.csv, output_rounds.csv and output_damage.csv get the full round length
+// and hit damage distributions.
+//
+// Fighter timers (DashMaxTime, BlockTime and the like) are capped at SIM_MAX_TIMER_TICKS, 8 seconds, so sweeping
+// them any further changes nothing.
+
+#include "ZhengSimulation.h"
+
+#include <atomic>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#pragma warning( disable : 4996) //fopen and strtok are fine here
+
+const int SWEEP_MATCHES_PER_JOB = 8;
+const int SWEEP_MAX_DAMAGE = 64; //hits doing more land in the last bucket
+const int SWEEP_ROUND_BUCKET_SECONDS = 1;
+const int SWEEP_MAX_ROUND_BUCKETS = 256;
+const float SWEEP_MAX_BATTLE_SECONDS = 15.0f * 60.0f; //a battle running longer than this counts as a draw
+
+enum class SweepParameterType : uint8_t
+{
+	Float,
+	Int,
+	BotSkill
+};
+
+struct SweepParameterInfo
+{
+	const char* name;
+	SweepParameterType type;
+	size_t offset;
+};
+
+//Tuning fields the grid can change
+static const SweepParameterInfo SWEEP_PARAMETERS[] =
+{
+	{ "MaxHealth", SweepParameterType::Int, offsetof(ZhengTuning, MaxHealth) },
+	{ "DefaultWalkSpeed", SweepParameterType::Float, offsetof(ZhengTuning, DefaultWalkSpeed) },
+	{ "DashWalkSpeed", SweepParameterType::Float, offsetof(ZhengTuning, DashWalkSpeed) },
+	{ "DashMaxTime", SweepParameterType::Float, offsetof(ZhengTuning, DashMaxTime) },
+	{ "DashEndingTime", SweepParameterType::Float, offsetof(ZhengTuning, DashEndingTime) },
+	{ "DashCooldownTime", SweepParameterType::Float, offsetof(ZhengTuning, DashCooldownTime) },
+	{ "AttackEndingTime", SweepParameterType::Float, offsetof(ZhengTuning, AttackEndingTime) },
+	{ "ForwardWalkSpeedMod", SweepParameterType::Float, offsetof(ZhengTuning, ForwardWalkSpeedMod) },
+	{ "SideWalkSpeedMod", SweepParameterType::Float, offsetof(ZhengTuning, SideWalkSpeedMod) },
+	{ "BlockTime", SweepParameterType::Float, offsetof(ZhengTuning, BlockTime) },
+	{ "DoublePressTimingWindow", SweepParameterType::Float, offsetof(ZhengTuning, DoublePressTimingWindow) },
+	{ "StrumToCommandTime", SweepParameterType::Float, offsetof(ZhengTuning, StrumToCommandTime) },
+	{ "BeatsPerMinute", SweepParameterType::Float, offsetof(ZhengTuning, BeatsPerMinute) },
+	{ "GeneralScaler", SweepParameterType::Float, offsetof(ZhengTuning, GeneralScaler) },
+	{ "BaseDamage", SweepParameterType::Int, offsetof(ZhengTuning, BaseDamage) },
+	{ "NumRoundsToWin", SweepParameterType::Int, offsetof(ZhengTuning, NumRoundsToWin) },
+	{ "RoundTime", SweepParameterType::Float, offsetof(ZhengTuning, RoundTime) },
+	{ "ArenaRadius", SweepParameterType::Float, offsetof(ZhengTuning, ArenaRadius) },
+	{ "SpawnDistance", SweepParameterType::Float, offsetof(ZhengTuning, SpawnDistance) },
+	{ "AttackSpeed", SweepParameterType::Float, offsetof(ZhengTuning, AttackSpeed) },
+	{ "AttackHitRadius", SweepParameterType::Float, offsetof(ZhengTuning, AttackHitRadius) },
+	{ "AttackLifetime", SweepParameterType::Float, offsetof(ZhengTuning, AttackLifetime) },
+	{ "PushbackDistance", SweepParameterType::Float, offsetof(ZhengTuning, PushbackDistance) },
+	{ "Gravity", SweepParameterType::Float, offsetof(ZhengTuning, Gravity) },
+	{ "Bot0Skill", SweepParameterType::BotSkill, 0 },
+	{ "Bot1Skill", SweepParameterType::BotSkill, 1 },
+};
+
+struct SweepAxis
+{
+	const SweepParameterInfo* parameter;
+	std::vector<float> values;
+};
+
+//One point in the grid
+struct SweepSetting
+{
+	ZhengTuning tuning;
+	float botSkill[2];
+	std::vector<float> values;
+};
+
+//What a batch of matches added up to. Jobs fill their own, and they get summed per setting at the end.
+struct SweepResult
+{
+	uint32_t matches;
+	uint32_t wins[2];
+	uint32_t draws;
+	uint32_t rounds;
+	uint64_t roundTicks;
+	uint32_t hits;
+	uint32_t blockedHits;
+	uint64_t damage;
+	uint32_t roundLengths[SWEEP_MAX_ROUND_BUCKETS];
+	uint32_t hitDamage[SWEEP_MAX_DAMAGE + 1];
+};
+
+struct SweepJob
+{
+	size_t setting;
+	uint32_t firstMatch;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// SweepBot
+//
+// Plays like a middling human: keeps its distance, circles, strums a few components on the beat and
+// launches them, and dashes out of the way of incoming attacks. Skill is how reliably it does each of those.
+
+class SweepBot
+{
+public:
+	void Initialize(int i_fighter, float i_skill, uint64_t i_seed)
+	{
+		fighter = i_fighter;
+		skill = i_skill;
+		randomState = i_seed | 1;
+		strafeDirection = SimInput::Left;
+		nextStrafeChangeTick = 0;
+		dashTapTick = SIM_NEVER;
+		dashDirection = SimInput::Left;
+		componentsWanted = 1;
+		lastHeld = 0;
+	}
+
+	SimInputFrame Think(const ZhengSimulation& i_simulation)
+	{
+		const ZhengArenaState& arena = i_simulation.GetArena();
+		const ZhengArenaFighter& body = arena.bodies[fighter];
+		const ZhengArenaFighter& target = arena.bodies[body.target];
+		const ZhengFighterState& state = i_simulation.GetFighter(fighter).GetState();
+		uint32_t tick = arena.tick;
+
+		uint8_t held = 0;
+		uint8_t pressed = 0;
+
+		//keep at a comfortable range and circle
+		float dx = target.x - body.x;
+		float dy = target.y - body.y;
+		float distance = sqrtf(dx * dx + dy * dy);
+
+		if (distance > 900.0f)
+			held |= Bit(SimInput::Up);
+		else if (distance < 450.0f)
+			held |= Bit(SimInput::Down);
+
+		if (tick >= nextStrafeChangeTick)
+		{
+			strafeDirection = (NextRandom() & 1) ? SimInput::Left : SimInput::Right;
+			nextStrafeChangeTick = tick + SIM_TICKS_PER_SECOND / 2 + NextRandom() % (2 * SIM_TICKS_PER_SECOND);
+		}
+		held |= Bit(strafeDirection);
+
+		//second tap of a dash
+		if (dashTapTick != SIM_NEVER && tick >= dashTapTick)
+		{
+			pressed |= Bit(dashDirection);
+			dashTapTick = SIM_NEVER;
+		}
+		else if (dashTapTick == SIM_NEVER && !state.dashing && !state.dashOnCooldown && IncomingAttack(arena) && Chance(skill * 0.2f))
+		{
+			dashDirection = (NextRandom() & 1) ? SimInput::Left : SimInput::Right;
+			pressed |= Bit(dashDirection);
+			dashTapTick = tick + 2 + NextRandom() % 4;
+		}
+
+		//strum on the beat
+		SimBeat beat = i_simulation.GetBeatAtTick(tick);
+		bool onBeat = beat.elapsed < 0.1f || beat.remaining < 0.05f;
+		if (!state.beatConsumed && !state.strumming && (onBeat || Chance((1.0f - skill) * 0.02f)) && Chance(0.3f + skill * 0.5f))
+		{
+			if (state.numAttackComponents >= componentsWanted)
+			{
+				//all four at once launches what we've built
+				pressed |= Bit(SimInput::Physical) | Bit(SimInput::Magical) | Bit(SimInput::Pushback) | Bit(SimInput::Special);
+				componentsWanted = 1 + NextRandom() % 3;
+			}
+			else
+			{
+				static const SimInput components[] = { SimInput::Physical, SimInput::Physical, SimInput::Magical, SimInput::Magical, SimInput::Pushback, SimInput::Special };
+				pressed |= Bit(components[NextRandom() % (sizeof(components) / sizeof(components[0]))]);
+			}
+		}
+
+		//a direction only counts as pressed the tick it goes down
+		pressed |= held & ~lastHeld;
+		lastHeld = held;
+
+		SimInputFrame input;
+		memset(&input, 0, sizeof(input));
+		input.held = held | pressed;
+		input.pressed = pressed;
+		return input;
+	}
+
+private:
+	static uint8_t Bit(SimInput i_input)
+	{
+		return static_cast<uint8_t>(1 << static_cast<int>(i_input));
+	}
+
+	bool IncomingAttack(const ZhengArenaState& i_arena) const
+	{
+		const ZhengArenaFighter& body = i_arena.bodies[fighter];
+
+		for (int i = 0; i < SIM_MAX_PROJECTILES; i++)
+		{
+			const ZhengArenaProjectile& projectile = i_arena.projectiles[i];
+			if (!projectile.active || projectile.target != fighter)
+				continue;
+
+			float dx = projectile.x - body.x;
+			float dy = projectile.y - body.y;
+			if (dx * dx + dy * dy < 500.0f * 500.0f)
+				return true;
+		}
+
+		return false;
+	}
+
+	uint32_t NextRandom()
+	{
+		randomState ^= randomState << 13;
+		randomState ^= randomState >> 7;
+		randomState ^= randomState << 17;
+		return static_cast<uint32_t>(randomState >> 32);
+	}
+
+	bool Chance(float i_probability)
+	{
+		return (NextRandom() % 10000) < static_cast<uint32_t>(i_probability * 10000.0f);
+	}
+
+	int fighter;
+	float skill;
+	uint64_t randomState;
+	SimInput strafeDirection;
+	uint32_t nextStrafeChangeTick;
+	uint32_t dashTapTick;
+	SimInput dashDirection;
+	int componentsWanted;
+	uint8_t lastHeld;
+};
+
+
+//Plays one whole battle and adds it to o_result
+static void PlayMatch(const SweepSetting& i_setting, uint64_t i_seed, ZhengSimulation& io_simulation, SweepResult& o_result)
+{
+	io_simulation.Initialize(i_setting.tuning, 2);
+
+	SweepBot bots[2];
+	for (int i = 0; i < 2; i++)
+		bots[i].Initialize(i, i_setting.botSkill[i], i_seed * 2 + i + 1);
+
+	uint32_t maxTicks = SecondsToTicks(SWEEP_MAX_BATTLE_SECONDS);
+	uint32_t roundStartTick = 0;
+	uint16_t roundNumber = 0;
+
+	while (!io_simulation.GetRound().IsBattleOver() && io_simulation.GetArena().tick < maxTicks)
+	{
+		SimInputFrame inputs[2];
+		for (int i = 0; i < 2; i++)
+			inputs[i] = bots[i].Think(io_simulation);
+
+		io_simulation.Step(inputs);
+
+		for (int i = 0; i < io_simulation.GetNumHits(); i++)
+		{
+			const ZhengHitResult& hit = io_simulation.GetHit(i).result;
+			o_result.hits++;
+
+			if (hit.blocked)
+			{
+				o_result.blockedHits++;
+				continue;
+			}
+
+			o_result.damage += hit.damage;
+			o_result.hitDamage[(hit.damage < SWEEP_MAX_DAMAGE) ? hit.damage : SWEEP_MAX_DAMAGE]++;
+		}
+
+		if (io_simulation.GetRound().GetState().roundNumber != roundNumber)
+		{
+			uint32_t roundTicks = io_simulation.GetArena().tick - roundStartTick;
+			size_t bucket = roundTicks / (SWEEP_ROUND_BUCKET_SECONDS * SIM_TICKS_PER_SECOND);
+
+			o_result.rounds++;
+			o_result.roundTicks += roundTicks;
+			o_result.roundLengths[(bucket < SWEEP_MAX_ROUND_BUCKETS) ? bucket : SWEEP_MAX_ROUND_BUCKETS - 1]++;
+
+			roundNumber = io_simulation.GetRound().GetState().roundNumber;
+			roundStartTick = io_simulation.GetArena().tick;
+		}
+	}
+
+	o_result.matches++;
+
+	if (io_simulation.GetRound().IsBattleOver())
+		o_result.wins[io_simulation.GetRound().GetState().battleWinner]++;
+	else
+		o_result.draws++;
+}
+
+static const SweepParameterInfo* FindParameter(const char* i_name)
+{
+	for (size_t i = 0; i < sizeof(SWEEP_PARAMETERS) / sizeof(SWEEP_PARAMETERS[0]); i++)
+	{
+		if (strcmp(SWEEP_PARAMETERS[i].name, i_name) == 0)
+			return &SWEEP_PARAMETERS[i];
+	}
+
+	return nullptr;
+}
+
+static bool ReadGrid(const char* i_path, std::vector<SweepAxis>& o_axes)
+{
+	FILE* file = fopen(i_path, "r");
+	if (file == nullptr)
+	{
+		printf("Couldn't open the grid file %s.\n", i_path);
+		return false;
+	}
+
+	char line[1024];
+	while (fgets(line, sizeof(line), file) != nullptr)
+	{
+		char* name = strtok(line, " \t\r\n");
+		if (name == nullptr || name[0] == '#')
+			continue;
+
+		SweepAxis axis;
+		axis.parameter = FindParameter(name);
+		if (axis.parameter == nullptr)
+		{
+			printf("Unknown parameter %s.\n", name);
+			fclose(file);
+			return false;
+		}
+
+		for (char* value = strtok(nullptr, " \t\r\n"); value != nullptr; value = strtok(nullptr, " \t\r\n"))
+		{
+			float first, last, step;
+			if (sscanf(value, "%f:%f:%f", &first, &last, &step) == 3 && step > 0.0f)
+			{
+				//count the steps instead of adding them up, so the last value doesn't get lost to rounding
+				int numSteps = static_cast<int>((last - first) / step + 0.5f);
+				for (int i = 0; i <= numSteps; i++)
+					axis.values.push_back(first + step * i);
+			}
+			else
+			{
+				axis.values.push_back(static_cast<float>(atof(value)));
+			}
+		}
+
+		if (axis.values.empty())
+		{
+			printf("No values for %s.\n", name);
+			fclose(file);
+			return false;
+		}
+
+		o_axes.push_back(axis);
+	}
+
+	fclose(file);
+	return true;
+}
+
+//Expands the axes into every combination, the last axis changing fastest
+static void BuildSettings(const std::vector<SweepAxis>& i_axes, std::vector<SweepSetting>& o_settings)
+{
+	size_t numSettings = 1;
+	for (size_t i = 0; i < i_axes.size(); i++)
+		numSettings *= i_axes[i].values.size();
+
+	for (size_t index = 0; index < numSettings; index++)
+	{
+		SweepSetting setting;
+		setting.botSkill[0] = 0.5f;
+		setting.botSkill[1] = 0.5f;
+
+		size_t remainder = index;
+		setting.values.resize(i_axes.size());
+
+		for (size_t i = i_axes.size(); i > 0; i--)
+		{
+			const SweepAxis& axis = i_axes[i - 1];
+			float value = axis.values[remainder % axis.values.size()];
+			remainder /= axis.values.size();
+			setting.values[i - 1] = value;
+
+			char* field = reinterpret_cast<char*>(&setting.tuning) + axis.parameter->offset;
+			switch (axis.parameter->type)
+			{
+			case SweepParameterType::Float:
+				*reinterpret_cast<float*>(field) = value;
+				break;
+			case SweepParameterType::Int:
+				*reinterpret_cast<int*>(field) = static_cast<int>(value + 0.5f);
+				break;
+			case SweepParameterType::BotSkill:
+				setting.botSkill[axis.parameter->offset] = value;
+				break;
+			}
+		}
+
+		o_settings.push_back(setting);
+	}
+}
+
+static void AddResult(SweepResult& io_total, const SweepResult& i_result)
+{
+	io_total.matches += i_result.matches;
+	io_total.wins[0] += i_result.wins[0];
+	io_total.wins[1] += i_result.wins[1];
+	io_total.draws += i_result.draws;
+	io_total.rounds += i_result.rounds;
+	io_total.roundTicks += i_result.roundTicks;
+	io_total.hits += i_result.hits;
+	io_total.blockedHits += i_result.blockedHits;
+	io_total.damage += i_result.damage;
+
+	for (int i = 0; i < SWEEP_MAX_ROUND_BUCKETS; i++)
+		io_total.roundLengths[i] += i_result.roundLengths[i];
+	for (int i = 0; i <= SWEEP_MAX_DAMAGE; i++)
+		io_total.hitDamage[i] += i_result.hitDamage[i];
+}
+
+//Round length in seconds that i_fraction of rounds finished within
+static float RoundLengthPercentile(const SweepResult& i_result, float i_fraction)
+{
+	uint32_t wanted = static_cast<uint32_t>(ceilf(i_result.rounds * i_fraction));
+	uint32_t seen = 0;
+
+	for (int i = 0; i < SWEEP_MAX_ROUND_BUCKETS; i++)
+	{
+		seen += i_result.roundLengths[i];
+		if (seen >= wanted && seen > 0)
+			return static_cast<float>((i + 1) * SWEEP_ROUND_BUCKET_SECONDS);
+	}
+
+	return 0.0f;
+}
+
+static bool WriteResults(const char* i_path, const std::vector<SweepAxis>& i_axes, const std::vector<SweepSetting>& i_settings, const std::vector<SweepResult>& i_results)
+{
+	std::string basePath(i_path);
+	size_t extension = basePath.rfind(".csv");
+	if (extension != std::string::npos)
+		basePath.resize(extension);
+
+	FILE* summary = fopen(i_path, "w");
+	FILE* rounds = fopen((basePath + "_rounds.csv").c_str(), "w");
+	FILE* damage = fopen((basePath + "_damage.csv").c_str(), "w");
+
+	if (summary == nullptr || rounds == nullptr || damage == nullptr)
+	{
+		printf("Couldn't open the output files next to %s.\n", i_path);
+		if (summary) fclose(summary);
+		if (rounds) fclose(rounds);
+		if (damage) fclose(damage);
+		return false;
+	}
+
+	fprintf(summary, "setting");
+	for (size_t i = 0; i < i_axes.size(); i++)
+		fprintf(summary, ",%s", i_axes[i].parameter->name);
+	fprintf(summary, ",matches,p0_win_rate,p1_win_rate,draw_rate,rounds_per_match,mean_round_seconds,p10_round_seconds,p50_round_seconds,p90_round_seconds,hits_per_round,blocked_rate,mean_hit_damage\n");
+
+	fprintf(rounds, "setting,round_seconds,rounds\n");
+	fprintf(damage, "setting,hit_damage,hits\n");
+
+	for (size_t s = 0; s < i_settings.size(); s++)
+	{
+		const SweepResult& result = i_results[s];
+		double matches = (result.matches > 0) ? result.matches : 1.0;
+		double roundCount = (result.rounds > 0) ? result.rounds : 1.0;
+		uint32_t landedHits = result.hits - result.blockedHits;
+
+		fprintf(summary, "%zu", s);
+		for (size_t i = 0; i < i_axes.size(); i++)
+			fprintf(summary, ",%g", i_settings[s].values[i]);
+
+		fprintf(summary, ",%u,%.4f,%.4f,%.4f,%.3f,%.3f,%.0f,%.0f,%.0f,%.3f,%.4f,%.3f\n",
+			result.matches, result.wins[0] / matches, result.wins[1] / matches, result.draws / matches,
+			result.rounds / matches, result.roundTicks / roundCount * SIM_TICK_SECONDS,
+			RoundLengthPercentile(result, 0.1f), RoundLengthPercentile(result, 0.5f), RoundLengthPercentile(result, 0.9f),
+			result.hits / roundCount, (result.hits > 0) ? static_cast<double>(result.blockedHits) / result.hits : 0.0,
+			(landedHits > 0) ? static_cast<double>(result.damage) / landedHits : 0.0);
+
+		for (int i = 0; i < SWEEP_MAX_ROUND_BUCKETS; i++)
+		{
+			if (result.roundLengths[i] > 0)
+				fprintf(rounds, "%zu,%d,%u\n", s, i * SWEEP_ROUND_BUCKET_SECONDS, result.roundLengths[i]);
+		}
+
+		for (int i = 0; i <= SWEEP_MAX_DAMAGE; i++)
+		{
+			if (result.hitDamage[i] > 0)
+				fprintf(damage, "%zu,%d,%u\n", s, i, result.hitDamage[i]);
+		}
+	}
+
+	fclose(summary);
+	fclose(rounds);
+	fclose(damage);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		printf("usage: ZhengBalanceSweep <grid file> <output.csv> [matches per setting] [threads]\n");
+		return 1;
+	}
+
+	uint32_t matchesPerSetting = (argc > 3) ? static_cast<uint32_t>(atoi(argv[3])) : 1000;
+	unsigned int numThreads = (argc > 4) ? static_cast<unsigned int>(atoi(argv[4])) : std::thread::hardware_concurrency();
+	if (numThreads == 0)
+		numThreads = 1;
+
+	std::vector<SweepAxis> axes;
+	if (!ReadGrid(argv[1], axes))
+		return 1;
+
+	std::vector<SweepSetting> settings;
+	BuildSettings(axes, settings);
+
+	//small fixed-size jobs keep every core busy to the end even when some settings play much longer matches
+	std::vector<SweepJob> jobs;
+	for (size_t s = 0; s < settings.size(); s++)
+	{
+		for (uint32_t match = 0; match < matchesPerSetting; match += SWEEP_MATCHES_PER_JOB)
+		{
+			SweepJob job;
+			job.setting = s;
+			job.firstMatch = match;
+			jobs.push_back(job);
+		}
+	}
+
+	printf("%zu settings x %u matches on %u threads\n", settings.size(), matchesPerSetting, numThreads);
+
+	std::vector<SweepResult> jobResults(jobs.size());
+	memset(jobResults.data(), 0, jobResults.size() * sizeof(SweepResult));
+
+	std::atomic<size_t> nextJob(0);
+	std::atomic<size_t> jobsDone(0);
+
+	auto worker = [&]()
+	{
+		//one simulation per thread, reused for every match
+		ZhengSimulation* simulation = new ZhengSimulation();
+
+		for (size_t j = nextJob.fetch_add(1); j < jobs.size(); j = nextJob.fetch_add(1))
+		{
+			const SweepJob& job = jobs[j];
+			uint32_t lastMatch = job.firstMatch + SWEEP_MATCHES_PER_JOB;
+			if (lastMatch > matchesPerSetting)
+				lastMatch = matchesPerSetting;
+
+			for (uint32_t match = job.firstMatch; match < lastMatch; match++)
+				PlayMatch(settings[job.setting], match, *simulation, jobResults[j]);
+
+			size_t done = jobsDone.fetch_add(1) + 1;
+			if (done % 256 == 0 || done == jobs.size())
+				printf("\r%zu / %zu jobs", done, jobs.size());
+		}
+
+		delete simulation;
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 0; i < numThreads; i++)
+		threads.push_back(std::thread(worker));
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+	printf("\n");
+
+	std::vector<SweepResult> results(settings.size());
+	memset(results.data(), 0, results.size() * sizeof(SweepResult));
+	for (size_t j = 0; j < jobs.size(); j++)
+		AddResult(results[jobs[j].setting], jobResults[j]);
+
+	if (!WriteResults(argv[2], axes, settings, results))
+		return 1;
+
+	printf("wrote %s\n", argv[2]);
+	return 0;
+}
@@ -0,0 +1,262 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "ZhengBeatClock.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <thread>
+
+//////////////////////////////////////////////////////////////////////////
+// ZhengSeqlock
+//
+// One writer, any number of readers, nobody blocks. The writer makes the sequence odd while it copies
+// and even again after; a reader that saw the sequence change (or odd) while copying just copies again.
+// The payload is kept in atomic words so a torn read is never undefined, only retried.
+
+ZhengSeqlock::ZhengSeqlock()
+{
+	sequence.store(0, std::memory_order_relaxed);
+
+	for (int i = 0; i < SEQLOCK_MAX_WORDS; i++)
+		words[i].store(0, std::memory_order_relaxed);
+}
+
+//Writer side. Only ever call from one thread at a time. Payloads bigger than SEQLOCK_MAX_WORDS words are refused.
+void ZhengSeqlock::Write(const void* i_data, size_t i_size)
+{
+	uint64_t buffer[SEQLOCK_MAX_WORDS] = {};
+	assert(i_size <= sizeof(buffer));
+	if (i_size > sizeof(buffer))
+		return;
+
+	memcpy(buffer, i_data, i_size);
+
+	uint32_t current = sequence.load(std::memory_order_relaxed);
+	sequence.store(current + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	for (size_t i = 0; i < (i_size + 7) / 8; i++)
+		words[i].store(buffer[i], std::memory_order_relaxed);
+
+	sequence.store(current + 2, std::memory_order_release);
+}
+
+//Reader side, from any thread. Returns the sequence the copy was taken at, 0 if nothing was written yet.
+uint32_t ZhengSeqlock::Read(void* o_data, size_t i_size) const
+{
+	uint64_t buffer[SEQLOCK_MAX_WORDS];
+	assert(i_size <= sizeof(buffer));
+	if (i_size > sizeof(buffer))
+		return 0;
+
+	for (;;)
+	{
+		uint32_t before = sequence.load(std::memory_order_acquire);
+
+		if (before & 1)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		for (size_t i = 0; i < (i_size + 7) / 8; i++)
+			buffer[i] = words[i].load(std::memory_order_relaxed);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (sequence.load(std::memory_order_relaxed) == before)
+		{
+			memcpy(o_data, buffer, i_size);
+			return before;
+		}
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// ZhengBeatClock
+//
+// Tells where the music's beat is at any moment, as precisely as the audio device knows it.
+// The audio thread publishes how many frames it has rendered and when; the game thread publishes the
+// beat grid (tempo and which frame the first beat is on). Anything holding a timestamp on the same clock
+// as FPlatformTime::Seconds, like an input event, can then get the beat phase at exactly that moment.
+// The beats either come at a constant tempo or follow a beat map extracted from the track, which can
+// speed up and slow down with the music.
+//
+// Audio callbacks arrive in bursts, so the raw callback times jitter by a millisecond or more. The writer
+// runs them through a small phase-locked filter: it predicts each callback's time from the frames
+// rendered, and only nudges the prediction towards the measured time. That keeps the frame-to-time
+// mapping within a fraction of a millisecond while still following the device's real rate.
+
+static_assert(sizeof(ZhengAudioAnchor) <= SEQLOCK_MAX_WORDS * sizeof(uint64_t), "ZhengAudioAnchor doesn't fit in a ZhengSeqlock, raise SEQLOCK_MAX_WORDS.");
+static_assert(sizeof(ZhengBeatGrid) <= SEQLOCK_MAX_WORDS * sizeof(uint64_t), "ZhengBeatGrid doesn't fit in a ZhengSeqlock, raise SEQLOCK_MAX_WORDS.");
+
+//how far the filter moves towards each measured callback time
+const double BEAT_CLOCK_FILTER_GAIN = 0.01;
+//a measured time this far off the prediction means the stream restarted or hitched, so start over
+const double BEAT_CLOCK_RESYNC_SECONDS = 0.05;
+
+ZhengBeatClock::ZhengBeatClock()
+{
+	filterFrames = 0;
+	filterHostTime = 0.0;
+	filterStarted = false;
+}
+
+//Audio thread. i_framesRendered counts every frame handed to the device so far, i_hostTime is when this
+//callback ran on the FPlatformTime::Seconds clock.
+void ZhengBeatClock::PublishAudioPosition(uint64_t i_framesRendered, double i_hostTime, double i_sampleRate)
+{
+	if (i_sampleRate <= 0.0)
+		return;
+
+	if (filterStarted && i_framesRendered > filterFrames)
+	{
+		double predicted = filterHostTime + (i_framesRendered - filterFrames) / i_sampleRate;
+		double error = i_hostTime - predicted;
+
+		if (fabs(error) < BEAT_CLOCK_RESYNC_SECONDS)
+			i_hostTime = predicted + error * BEAT_CLOCK_FILTER_GAIN;
+	}
+
+	filterFrames = i_framesRendered;
+	filterHostTime = i_hostTime;
+	filterStarted = true;
+
+	ZhengAudioAnchor anchor;
+	anchor.frame = static_cast<double>(i_framesRendered);
+	anchor.hostTime = i_hostTime;
+	anchor.sampleRate = i_sampleRate;
+	anchorLock.Write(&anchor, sizeof(anchor));
+}
+
+//Game thread. Starts the music's beats at i_hostTime (normally when the music started), following i_beatMap
+//if there is one or else coming at i_beatsPerMinute from the start. i_beatMap has to stay loaded until the
+//beats are stopped or started again. i_outputLatency is how long rendered audio takes to be heard.
+void ZhengBeatClock::StartBeats(double i_beatsPerMinute, double i_hostTime, double i_outputLatency, const ZhengBeatMap* i_beatMap)
+{
+	ZhengBeatGrid grid;
+	memset(&grid, 0, sizeof(grid));
+
+	//a map needs at least one gap between beats to say anything about the tempo
+	if (i_beatMap != nullptr && i_beatMap->beatFrames.size() >= 2 && i_beatMap->sampleRate > 0)
+		grid.beatMap = i_beatMap;
+
+	grid.beatsPerMinute = i_beatsPerMinute;
+	grid.outputLatency = i_outputLatency;
+	grid.originHostTime = i_hostTime;
+	grid.running = 1;
+
+	//the grid lives in audio frames once we know them, so it stays locked to the music whatever the host clock does
+	ZhengAudioAnchor anchor;
+	if (anchorLock.Read(&anchor, sizeof(anchor)) != 0)
+	{
+		grid.originFrame = anchor.frame + (i_hostTime - anchor.hostTime) * anchor.sampleRate;
+		grid.originInFrames = 1;
+	}
+
+	gridLock.Write(&grid, sizeof(grid));
+}
+
+//Game thread
+void ZhengBeatClock::StopBeats()
+{
+	ZhengBeatGrid grid;
+	memset(&grid, 0, sizeof(grid));
+	gridLock.Write(&grid, sizeof(grid));
+}
+
+//Any thread. Gets the beat at i_hostTime, which can be in the past or a little ahead.
+//Returns false if the beats haven't been started.
+bool ZhengBeatClock::GetBeatAt(double i_hostTime, ZhengBeatTime& o_beat) const
+{
+	ZhengBeatGrid grid;
+	gridLock.Read(&grid, sizeof(grid));
+
+	if (!grid.running || (grid.beatMap == nullptr && grid.beatsPerMinute <= 0.0))
+		return false;
+
+	double sinceOrigin;
+
+	ZhengAudioAnchor anchor;
+	if (grid.originInFrames && anchorLock.Read(&anchor, sizeof(anchor)) != 0)
+	{
+		//what is being heard at i_hostTime is what was rendered a latency ago
+		double frame = anchor.frame + (i_hostTime - grid.outputLatency - anchor.hostTime) * anchor.sampleRate;
+		sinceOrigin = (frame - grid.originFrame) / anchor.sampleRate;
+		o_beat.frame = frame;
+	}
+	else
+	{
+		//no audio yet (or none at all), run off the host clock
+		sinceOrigin = i_hostTime - grid.originHostTime;
+		o_beat.frame = 0.0;
+	}
+
+	if (grid.beatMap != nullptr)
+	{
+		GetMappedBeat(*grid.beatMap, sinceOrigin, o_beat);
+		return true;
+	}
+
+	double secondsPerBeat = 60.0 / grid.beatsPerMinute;
+	double beats = sinceOrigin / secondsPerBeat;
+	double beatIndex = floor(beats);
+
+	o_beat.beatIndex = static_cast<int64_t>(beatIndex);
+	o_beat.phase = beats - beatIndex;
+	o_beat.elapsed = o_beat.phase * secondsPerBeat;
+	o_beat.remaining = secondsPerBeat - o_beat.elapsed;
+	return true;
+}
+
+//Finds the beats of a map either side of i_seconds into the track. Before the first beat and after the last,
+//the nearest gap between beats carries on.
+void ZhengBeatClock::GetMappedBeat(const ZhengBeatMap& i_beatMap, double i_seconds, ZhengBeatTime& o_beat)
+{
+	const std::vector<uint32_t>& beats = i_beatMap.beatFrames;
+	double position = i_seconds * i_beatMap.sampleRate;
+
+	size_t after = std::upper_bound(beats.begin(), beats.end(), position,
+		[](double i_position, uint32_t i_beat) { return i_position < i_beat; }) - beats.begin();
+
+	//the gap the position is in, or the first or last one
+	size_t gap = (after == 0) ? 0 : ((after >= beats.size()) ? beats.size() - 2 : after - 1);
+	double gapFrames = static_cast<double>(beats[gap + 1]) - beats[gap];
+	double beatsIn = gap + (position - beats[gap]) / gapFrames;
+	double beatIndex = floor(beatsIn);
+	double secondsPerBeat = gapFrames / i_beatMap.sampleRate;
+
+	o_beat.beatIndex = static_cast<int64_t>(beatIndex);
+	o_beat.phase = beatsIn - beatIndex;
+	o_beat.elapsed = o_beat.phase * secondsPerBeat;
+	o_beat.remaining = secondsPerBeat - o_beat.elapsed;
+}
+
+//Any thread. Whether the beat grid is pinned to audio frames, rather than waiting for the audio to start.
+bool ZhengBeatClock::IsLockedToAudio() const
+{
+	ZhengBeatGrid grid;
+	gridLock.Read(&grid, sizeof(grid));
+	return grid.running && grid.originInFrames;
+}
+
+//Any thread. When the latest audio buffer was rendered, on the FPlatformTime::Seconds clock.
+//Returns false if the audio thread hasn't published a position yet.
+bool ZhengBeatClock::GetLatestAudioTime(double& o_hostTime) const
+{
+	ZhengAudioAnchor anchor;
+	if (anchorLock.Read(&anchor, sizeof(anchor)) == 0)
+		return false;
+
+	o_hostTime = anchor.hostTime;
+	return true;
+}
+
+//Any thread. Whether the audio thread has published a position yet.
+bool ZhengBeatClock::HasAudio() const
+{
+	ZhengAudioAnchor anchor;
+	return anchorLock.Read(&anchor, sizeof(anchor)) != 0;
+}
@@ -0,0 +1,831 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "ZhengBeatMap.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define ZHENG_BEATMAP_SSE 1
+#endif
+
+#pragma warning( disable : 4996) //fopen is fine here
+
+//////////////////////////////////////////////////////////////////////////
+// Beat maps
+//
+// Finds the beats of a music track offline, so tracks don't need a constant, hand-entered tempo.
+// The track is cut into overlapping windows, and the spectral flux (how much louder each frequency got
+// since the last window) gives an onset envelope that peaks wherever a note or drum hits. Tempo is taken
+// from the envelope's autocorrelation over a few seconds at a time, so it can drift and change through
+// the track, and a dynamic programming pass then picks the beats that best line up with both the
+// onsets and the local tempo.
+//
+// The result is a list of beat positions in audio frames, which ZhengBeatClock follows in place of a
+// fixed tempo. On disk it is a short header and the gaps between beats as varints, a few bytes a beat.
+
+const uint32_t BEATMAP_MAGIC = 0x504D425A; //"ZBMP"
+const uint16_t BEATMAP_VERSION = 1;
+
+//analysis window, a power of two
+const int BEATMAP_FFT_BITS = 10;
+const int BEATMAP_FFT_SIZE = 1 << BEATMAP_FFT_BITS;
+//onset envelope frames per second, whatever the sample rate
+const double BEATMAP_FRAME_RATE = 172.0;
+//how far into a window an onset is when the flux peaks; the log levels jump before the onset reaches the
+//middle of the window (measured on synthetic drum tracks)
+const double BEATMAP_ONSET_POSITION = 0.7;
+//the spectrum is summed into this many log-spaced bands, so a kick counts as much as a hi-hat
+const int BEATMAP_NUM_BANDS = 40;
+//compression of the band levels before the flux, so quiet notes still count
+const float BEATMAP_LOG_COMPRESSION = 100.0f;
+//onsets louder than this many deviations don't count extra towards the tempo, so accents can't drown the pulse
+const float BEATMAP_TEMPO_CLIP = 3.0f;
+
+//tempo is looked for in this range, leaning towards BEATMAP_PREFERRED_BPM when it's ambiguous
+const double BEATMAP_MIN_BPM = 60.0;
+const double BEATMAP_MAX_BPM = 200.0;
+const double BEATMAP_PREFERRED_BPM = 120.0;
+//seconds of envelope each tempo estimate looks at, and how far apart the estimates are
+const double BEATMAP_TEMPO_WINDOW = 8.0;
+const double BEATMAP_TEMPO_HOP = 1.0;
+//how strongly the beat tracker sticks to the local tempo over chasing onsets
+const double BEATMAP_TIGHTNESS = 300.0;
+
+#pragma pack(push, 1)
+struct BeatMapFileHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t sampleRate;
+	uint32_t numBeats;
+};
+#pragma pack(pop)
+
+static size_t WriteVarint(uint8_t* o_bytes, uint32_t i_value)
+{
+	size_t size = 0;
+
+	while (i_value >= 0x80)
+	{
+		o_bytes[size++] = static_cast<uint8_t>(i_value | 0x80);
+		i_value >>= 7;
+	}
+
+	o_bytes[size++] = static_cast<uint8_t>(i_value);
+	return size;
+}
+
+static bool ReadVarint(const uint8_t*& io_cursor, const uint8_t* i_end, uint32_t& o_value)
+{
+	o_value = 0;
+
+	for (int shift = 0; shift < 35; shift += 7)
+	{
+		if (io_cursor >= i_end)
+			return false;
+
+		uint8_t byte = *io_cursor++;
+		o_value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+
+		if (!(byte & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
+static bool ReadFile(const char* i_path, std::vector<uint8_t>& o_bytes)
+{
+	FILE* file = fopen(i_path, "rb");
+	if (file == nullptr)
+	{
+		printf("Could not open %s.\n", i_path);
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	o_bytes.resize(size > 0 ? size : 0);
+	bool ok = size > 0 && fread(o_bytes.data(), 1, size, file) == static_cast<size_t>(size);
+	fclose(file);
+
+	if (!ok)
+		printf("Could not read %s.\n", i_path);
+
+	return ok;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// WAV decoding
+
+static uint32_t ReadLittleEndian(const uint8_t* i_bytes, int i_numBytes)
+{
+	uint32_t value = 0;
+
+	for (int i = 0; i < i_numBytes; i++)
+		value |= static_cast<uint32_t>(i_bytes[i]) << (8 * i);
+
+	return value;
+}
+
+//Decodes a PCM (8, 16, 24 or 32 bit) or float WAV file, mixed down to mono
+bool LoadWav(const char* i_path, std::vector<float>& o_samples, uint32_t& o_sampleRate)
+{
+	std::vector<uint8_t> bytes;
+	if (!ReadFile(i_path, bytes))
+		return false;
+
+	if (bytes.size() < 12 || memcmp(bytes.data(), "RIFF", 4) != 0 || memcmp(bytes.data() + 8, "WAVE", 4) != 0)
+	{
+		printf("%s is not a WAV file.\n", i_path);
+		return false;
+	}
+
+	uint32_t format = 0;
+	uint32_t numChannels = 0;
+	uint32_t bitsPerSample = 0;
+	const uint8_t* data = nullptr;
+	size_t dataSize = 0;
+	o_sampleRate = 0;
+
+	size_t position = 12;
+	while (position + 8 <= bytes.size())
+	{
+		const uint8_t* chunk = bytes.data() + position;
+		size_t chunkSize = ReadLittleEndian(chunk + 4, 4);
+		size_t available = std::min(chunkSize, bytes.size() - position - 8);
+
+		if (memcmp(chunk, "fmt ", 4) == 0 && available >= 16)
+		{
+			format = ReadLittleEndian(chunk + 8, 2);
+			numChannels = ReadLittleEndian(chunk + 10, 2);
+			o_sampleRate = ReadLittleEndian(chunk + 12, 4);
+			bitsPerSample = ReadLittleEndian(chunk + 22, 2);
+
+			//WAVE_FORMAT_EXTENSIBLE keeps the real format at the start of the subformat GUID
+			if (format == 0xFFFE && available >= 26)
+				format = ReadLittleEndian(chunk + 32, 2);
+		}
+		else if (memcmp(chunk, "data", 4) == 0)
+		{
+			data = chunk + 8;
+			dataSize = available;
+		}
+
+		//chunks are padded to an even size
+		position += 8 + chunkSize + (chunkSize & 1);
+	}
+
+	bool isFloat = format == 3 && bitsPerSample == 32;
+	bool isPcm = format == 1 && (bitsPerSample == 8 || bitsPerSample == 16 || bitsPerSample == 24 || bitsPerSample == 32);
+
+	if (data == nullptr || numChannels == 0 || o_sampleRate == 0 || (!isFloat && !isPcm))
+	{
+		printf("%s is not a WAV format we can read (format %u, %u bits).\n", i_path, format, bitsPerSample);
+		return false;
+	}
+
+	uint32_t bytesPerSample = bitsPerSample / 8;
+	size_t numFrames = dataSize / (bytesPerSample * numChannels);
+	float channelScale = 1.0f / numChannels;
+
+	o_samples.resize(numFrames);
+
+	for (size_t frame = 0; frame < numFrames; frame++)
+	{
+		const uint8_t* in = data + frame * bytesPerSample * numChannels;
+		float sum = 0.0f;
+
+		for (uint32_t channel = 0; channel < numChannels; channel++, in += bytesPerSample)
+		{
+			if (isFloat)
+			{
+				float value;
+				memcpy(&value, in, sizeof(value));
+				sum += value;
+			}
+			else if (bitsPerSample == 8)
+			{
+				sum += (in[0] - 128) * (1.0f / 128.0f);
+			}
+			else
+			{
+				//shift the sample to the top of an int32 so the sign comes along
+				int32_t value = static_cast<int32_t>(ReadLittleEndian(in, bytesPerSample) << (32 - bitsPerSample));
+				sum += value * (1.0f / 2147483648.0f);
+			}
+		}
+
+		o_samples[frame] = sum * channelScale;
+	}
+
+	return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// FFT
+//
+// Radix-2 complex FFT on separate real and imaginary arrays, so the butterflies of every stage past the
+// second run four at a time in SSE registers. Two real windows go through one complex transform, one as
+// the real part and one as the imaginary part, and are pulled apart again afterwards.
+
+class BeatMapFft
+{
+public:
+	BeatMapFft()
+	{
+		for (int i = 0; i < BEATMAP_FFT_SIZE; i++)
+		{
+			int reversed = 0;
+			for (int bit = 0; bit < BEATMAP_FFT_BITS; bit++)
+			{
+				if (i & (1 << bit))
+					reversed |= 1 << (BEATMAP_FFT_BITS - 1 - bit);
+			}
+			bitReversed[i] = reversed;
+		}
+
+		//the twiddles of the stage with half size h live at [h, 2h)
+		for (int half = 1; half < BEATMAP_FFT_SIZE; half <<= 1)
+		{
+			for (int j = 0; j < half; j++)
+			{
+				double angle = -3.14159265358979323846 * j / half;
+				twiddleReal[half + j] = static_cast<float>(cos(angle));
+				twiddleImaginary[half + j] = static_cast<float>(sin(angle));
+			}
+		}
+	}
+
+	//Loads two real windows in bit-reversed order, ready for Transform
+	void Load(const float* i_first, const float* i_second)
+	{
+		for (int i = 0; i < BEATMAP_FFT_SIZE; i++)
+		{
+			real[bitReversed[i]] = i_first[i];
+			imaginary[bitReversed[i]] = i_second[i];
+		}
+	}
+
+	void Transform()
+	{
+		for (int half = 1; half < BEATMAP_FFT_SIZE; half <<= 1)
+		{
+			const float* wr = twiddleReal + half;
+			const float* wi = twiddleImaginary + half;
+
+			for (int start = 0; start < BEATMAP_FFT_SIZE; start += 2 * half)
+			{
+				float* ar = real + start;
+				float* ai = imaginary + start;
+				float* br = ar + half;
+				float* bi = ai + half;
+				int j = 0;
+
+#if defined(ZHENG_BEATMAP_SSE)
+				for (; j + 4 <= half; j += 4)
+				{
+					__m128 twr = _mm_loadu_ps(wr + j);
+					__m128 twi = _mm_loadu_ps(wi + j);
+					__m128 xr = _mm_loadu_ps(br + j);
+					__m128 xi = _mm_loadu_ps(bi + j);
+					__m128 tr = _mm_sub_ps(_mm_mul_ps(xr, twr), _mm_mul_ps(xi, twi));
+					__m128 ti = _mm_add_ps(_mm_mul_ps(xr, twi), _mm_mul_ps(xi, twr));
+					__m128 yr = _mm_loadu_ps(ar + j);
+					__m128 yi = _mm_loadu_ps(ai + j);
+
+					_mm_storeu_ps(br + j, _mm_sub_ps(yr, tr));
+					_mm_storeu_ps(bi + j, _mm_sub_ps(yi, ti));
+					_mm_storeu_ps(ar + j, _mm_add_ps(yr, tr));
+					_mm_storeu_ps(ai + j, _mm_add_ps(yi, ti));
+				}
+#endif
+				for (; j < half; j++)
+				{
+					float tr = br[j] * wr[j] - bi[j] * wi[j];
+					float ti = br[j] * wi[j] + bi[j] * wr[j];
+
+					br[j] = ar[j] - tr;
+					bi[j] = ai[j] - ti;
+					ar[j] += tr;
+					ai[j] += ti;
+				}
+			}
+		}
+	}
+
+	//Splits the transform back into the magnitude spectra of the two windows, bins 0 to BEATMAP_FFT_SIZE / 2
+	void GetMagnitudes(float* o_first, float* o_second) const
+	{
+		for (int k = 0; k <= BEATMAP_FFT_SIZE / 2; k++)
+		{
+			int mirror = (BEATMAP_FFT_SIZE - k) & (BEATMAP_FFT_SIZE - 1);
+			float sumReal = real[k] + real[mirror];
+			float diffReal = real[k] - real[mirror];
+			float sumImaginary = imaginary[k] + imaginary[mirror];
+			float diffImaginary = imaginary[k] - imaginary[mirror];
+
+			o_first[k] = 0.5f * sqrtf(sumReal * sumReal + diffImaginary * diffImaginary);
+			o_second[k] = 0.5f * sqrtf(sumImaginary * sumImaginary + diffReal * diffReal);
+		}
+	}
+
+private:
+	int bitReversed[BEATMAP_FFT_SIZE];
+	float twiddleReal[BEATMAP_FFT_SIZE];
+	float twiddleImaginary[BEATMAP_FFT_SIZE];
+	float real[BEATMAP_FFT_SIZE];
+	float imaginary[BEATMAP_FFT_SIZE];
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// Analysis
+
+const int BEATMAP_NUM_BINS = BEATMAP_FFT_SIZE / 2 + 1;
+
+//First bin of every band, log spaced from bin 1 to Nyquist, every band at least one bin wide
+static void ComputeBandEdges(int* o_edges)
+{
+	o_edges[0] = 1;
+
+	for (int band = 1; band <= BEATMAP_NUM_BANDS; band++)
+	{
+		int edge = static_cast<int>(pow(BEATMAP_NUM_BINS - 1.0, static_cast<double>(band) / BEATMAP_NUM_BANDS) + 0.5);
+		o_edges[band] = (edge > o_edges[band - 1]) ? edge : o_edges[band - 1] + 1;
+	}
+
+	o_edges[BEATMAP_NUM_BANDS] = BEATMAP_NUM_BINS;
+}
+
+//Log-compressed average level of every band
+static void ComputeBands(const float* i_magnitudes, const int* i_edges, float* o_bands)
+{
+	for (int band = 0; band < BEATMAP_NUM_BANDS; band++)
+	{
+		float sum = 0.0f;
+		for (int k = i_edges[band]; k < i_edges[band + 1]; k++)
+			sum += i_magnitudes[k];
+
+		o_bands[band] = logf(1.0f + BEATMAP_LOG_COMPRESSION * sum / (i_edges[band + 1] - i_edges[band]));
+	}
+}
+
+//Sum of how much every band rose since the previous window
+static float SpectralFlux(const float* i_previous, const float* i_current)
+{
+	float flux = 0.0f;
+	int band = 0;
+
+#if defined(ZHENG_BEATMAP_SSE)
+	__m128 sum = _mm_setzero_ps();
+	__m128 zero = _mm_setzero_ps();
+
+	for (; band + 4 <= BEATMAP_NUM_BANDS; band += 4)
+	{
+		__m128 rise = _mm_sub_ps(_mm_loadu_ps(i_current + band), _mm_loadu_ps(i_previous + band));
+		sum = _mm_add_ps(sum, _mm_max_ps(rise, zero));
+	}
+
+	float lanes[4];
+	_mm_storeu_ps(lanes, sum);
+	flux = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+
+	for (; band < BEATMAP_NUM_BANDS; band++)
+	{
+		float rise = i_current[band] - i_previous[band];
+		if (rise > 0.0f)
+			flux += rise;
+	}
+
+	return flux;
+}
+
+//Onset strength for every hop of the track. Frame i compares the window starting at i * i_hop with the one before.
+static void ComputeOnsetEnvelope(const float* i_samples, size_t i_numSamples, size_t i_hop, std::vector<float>& o_envelope)
+{
+	size_t numFrames = (i_numSamples >= BEATMAP_FFT_SIZE) ? (i_numSamples - BEATMAP_FFT_SIZE) / i_hop + 1 : 0;
+	o_envelope.assign(numFrames, 0.0f);
+
+	if (numFrames == 0)
+		return;
+
+	BeatMapFft* fft = new BeatMapFft();
+
+	float window[BEATMAP_FFT_SIZE];
+	for (int i = 0; i < BEATMAP_FFT_SIZE; i++)
+		window[i] = 0.5f - 0.5f * cosf(6.28318530718f * i / BEATMAP_FFT_SIZE);
+
+	int edges[BEATMAP_NUM_BANDS + 1];
+	ComputeBandEdges(edges);
+
+	float first[BEATMAP_FFT_SIZE];
+	float second[BEATMAP_FFT_SIZE];
+	float firstSpectrum[BEATMAP_NUM_BINS];
+	float secondSpectrum[BEATMAP_NUM_BINS];
+	float bands[3][BEATMAP_NUM_BANDS];
+	float* previous = bands[0];
+	float* firstBands = bands[1];
+	float* secondBands = bands[2];
+
+	memset(previous, 0, sizeof(bands[0]));
+
+	for (size_t frame = 0; frame < numFrames; frame += 2)
+	{
+		const float* in = i_samples + frame * i_hop;
+		bool hasSecond = frame + 1 < numFrames;
+
+		for (int i = 0; i < BEATMAP_FFT_SIZE; i++)
+		{
+			first[i] = in[i] * window[i];
+			second[i] = hasSecond ? in[i + i_hop] * window[i] : 0.0f;
+		}
+
+		fft->Load(first, second);
+		fft->Transform();
+		fft->GetMagnitudes(firstSpectrum, secondSpectrum);
+
+		ComputeBands(firstSpectrum, edges, firstBands);
+		o_envelope[frame] = (frame > 0) ? SpectralFlux(previous, firstBands) : 0.0f;
+
+		if (hasSecond)
+		{
+			ComputeBands(secondSpectrum, edges, secondBands);
+			o_envelope[frame + 1] = SpectralFlux(firstBands, secondBands);
+			std::swap(previous, secondBands);
+		}
+		else
+		{
+			std::swap(previous, firstBands);
+		}
+	}
+
+	delete fft;
+
+	//take out the slow swell of loud passages, keep only the peaks above it, and scale to unit deviation
+	size_t radius = static_cast<size_t>(BEATMAP_FRAME_RATE * 0.25);
+	std::vector<double> prefix(numFrames + 1, 0.0);
+	for (size_t i = 0; i < numFrames; i++)
+		prefix[i + 1] = prefix[i] + o_envelope[i];
+
+	std::vector<float> detrended(numFrames);
+	double sumSquares = 0.0;
+
+	for (size_t i = 0; i < numFrames; i++)
+	{
+		size_t low = (i > radius) ? i - radius : 0;
+		size_t high = std::min(numFrames, i + radius + 1);
+		double mean = (prefix[high] - prefix[low]) / (high - low);
+		float value = static_cast<float>(o_envelope[i] - mean);
+
+		detrended[i] = (value > 0.0f) ? value : 0.0f;
+		sumSquares += detrended[i] * detrended[i];
+	}
+
+	float deviation = static_cast<float>(sqrt(sumSquares / numFrames));
+	float scale = (deviation > 0.0f) ? 1.0f / deviation : 0.0f;
+
+	for (size_t i = 0; i < numFrames; i++)
+		o_envelope[i] = detrended[i] * scale;
+}
+
+//How much the envelope favours a beat every i_lag frames over the given range, leaning towards the preferred tempo
+static double TempoScore(const float* i_envelope, size_t i_numFrames, double i_frameRate, int i_lag)
+{
+	size_t lag = static_cast<size_t>(i_lag);
+	if (lag >= i_numFrames)
+		return 0.0;
+
+	double sum = 0.0;
+	for (size_t i = lag; i < i_numFrames; i++)
+		sum += i_envelope[i] * i_envelope[i - lag];
+
+	double score = sum / (i_numFrames - lag);
+	double preferredLag = i_frameRate * 60.0 / BEATMAP_PREFERRED_BPM;
+	double octaves = log2(i_lag / preferredLag);
+	return score * exp(-0.5 * octaves * octaves);
+}
+
+//Beat period in frames at every frame, from tempo estimates over overlapping stretches of the envelope
+static void EstimateTempo(const std::vector<float>& i_envelope, double i_frameRate, std::vector<float>& o_period)
+{
+	size_t numFrames = i_envelope.size();
+	int minLag = static_cast<int>(floor(i_frameRate * 60.0 / BEATMAP_MAX_BPM));
+	int maxLag = static_cast<int>(ceil(i_frameRate * 60.0 / BEATMAP_MIN_BPM));
+	size_t window = static_cast<size_t>(BEATMAP_TEMPO_WINDOW * i_frameRate);
+	size_t hop = static_cast<size_t>(BEATMAP_TEMPO_HOP * i_frameRate);
+
+	if (window > numFrames)
+		window = numFrames;
+
+	std::vector<double> centers;
+	std::vector<double> periods;
+	std::vector<double> scores(maxLag + 2, 0.0);
+	double lastLag = 0.0;
+
+	for (size_t start = 0; ; start += hop)
+	{
+		if (start + window > numFrames)
+			start = numFrames - window;
+
+		for (int lag = minLag - 1; lag <= maxLag + 1; lag++)
+			scores[lag] = (lag > 0) ? TempoScore(i_envelope.data() + start, window, i_frameRate, lag) : 0.0;
+
+		int best = minLag;
+		for (int lag = minLag; lag <= maxLag; lag++)
+		{
+			if (scores[lag] > scores[best])
+				best = lag;
+		}
+
+		//a nearly as good peak near the last estimate wins, so the tempo doesn't flicker between octaves
+		if (lastLag > 0.0)
+		{
+			int near = static_cast<int>(lastLag + 0.5);
+			int nearBest = -1;
+			for (int lag = near - 2; lag <= near + 2; lag++)
+			{
+				if (lag >= minLag && lag <= maxLag && (nearBest < 0 || scores[lag] > scores[nearBest]))
+					nearBest = lag;
+			}
+
+			if (nearBest >= 0 && scores[nearBest] >= 0.8 * scores[best])
+				best = nearBest;
+		}
+
+		//the peak between whole frames
+		double lag = best;
+		double left = scores[best - 1];
+		double right = scores[best + 1];
+		double curvature = left - 2.0 * scores[best] + right;
+		if (curvature < 0.0)
+			lag += 0.5 * (left - right) / curvature;
+
+		centers.push_back(start + window * 0.5);
+		periods.push_back(lag);
+		lastLag = lag;
+
+		if (start + window >= numFrames)
+			break;
+	}
+
+	o_period.resize(numFrames);
+	size_t segment = 0;
+
+	for (size_t i = 0; i < numFrames; i++)
+	{
+		while (segment + 1 < centers.size() && centers[segment + 1] <= i)
+			segment++;
+
+		if (i <= centers[0] || segment + 1 >= centers.size())
+		{
+			o_period[i] = static_cast<float>(i <= centers[0] ? periods[0] : periods.back());
+			continue;
+		}
+
+		double t = (i - centers[segment]) / (centers[segment + 1] - centers[segment]);
+		o_period[i] = static_cast<float>(periods[segment] + (periods[segment + 1] - periods[segment]) * t);
+	}
+}
+
+//Picks the beat frames that best fit both the onsets and the local tempo (Ellis' dynamic programming tracker)
+static void TrackBeats(const std::vector<float>& i_envelope, const std::vector<float>& i_period, std::vector<double>& o_beats)
+{
+	size_t numFrames = i_envelope.size();
+	std::vector<float> score(numFrames);
+	std::vector<int32_t> previous(numFrames, -1);
+
+	for (size_t i = 0; i < numFrames; i++)
+	{
+		double period = i_period[i];
+		int earliest = static_cast<int>(i) - static_cast<int>(2.0 * period);
+		int latest = static_cast<int>(i) - static_cast<int>(0.5 * period);
+		double best = 0.0;
+		int bestFrame = -1;
+
+		for (int p = (earliest > 0 ? earliest : 0); p <= latest; p++)
+		{
+			double stretch = log((i - p) / period);
+			double candidate = score[p] - BEATMAP_TIGHTNESS * stretch * stretch;
+
+			if (bestFrame < 0 || candidate > best)
+			{
+				best = candidate;
+				bestFrame = p;
+			}
+		}
+
+		//chain onto an earlier beat only if that pays; otherwise this is where the beats start
+		if (bestFrame >= 0 && best > 0.0)
+		{
+			score[i] = static_cast<float>(i_envelope[i] + best);
+			previous[i] = bestFrame;
+		}
+		else
+		{
+			score[i] = i_envelope[i];
+		}
+	}
+
+	o_beats.clear();
+	if (numFrames == 0)
+		return;
+
+	//the chain ends on the best scoring frame within the last beat
+	size_t lastPeriod = static_cast<size_t>(i_period[numFrames - 1]);
+	size_t end = (numFrames > lastPeriod) ? numFrames - lastPeriod : 0;
+	for (size_t i = end; i < numFrames; i++)
+	{
+		if (score[i] > score[end])
+			end = i;
+	}
+
+	std::vector<size_t> chain;
+	for (int32_t frame = static_cast<int32_t>(end); frame >= 0; frame = previous[frame])
+		chain.push_back(frame);
+
+	//place each beat between frames at the top of its onset peak
+	for (size_t i = chain.size(); i > 0; i--)
+	{
+		size_t frame = chain[i - 1];
+		double position = static_cast<double>(frame);
+
+		if (frame > 0 && frame + 1 < numFrames)
+		{
+			double left = i_envelope[frame - 1];
+			double center = i_envelope[frame];
+			double right = i_envelope[frame + 1];
+			double curvature = left - 2.0 * center + right;
+
+			if (center >= left && center >= right && curvature < 0.0)
+				position += 0.5 * (left - right) / curvature;
+		}
+
+		o_beats.push_back(position);
+	}
+}
+
+//Finds the beats of a mono track. Returns false if the track is too short to have a tempo.
+bool AnalyzeBeats(const float* i_samples, size_t i_numSamples, uint32_t i_sampleRate, ZhengBeatMap& o_beatMap, ZhengBeatAnalysis* o_analysis)
+{
+	o_beatMap.sampleRate = i_sampleRate;
+	o_beatMap.beatFrames.clear();
+
+	size_t hop = static_cast<size_t>(i_sampleRate / BEATMAP_FRAME_RATE + 0.5);
+	if (hop == 0)
+		hop = 1;
+
+	double frameRate = static_cast<double>(i_sampleRate) / hop;
+
+	std::vector<float> envelope;
+	ComputeOnsetEnvelope(i_samples, i_numSamples, hop, envelope);
+
+	if (envelope.size() < static_cast<size_t>(frameRate * 60.0 / BEATMAP_MIN_BPM) * 4)
+	{
+		printf("Track is too short to find a tempo in.\n");
+		return false;
+	}
+
+	std::vector<float> clipped(envelope.size());
+	for (size_t i = 0; i < envelope.size(); i++)
+		clipped[i] = (envelope[i] < BEATMAP_TEMPO_CLIP) ? envelope[i] : BEATMAP_TEMPO_CLIP;
+
+	std::vector<float> period;
+	EstimateTempo(clipped, frameRate, period);
+
+	std::vector<double> beats;
+	TrackBeats(envelope, period, beats);
+
+	//frame i's flux is from the window starting at i * hop
+	for (size_t i = 0; i < beats.size(); i++)
+	{
+		double position = beats[i] * hop + BEATMAP_FFT_SIZE * BEATMAP_ONSET_POSITION;
+		if (position >= 0.0 && position < 4294967295.0)
+			o_beatMap.beatFrames.push_back(static_cast<uint32_t>(position + 0.5));
+	}
+
+	if (o_analysis != nullptr)
+	{
+		o_analysis->numOnsetFrames = static_cast<uint32_t>(envelope.size());
+		o_analysis->minBeatsPerMinute = 0.0f;
+		o_analysis->maxBeatsPerMinute = 0.0f;
+
+		for (size_t i = 0; i < period.size(); i++)
+		{
+			float bpm = static_cast<float>(frameRate * 60.0 / period[i]);
+			if (i == 0 || bpm < o_analysis->minBeatsPerMinute)
+				o_analysis->minBeatsPerMinute = bpm;
+			if (i == 0 || bpm > o_analysis->maxBeatsPerMinute)
+				o_analysis->maxBeatsPerMinute = bpm;
+		}
+	}
+
+	return o_beatMap.beatFrames.size() >= 2;
+}
+
+//Writes a beat map as a header and the gaps between beats as varints
+bool SaveBeatMap(const char* i_path, const ZhengBeatMap& i_beatMap)
+{
+	FILE* file = fopen(i_path, "wb");
+	if (file == nullptr)
+	{
+		printf("Could not open %s for writing.\n", i_path);
+		return false;
+	}
+
+	BeatMapFileHeader header;
+	header.magic = BEATMAP_MAGIC;
+	header.version = BEATMAP_VERSION;
+	header.reserved = 0;
+	header.sampleRate = i_beatMap.sampleRate;
+	header.numBeats = static_cast<uint32_t>(i_beatMap.beatFrames.size());
+
+	std::vector<uint8_t> gaps(i_beatMap.beatFrames.size() * 5);
+	size_t size = 0;
+	uint32_t last = 0;
+
+	for (size_t i = 0; i < i_beatMap.beatFrames.size(); i++)
+	{
+		size += WriteVarint(gaps.data() + size, i_beatMap.beatFrames[i] - last);
+		last = i_beatMap.beatFrames[i];
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(gaps.data(), 1, size, file) == size;
+	fclose(file);
+
+	if (!ok)
+		printf("Could not write %s.\n", i_path);
+
+	return ok;
+}
+
+bool LoadBeatMap(const char* i_path, ZhengBeatMap& o_beatMap)
+{
+	std::vector<uint8_t> bytes;
+	if (!ReadFile(i_path, bytes))
+		return false;
+
+	BeatMapFileHeader header;
+	if (bytes.size() < sizeof(header))
+	{
+		printf("%s is too small to be a beat map.\n", i_path);
+		return false;
+	}
+
+	memcpy(&header, bytes.data(), sizeof(header));
+	if (header.magic != BEATMAP_MAGIC || header.version != BEATMAP_VERSION || header.sampleRate == 0)
+	{
+		printf("%s is not a beat map this version can read.\n", i_path);
+		return false;
+	}
+
+	const uint8_t* cursor = bytes.data() + sizeof(header);
+	const uint8_t* end = bytes.data() + bytes.size();
+
+	//every gap takes at least one byte, so a header claiming more beats than that is lying
+	if (header.numBeats > static_cast<size_t>(end - cursor))
+	{
+		printf("%s is cut short.\n", i_path);
+		return false;
+	}
+
+	std::vector<uint32_t> beatFrames;
+	beatFrames.reserve(header.numBeats);
+	uint32_t last = 0;
+
+	for (uint32_t i = 0; i < header.numBeats; i++)
+	{
+		uint32_t gap;
+		if (!ReadVarint(cursor, end, gap))
+		{
+			printf("%s is cut short.\n", i_path);
+			return false;
+		}
+
+		//only the first beat may sit on frame 0; two beats on one frame would make a gap of no length
+		if ((gap == 0 && i > 0) || gap > UINT32_MAX - last)
+		{
+			printf("%s has beats out of order.\n", i_path);
+			return false;
+		}
+
+		last += gap;
+		beatFrames.push_back(last);
+	}
+
+	o_beatMap.sampleRate = header.sampleRate;
+	o_beatMap.beatFrames.swap(beatFrames);
+
+	return true;
+}
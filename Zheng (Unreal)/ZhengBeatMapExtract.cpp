@@ -0,0 +1,51 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+//////////////////////////////////////////////////////////////////////////
+// Beat map extraction
+//
+// Standalone program, built outside the game module together with ZhengBeatMap.cpp. Finds the beats of a
+// WAV music track and writes them as a beat map the game mode's BeatMapFile can point at.
+//
+// usage: ZhengBeatMapExtract <track.wav> <output.zbmp>
+
+#include "ZhengBeatMap.h"
+
+#include <chrono>
+#include <stdio.h>
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		printf("usage: ZhengBeatMapExtract <track.wav> <output.zbmp>\n");
+		return 1;
+	}
+
+	std::vector<float> samples;
+	uint32_t sampleRate;
+	if (!LoadWav(argv[1], samples, sampleRate))
+		return 1;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	ZhengBeatMap beatMap;
+	ZhengBeatAnalysis analysis;
+	if (!AnalyzeBeats(samples.data(), samples.size(), sampleRate, beatMap, &analysis))
+	{
+		printf("No beats found in %s.\n", argv[1]);
+		return 1;
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double trackSeconds = static_cast<double>(samples.size()) / sampleRate;
+
+	printf("%s: %.1f s at %u Hz, analyzed in %.3f s\n", argv[1], trackSeconds, sampleRate, seconds);
+	printf("  %zu beats, tempo %.1f to %.1f bpm, first beat at %.3f s\n", beatMap.beatFrames.size(),
+		analysis.minBeatsPerMinute, analysis.maxBeatsPerMinute, static_cast<double>(beatMap.beatFrames[0]) / sampleRate);
+
+	if (!SaveBeatMap(argv[2], beatMap))
+		return 1;
+
+	printf("  written to %s\n", argv[2]);
+	return 0;
+}
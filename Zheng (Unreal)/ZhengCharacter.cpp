@@ -2,6 +2,11 @@
 
 #include "ZhengCharacter.h"
 #include "ZhengCharacter-inl.h"
+#include "ZhengSimulation.h"
+#include "ZhengReplay.h"
+#include "ZhengBeatClock.h"
+#include "ZhengGameMode.h"
+#include "ZhengActorPool.h"
 #include "HeadMountedDisplayFunctionLibrary.h"
 #include "PlayerAttack-inl.h"
 #include "PlayerAttackFactory-inl.h"
@@ -11,12 +16,66 @@
 #include "GameFramework/CharacterMovementComponent.h"
 #include "GameFramework/Controller.h"
 #include "GameFramework/SpringArmComponent.h"
+#include "Kismet/GameplayStatics.h"
 
 //////////////////////////////////////////////////////////////////////////
 // AZhengCharacter
 
 const float DOUBLE_PRESS_TIMING_WINDOW = 0.2f;
 const float STRUM_TO_COMMAND_TIME = 0.1f;
+const float BLOCK_TIME = 5.0f;
+//attacks in flight at once before the pool has to spawn more
+const int ATTACK_POOL_SIZE = 8;
+
+static inline uint8 InputBit(SimInput i_input)
+{
+	return static_cast<uint8>(1 << static_cast<int>(i_input));
+}
+
+//Maps controller buttons onto the simulation's inputs
+static bool ToSimInput(ControllerInputs i_input, SimInput& o_simInput)
+{
+	switch (i_input)
+	{
+	case ControllerInputs::Right: o_simInput = SimInput::Right; return true;
+	case ControllerInputs::Left: o_simInput = SimInput::Left; return true;
+	case ControllerInputs::Up: o_simInput = SimInput::Up; return true;
+	case ControllerInputs::Down: o_simInput = SimInput::Down; return true;
+	case ControllerInputs::Physical: o_simInput = SimInput::Physical; return true;
+	case ControllerInputs::Magical: o_simInput = SimInput::Magical; return true;
+	case ControllerInputs::Pushback: o_simInput = SimInput::Pushback; return true;
+	case ControllerInputs::Special: o_simInput = SimInput::Special; return true;
+	default: return false;
+	}
+}
+
+//The character's fighter is the only one on its timer wheel, so payloads are just the SimTimer
+static void OnFighterTimerFired(void* i_context, uint32_t i_payload)
+{
+	static_cast<ZhengFighterSim*>(i_context)->OnTimerDue(static_cast<SimTimer>(i_payload));
+}
+
+static uint8 ToSimComponent(EPlayerAttackComponent i_component)
+{
+	switch (i_component)
+	{
+	case EPlayerAttackComponent::Magical: return static_cast<uint8>(SimAttackComponent::Magical);
+	case EPlayerAttackComponent::Pushback: return static_cast<uint8>(SimAttackComponent::Pushback);
+	case EPlayerAttackComponent::Special: return static_cast<uint8>(SimAttackComponent::Special);
+	default: return static_cast<uint8>(SimAttackComponent::Physical);
+	}
+}
+
+static EPlayerAttackComponent ToAttackComponent(uint8 i_simComponent)
+{
+	switch (static_cast<SimAttackComponent>(i_simComponent))
+	{
+	case SimAttackComponent::Magical: return EPlayerAttackComponent::Magical;
+	case SimAttackComponent::Pushback: return EPlayerAttackComponent::Pushback;
+	case SimAttackComponent::Special: return EPlayerAttackComponent::Special;
+	default: return EPlayerAttackComponent::Physical;
+	}
+}
 
 AZhengCharacter::AZhengCharacter()
 {
@@ -65,42 +124,28 @@ AZhengCharacter::AZhengCharacter()
 	playerNumber = EPlayerNumber::P1;
 	currentTarget = nullptr;
 
-	health = MaxHealth;
-	alive = true;
-
-	roundsWon = 0;
-
-	dashing = false;
-	dashCurrentTime = 0.0f;
-	dashEnding = false;
-	dashEndingCurrentTime = 0.0f;
+	strumToCommandTime = STRUM_TO_COMMAND_TIME;
 	dashDirection = FVector(0, 0, 0);
-	dashOnCooldown = false;
-	dashOnCooldownCurrentTime = 0.0f;
 
-	attackEnding = false;
-	attackEndingCurrentTime = 0.0f;
+	simAccumulator = 0.0f;
+	simTick = 0;
+	FMemory::Memzero(pendingInput);
 
-	strumming = false;
-	strumToCommandCurrentTime = 0.0f;
-	strumToCommandTime = STRUM_TO_COMMAND_TIME;
-
-	beatConsumed = false;
-	beatPassed = false;
+	replayWriter = nullptr;
+	replayFighter = 0;
 
-	rightPressed = false;
-	rightPressedLastTime = 0.0f;
-	leftPressed = false;
-	leftPressedLastTime = 0.0f;
-	upPressed = false;
-	upPressedLastTime = 0.0f;
-	downPressed = false;
-	downPressedLastTime = 0.0f;
+	beatClock = nullptr;
+	gameMode = nullptr;
+	kinematicsFrame = 0;
+	rosterIndex = -1;
+	facingForward = FVector(1.0f, 0.0f, 0.0f);
+	facingRight = FVector(0.0f, 1.0f, 0.0f);
+	pendingStrumPressTime = -1.0;
+	strumStartTime = 0.0;
 
-	stumblePressed = false;
-	damagePressed = false;
-	stumbleBlockPressed = false;
-	damageBlockPressed = false;
+	ApplySimTuning();
+	timerWheel.Initialize(SIM_NUM_TIMERS, 0);
+	fighterSim.Initialize(&simTuning, &timerWheel, 0);
 }
 
 void AZhengCharacter::BeginPlay()
@@ -108,6 +153,56 @@ void AZhengCharacter::BeginPlay()
 	Super::BeginPlay();
 
 	playerAttackFactory->SetPlayerRef(this);
+
+	//pick up whatever the blueprint changed on the tuning properties
+	ApplySimTuning();
+	fighterSim.ResetForBattle();
+
+	//the game mode keeps the beat with the music; without one, keep our own from now
+	gameMode = Cast<AZhengGameMode>(UGameplayStatics::GetGameMode(this));
+	if (gameMode != nullptr)
+	{
+		beatClock = &gameMode->GetBeatClock();
+
+		//the game mode works out everyone's facing before we move
+		AddTickPrerequisiteActor(gameMode);
+	}
+	else
+	{
+		ownBeatClock.StartBeats(simTuning.BeatsPerMinute, FPlatformTime::Seconds(), 0.0, nullptr);
+		beatClock = &ownBeatClock;
+	}
+
+	//spawn every projectile we're likely to need now, rather than mid fight
+	attackPool.Initialize(GetWorld(), RegularAttack, ATTACK_POOL_SIZE);
+	fireOrbPool.Initialize(GetWorld(), FireOrbClass, SIM_MAX_FIRE_ORBS);
+}
+
+void AZhengCharacter::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	GetWorldTimerManager().ClearAllTimersForObject(this);
+	attackLifeSpans.Reset();
+	attackPool.Shutdown();
+	fireOrbPool.Shutdown();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+//Copies the editable tuning properties into what the combat rules read
+void AZhengCharacter::ApplySimTuning()
+{
+	simTuning.MaxHealth = MaxHealth;
+	simTuning.DefaultWalkSpeed = DefaultWalkSpeed;
+	simTuning.DashWalkSpeed = DashWalkSpeed;
+	simTuning.DashMaxTime = DashMaxTime;
+	simTuning.DashEndingTime = DashEndingTime;
+	simTuning.DashCooldownTime = DashCooldownTime;
+	simTuning.AttackEndingTime = AttackEndingTime;
+	simTuning.ForwardWalkSpeedMod = ForwardWalkSpeedMod;
+	simTuning.SideWalkSpeedMod = SideWalkSpeedMod;
+	simTuning.BlockTime = BLOCK_TIME;
+	simTuning.DoublePressTimingWindow = DOUBLE_PRESS_TIMING_WINDOW;
+	simTuning.StrumToCommandTime = strumToCommandTime;
 }
 
 void AZhengCharacter::Tick(float deltaTime)
@@ -115,16 +210,11 @@ void AZhengCharacter::Tick(float deltaTime)
 	Super::Tick(deltaTime);
 
 	//When we die, stop processing tick
-	if (!alive)
+	if (!IsAlive())
 		return;
 
-	//Deal with any inputs
-	HandleInputs();
-
-
-	//Rotation
-	
-	if (currentTarget !=  nullptr && !(this->GetCharacterMovement()->IsFalling()))
+	//Rotation, unless the game mode already did everyone's this frame
+	if (kinematicsFrame != GFrameCounter && ShouldFaceTarget())
 	{
 		FRotator newRotation = UKismetMathLibrary::FindLookAtRotation(GetActorLocation(), currentTarget->GetActorLocation());
 		newRotation = FRotator(0.0f, newRotation.Yaw, 0.0f);
@@ -132,25 +222,55 @@ void AZhengCharacter::Tick(float deltaTime)
 		SetActorRotation(newRotation);
 	}
 
-	
+	//Run the combat rules in fixed ticks, however long this frame was
+	if (gameMode != nullptr)
+	{
+		//the game mode's ticks, so every fighter steps on one shared clock
+		uint32 firstTick;
+		int numTicks;
+		double lastTickEndTime;
+		gameMode->GetFrameTicks(firstTick, numTicks, lastTickEndTime);
+
+		for (int i = 0; i < numTicks; i++)
+		{
+			//inputs stamped before the end of this tick belong to it
+			const double tickEndTime = lastTickEndTime - (numTicks - 1 - i) * SIM_TICK_SECONDS;
+			HandleInputs(tickEndTime);
+			StepSimulation(tickEndTime, firstTick + i);
+		}
+	}
+	else
+	{
+		simAccumulator += deltaTime;
+		const double frameEndTime = FPlatformTime::Seconds();
+
+		while (simAccumulator >= SIM_TICK_SECONDS)
+		{
+			simAccumulator -= SIM_TICK_SECONDS;
+
+			const double tickEndTime = frameEndTime - simAccumulator;
+			HandleInputs(tickEndTime);
+			StepSimulation(tickEndTime, simTick);
+		}
+	}
+
 	//Movement
+	const ZhengFighterState& fighter = fighterSim.GetState();
 	float x = 0.0f;
 	float y = 0.0f;
 
-	if (rightPressed)
+	if (fighter.heldButtons & InputBit(SimInput::Right))
 		x += 1.0f;
-	if (leftPressed)
+	if (fighter.heldButtons & InputBit(SimInput::Left))
 		x -= 1.0f;
-	if (upPressed)
+	if (fighter.heldButtons & InputBit(SimInput::Up))
 		y += 1.0f;
-	if (downPressed)
+	if (fighter.heldButtons & InputBit(SimInput::Down))
 		y -= 1.0f;
 
-
-	//Movement
-	if (dashing)
+	if (fighter.dashing)
 	{
-		if (!dashEnding)
+		if (!fighter.dashEnding)
 		{
 			DashPlayer();
 		}
@@ -166,160 +286,148 @@ void AZhengCharacter::Tick(float deltaTime)
 			MovePlayer(x, y);
 		}
 	}
-
-	//Timers
-	UpdateTimers(deltaTime);
 }
 
-void AZhengCharacter::HandleInputs()
+//Moves the queued inputs that happened before i_tickEndTime into the next tick's input frame, oldest first
+void AZhengCharacter::HandleInputs(double i_tickEndTime)
 {
-	if (inputQueue.empty())
-	{
-		return;
-	}
+	ControllerInput input;
+	const double tickStartTime = i_tickEndTime - SIM_TICK_SECONDS;
 
-	for (std::list<ControllerInput*>::iterator it = inputQueue.begin(); it != inputQueue.end(); ++it)
+	while (inputQueue.Peek(input) && input.Timestamp < i_tickEndTime)
 	{
-		bool inputProcessed = false;
+		inputQueue.Pop(input);
+
+		SimInput simInput;
+		if (!ToSimInput(input.Input, simInput))
+			continue;
 
-		if ((*it)->InputType == ControllerInputTypes::Press)
+		if (input.InputType == ControllerInputTypes::Press)
 		{
-			switch ((*it)->Input)
+			pendingInput.held |= InputBit(simInput);
+			pendingInput.pressed |= InputBit(simInput);
+
+			//the rules judge double presses to the sub-tick, so two taps inside one tick still count
+			int direction = static_cast<int>(simInput);
+			if (direction < SIM_NUM_DIRECTIONS)
 			{
-			case ControllerInputs::Right:
-				rightPressed = true;
-				if (CanDash())
-				{
-					if (GetWorld()->GetTimeSeconds() - rightPressedLastTime < DOUBLE_PRESS_TIMING_WINDOW)
-					{
-						StartDash(this->GetActorRightVector());
-					}
-				}
-				rightPressedLastTime = GetWorld()->GetTimeSeconds();
-				break;
-			case ControllerInputs::Left:
-				leftPressed = true;
-				if (CanDash())
-				{
-					if (GetWorld()->GetTimeSeconds() - leftPressedLastTime < DOUBLE_PRESS_TIMING_WINDOW)
-					{
-						StartDash(this->GetActorRightVector() * -1);
-					}
-				}
-				leftPressedLastTime = GetWorld()->GetTimeSeconds();
-				break;
-			case ControllerInputs::Up:
-				upPressed = true;
-				if (CanDash())
-				{
-					if (GetWorld()->GetTimeSeconds() - upPressedLastTime < DOUBLE_PRESS_TIMING_WINDOW)
-					{
-						StartDash(this->GetActorForwardVector());
-					}
-				}
-				upPressedLastTime = GetWorld()->GetTimeSeconds();
-				break;
-			case ControllerInputs::Down:
-				downPressed = true;
-				if (CanDash())
-				{
-					if (GetWorld()->GetTimeSeconds() - downPressedLastTime < DOUBLE_PRESS_TIMING_WINDOW)
-					{
-						StartDash(this->GetActorForwardVector() * -1);
-					}
-				}
-				downPressedLastTime = GetWorld()->GetTimeSeconds();
-				break;
-			case ControllerInputs::Physical:
-				stumblePressed = true;
-				if (CanStrum())
-				{
-					if (!IsStrumming())
-					{
-						StartStrum();
-					}
-					
-					strummedCommandsList.Add(EPlayerAttackComponent::Physical);
-					strumToCommandCurrentTime = 0.0f;
-				}
-				break;
-			case ControllerInputs::Magical:
-				damagePressed = true;
-				if (CanStrum())
-				{
-					if (!IsStrumming())
-					{
-						StartStrum();
-					}
-
-					strummedCommandsList.Add(EPlayerAttackComponent::Magical);
-					strumToCommandCurrentTime = 0.0f;
-				}
-				break;
-			case ControllerInputs::Pushback:
-				stumbleBlockPressed = true;
-				if (CanStrum())
-				{
-					if (!IsStrumming())
-					{
-						StartStrum();
-					}
-
-					strummedCommandsList.Add(EPlayerAttackComponent::Pushback);
-					strumToCommandCurrentTime = 0.0f;
-				}
-				break;
-			case ControllerInputs::Special:
-				damageBlockPressed = true;
-				if (CanStrum())
-				{
-					if (!IsStrumming())
-					{
-						StartStrum();
-					}
-
-					strummedCommandsList.Add(EPlayerAttackComponent::Special);
-					strumToCommandCurrentTime = 0.0f;
-				}
-				break;
+				//a press queued from before this tick counts as right at its start
+				int subtick = FMath::FloorToInt((input.Timestamp - tickStartTime) / SIM_TICK_SECONDS * SIM_SUBTICKS_PER_TICK);
+				uint8 pressTime = static_cast<uint8>(FMath::Clamp(subtick, 0, SIM_SUBTICKS_PER_TICK - 1));
+
+				if (pendingInput.pressCount[direction] == 0)
+					pendingInput.firstPress[direction] = pressTime;
+				pendingInput.lastPress[direction] = pressTime;
+				if (pendingInput.pressCount[direction] < MAX_uint8)
+					pendingInput.pressCount[direction]++;
 			}
+
+			//the first strum press of a tick is the one that can start a strum
+			if (simInput >= SimInput::Physical && pendingStrumPressTime < 0.0)
+				pendingStrumPressTime = input.Timestamp;
 		}
-		else if ((*it)->InputType == ControllerInputTypes::Release)
+		else if (input.InputType == ControllerInputTypes::Release)
 		{
-			switch ((*it)->Input)
-			{
-			case ControllerInputs::Right:
-				rightPressed = false;
-				break;
-			case ControllerInputs::Left:
-				leftPressed = false;
-				break;
-			case ControllerInputs::Up:
-				upPressed = false;
-				break;
-			case ControllerInputs::Down:
-				downPressed = false;
-				break;
-			case ControllerInputs::Physical:
-				stumblePressed = false;
-				break;
-			case ControllerInputs::Magical:
-				damagePressed = false;
-				break;
-			case ControllerInputs::Pushback:
-				stumbleBlockPressed = false;
-				break;
-			case ControllerInputs::Special:
-				damageBlockPressed = false;
-				break;
-			}
+			pendingInput.held &= ~InputBit(simInput);
 		}
+	}
+}
+
+//Advances the combat rules by one tick and carries out what they decided in the world.
+//i_tickEndTime is when this tick ends on the FPlatformTime::Seconds clock, i_sharedTick is the game mode's
+//number for it.
+void AZhengCharacter::StepSimulation(double i_tickEndTime, uint32 i_sharedTick)
+{
+	//the beat as the music has it at this tick, not wherever it was when the frame started
+	SimBeat beat;
+	ZhengBeatTime tickBeat;
+	if (beatClock->GetBeatAt(i_tickEndTime, tickBeat))
+	{
+		beat.elapsed = static_cast<float>(tickBeat.elapsed);
+		beat.remaining = static_cast<float>(tickBeat.remaining);
+	}
+	else
+	{
+		beat.elapsed = 0.0f;
+		beat.remaining = 0.0f;
+	}
 
-		inputQueue.remove(*it);
-		it--;
+	//and as it was at the strum press itself, so the rules judge the beat lock to the sample rather than to the tick
+	ZhengBeatTime pressBeat;
+	if (pendingStrumPressTime >= 0.0 && beatClock->GetBeatAt(pendingStrumPressTime, pressBeat))
+	{
+		beat.pressElapsed = static_cast<float>(pressBeat.elapsed);
+		beat.pressRemaining = static_cast<float>(pressBeat.remaining);
+	}
+	else
+	{
+		beat.pressElapsed = beat.elapsed;
+		beat.pressRemaining = beat.remaining;
+	}
 
+	uint32 replayTick;
+	if (replayWriter != nullptr && gameMode != nullptr && gameMode->GetReplayTick(i_sharedTick, replayTick))
+	{
+		replayWriter->RecordInput(replayTick, replayFighter, pendingInput);
 	}
 
+	const bool wasStrumming = fighterSim.GetState().strumming;
+
+	timerWheel.AdvanceTo(simTick, OnFighterTimerFired, &fighterSim);
+	uint32 simEvents = fighterSim.Step(simTick++, pendingInput, beat, GetCharacterMovement()->IsFalling());
+
+	//only what's held carries over to the next tick
+	const uint8 held = pendingInput.held;
+	FMemory::Memzero(pendingInput);
+	pendingInput.held = held;
+
+	if (!wasStrumming && pendingStrumPressTime >= 0.0)
+	{
+		strumStartTime = pendingStrumPressTime;
+	}
+	pendingStrumPressTime = -1.0;
+
+	if (simEvents & SimFighterEvent_DashStarted)
+	{
+		StartDash();
+	}
+	if (simEvents & SimFighterEvent_DashEnded)
+	{
+		EndDash();
+	}
+	if (simEvents & SimFighterEvent_ComponentAdded)
+	{
+		EPlayerAttackComponent component = ToAttackComponent(fighterSim.GetState().lastAddedComponent);
+		playerAttackFactory->AddComponentToAttack(component, strumToCommandTime, GetWorld());
+
+		//judged at the moment the strum was pressed, however late in the frame it got handled
+		ZhengBeatTime pressBeat;
+		float timing = 0.0f;
+		if (beatClock->GetBeatAt(strumStartTime, pressBeat))
+		{
+			timing = static_cast<float>(FMath::Min(pressBeat.elapsed, pressBeat.remaining));
+		}
+		OnInputCommand.Broadcast(playerNumber, component, timing);
+	}
+	if (simEvents & SimFighterEvent_AttackLaunched)
+	{
+		SendAttack();
+	}
+	if (simEvents & SimFighterEvent_BlockStarted)
+	{
+		//a one strum special blocks instead of attacking
+		StartBlocking();
+		playerAttackFactory->ClearCurrentAttack();
+		OnSendAttack.Broadcast(playerNumber);
+	}
+	if (simEvents & SimFighterEvent_BlockEnded)
+	{
+		StopBlocking();
+	}
+	if (simEvents & SimFighterEvent_BeatLockReset)
+	{
+		print("Reset!");
+	}
 }
 
 void AZhengCharacter::MoveForward(float Value)
@@ -351,89 +459,6 @@ void AZhengCharacter::MoveRight(float Value)
 	}
 }
 
-void AZhengCharacter::UpdateTimers(float deltaTime)
-{
-	if (dashing)
-	{
-		if (!dashEnding)
-		{
-			dashCurrentTime += deltaTime;
-			if (dashCurrentTime >= DashMaxTime)
-			{
-				dashEndingCurrentTime = (dashCurrentTime - DashMaxTime);
-				dashEnding = true;
-			}
-		}
-		else //if in the end of the dash
-		{
-			dashEndingCurrentTime += deltaTime;
-			if (dashEndingCurrentTime >= DashEndingTime)
-			{
-				EndDash();
-			}
-		}
-
-	}
-
-	if (dashOnCooldown)
-	{
-		dashOnCooldownCurrentTime += deltaTime;
-		if (dashOnCooldownCurrentTime >= DashCooldownTime)
-		{
-			dashOnCooldown = false;
-			dashOnCooldownCurrentTime = 0.0f;
-		}
-	}
-
-	if (attackEnding)
-	{
-		attackEndingCurrentTime += deltaTime;
-		if (attackEndingCurrentTime >= AttackEndingTime)
-		{
-			attackEnding = false;
-			attackEndingCurrentTime = 0.0f;
-		}
-	}
-
-	if (strumming)
-	{
-		strumToCommandCurrentTime += deltaTime;
-		if (strumToCommandCurrentTime >= strumToCommandTime)
-		{
-			EndStrum();
-		}
-	}
-
-	//This two-part lock prevents the player from playing more than one note, and refreshes on the off-beat.
-	//The first part of the lock checks to make sure that a beat has passed by checking to see if the elapsed time is less than the
-	//remaining time -- in other words, checks to see if we're just after a beat.
-	//The second part checks to make sure that a beat is incoming, so after the off-beat. If it is, then we can release the lock fully.
-	
-	//Bypass for this lock below
-	//beatConsumed = false;
-	//beatPassed = false;
-
-	if (beatConsumed)
-	{
-		if (!beatPassed)
-		{
-			if (PlayerAttackFactory::elapsed < PlayerAttackFactory::remaining)
-			{
-				beatPassed = true;
-			}
-		}
-		else
-		{
-			if (PlayerAttackFactory::elapsed > PlayerAttackFactory::remaining)
-			{
-				beatConsumed = false;
-				beatPassed = false;
-				print("Reset!");
-			}
-		}
-	}
-}
-
 
 
 void AZhengCharacter::SetupPlayerInputComponent(class UInputComponent* PlayerInputComponent)
@@ -457,12 +482,12 @@ void AZhengCharacter::MovePlayer(float i_x, float i_y)
 	if (i_x > 0.0f)
 	{
 		scaleValue *= SideWalkSpeedMod;
-		direction += GetActorRightVector();
+		direction += GetFacingRight();
 	}
 	else if (i_x < 0.0f)
 	{
 		scaleValue *= SideWalkSpeedMod;
-		direction += GetActorRightVector() * -1;
+		direction += GetFacingRight() * -1;
 	}
 	else
 	{
@@ -473,12 +498,12 @@ void AZhengCharacter::MovePlayer(float i_x, float i_y)
 	if (i_y > 0.0f)
 	{
 		scaleValue *= ForwardWalkSpeedMod;
-		direction += GetActorForwardVector();
+		direction += GetFacingForward();
 	}
 	else if (i_y < 0.0f)
 	{
 		scaleValue *= ForwardWalkSpeedMod;
-		direction += GetActorForwardVector() * -1;
+		direction += GetFacingForward() * -1;
 	}
 	else
 	{
@@ -512,14 +537,38 @@ EPlayerNumber AZhengCharacter::GetPlayerNumber() const
 
 void AZhengCharacter::IncrementRoundsWon()
 {
-	roundsWon++;
-	printf("rounds won: %d", roundsWon);
-	OnWonRound.Broadcast(playerNumber, roundsWon);
+	fighterSim.IncrementRoundsWon();
+	UpdateRoster();
+	printf("rounds won: %d", GetRoundsWon());
+	OnWonRound.Broadcast(playerNumber, GetRoundsWon());
 }
 
 int AZhengCharacter::GetRoundsWon() const
 {
-	return roundsWon;
+	return fighterSim.GetState().roundsWon;
+}
+
+//Starts writing this character's per-tick input to i_writer as fighter i_fighter, on the game mode's ticks
+void AZhengCharacter::StartReplayRecording(ZhengReplayWriter* i_writer, int i_fighter)
+{
+	replayWriter = i_writer;
+	replayFighter = i_fighter;
+}
+
+void AZhengCharacter::StopReplayRecording()
+{
+	replayWriter = nullptr;
+}
+
+const ZhengTuning& AZhengCharacter::GetSimTuning() const
+{
+	return simTuning;
+}
+
+//The combat rules behind this character, for the game mode's round logic
+ZhengFighterSim* AZhengCharacter::GetFighterSim()
+{
+	return &fighterSim;
 }
 
 void AZhengCharacter::WinBattle()
@@ -529,60 +578,32 @@ void AZhengCharacter::WinBattle()
 
 bool AZhengCharacter::CanMove() const
 {
-	if (alive && !dashing && !attackEnding && !GetCharacterMovement()->IsFalling())
-	{
-		return true;
-	}
-	else
-	{
-		return false;
-	}
+	return fighterSim.CanMove() && !GetCharacterMovement()->IsFalling();
 }
 
 bool AZhengCharacter::IsAlive() const
 {
-	return alive;
+	return fighterSim.GetState().alive;
 }
 
 bool AZhengCharacter::CanAttack() const
 {
-	if (alive && !dashing && !attackEnding && !GetCharacterMovement()->IsFalling())
-	{
-		return true;
-	}
-	else
-	{
-		return false;
-	}
+	return fighterSim.CanAttack() && !GetCharacterMovement()->IsFalling();
 }
 
 bool AZhengCharacter::CanStrum() const
 {
-	if (alive && !dashing && !attackEnding && !GetCharacterMovement()->IsFalling() && !blocking)
-	{
-		return true;
-	}
-	else
-	{
-		return false;
-	}
+	return fighterSim.CanStrum() && !GetCharacterMovement()->IsFalling();
 }
 
 bool AZhengCharacter::CanDash() const
 {
-	if (alive && !dashing && !attackEnding && !strumming && !GetCharacterMovement()->IsFalling())
-	{
-		return true;
-	}
-	else
-	{
-		return false;
-	}
+	return fighterSim.CanDash() && !GetCharacterMovement()->IsFalling();
 }
 
 int AZhengCharacter::GetHealth() const
 {
-	return health;
+	return fighterSim.GetState().health;
 }
 
 void AZhengCharacter::SetTarget(AActor * i_target)
@@ -590,75 +611,76 @@ void AZhengCharacter::SetTarget(AActor * i_target)
 	currentTarget = i_target;
 }
 
-void AZhengCharacter::StartStrum()
+//Where the game mode keeps us in its roster, so it hears about our health without searching for us
+void AZhengCharacter::SetRosterIndex(int i_rosterIndex)
 {
-	strumming = true;
-	strumToCommandCurrentTime = 0.0f;
-	strummedCommandsList.Empty(); //empty out our strum list just in case
+	rosterIndex = i_rosterIndex;
 }
 
-//Ends and finalizes the strum
-void AZhengCharacter::EndStrum()
+//Shows our health and keeps the game mode's count of who's standing up to date
+void AZhengCharacter::ReportHealth()
 {
-	if (beatConsumed)
-	{
-		strummedCommandsList.Empty(); //empty out our strum list
-		return;
-	}
-	if (strummedCommandsList.Num() == 0)
-	{
-		print("Empty strummed commands list.");
-		return;
-	}
+	OnUpdateHealth.Broadcast(playerNumber, GetHealth(), MaxHealth);
+	UpdateRoster();
+}
 
-	if (strummedCommandsList.Num() >= 4)
+void AZhengCharacter::UpdateRoster()
+{
+	if (gameMode != nullptr && rosterIndex >= 0)
 	{
-		if (strummedCommandsList.Contains(EPlayerAttackComponent::Physical) && strummedCommandsList.Contains(EPlayerAttackComponent::Magical) &&
-			strummedCommandsList.Contains(EPlayerAttackComponent::Pushback) && strummedCommandsList.Contains(EPlayerAttackComponent::Special))
-		{
-			print("all strum commands in queue! Launch attack!");
-			SendAttack();
-		}
+		gameMode->UpdateRoster(rosterIndex);
 	}
-	else
+}
+
+AActor* AZhengCharacter::GetTarget() const
+{
+	return currentTarget;
+}
+
+//Whether we turn to look at our target this frame; in the air we keep whatever way we were facing
+bool AZhengCharacter::ShouldFaceTarget() const
+{
+	return IsAlive() && currentTarget != nullptr && !GetCharacterMovement()->IsFalling();
+}
+
+//Takes this frame's facing from the game mode's batch. i_turn says whether to actually turn to i_yaw.
+void AZhengCharacter::ApplyKinematics(float i_yaw, const FVector& i_forward, const FVector& i_right, bool i_turn)
+{
+	if (i_turn)
 	{
-		//we strum the first one we strummed
-		float timing = playerAttackFactory->AddComponentToAttack(strummedCommandsList[0], strumToCommandTime, GetWorld());
-		OnInputCommand.Broadcast(playerNumber, strummedCommandsList[0], timing);
+		SetActorRotation(FRotator(0.0f, i_yaw, 0.0f));
 	}
 
-	strumming = false;
-	beatConsumed = true;
-	strumToCommandCurrentTime = 0.0f;
-	strummedCommandsList.Empty(); //empty out our strum list
+	facingForward = i_forward;
+	facingRight = i_right;
+	kinematicsFrame = GFrameCounter;
+}
+
+//Which way is forward for moving and dashing, from the batch when it ran this frame
+FVector AZhengCharacter::GetFacingForward() const
+{
+	return (kinematicsFrame == GFrameCounter) ? facingForward : GetActorForwardVector();
+}
+
+FVector AZhengCharacter::GetFacingRight() const
+{
+	return (kinematicsFrame == GFrameCounter) ? facingRight : GetActorRightVector();
 }
 
-//Cancels a strum partway through
+//Kept for Blueprints; the strum itself lives in the rules now
 void AZhengCharacter::CancelStrum()
 {
-	strumming = true;
-	strumToCommandCurrentTime = 0.0f;
-	strummedCommandsList.Empty(); //empty out our strum list
+	fighterSim.CancelStrum();
 }
 
 bool AZhengCharacter::IsStrumming() const
 {
-	return strumming;
+	return fighterSim.GetState().strumming;
 }
 
+//Spawns the projectile for an attack the rules launched
 void AZhengCharacter::SendAttack()
 {
-	attackEnding = true;
-	//If it's a one strum special
-	if (playerAttackFactory->GetCurrentAttack().size() == 1 && playerAttackFactory->GetCurrentAttack().front().component == EPlayerAttackComponent::Special) {
-		//block
-		StartBlocking();
-		FTimerHandle handler;
-		GetWorld()->GetTimerManager().SetTimer(handler, this, &AZhengCharacter::StopBlocking, 5, false);
-		playerAttackFactory->ClearCurrentAttack();
-		OnSendAttack.Broadcast(playerNumber);
-		return;
-	}
 	FVector PlayerLocation;
 	FRotator PlayerRotation;
 	this->GetActorEyesViewPoint(PlayerLocation, PlayerRotation);
@@ -666,137 +688,229 @@ void AZhengCharacter::SendAttack()
 	// To world location
 	FVector MuzzleLocation = PlayerLocation + FTransform(PlayerRotation).TransformVector(FVector(190, 0, -30));
 	FRotator MuzzleRotation = PlayerRotation;
-	FActorSpawnParameters spawnParams;
-	spawnParams.Owner = this;
-	spawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
-	spawnParams.bNoFail = true;
 
-	APlayerAttack* toReturn = GetWorld()->SpawnActor<APlayerAttack>(RegularAttack, MuzzleLocation, PlayerRotation, spawnParams);
+	APlayerAttack* toReturn = Cast<APlayerAttack>(attackPool.Acquire(MuzzleLocation, PlayerRotation, this));
 	FVector LaunchDirection = MuzzleRotation.Vector();
 	LaunchDirection = FVector(LaunchDirection.X, LaunchDirection.Y, 0);
 	if (toReturn != nullptr) {
-		toReturn->ProjectileMovementComponent->HomingTargetComponent = currentTarget->GetRootComponent();
-		std::list<ComponentBundle> components = playerAttackFactory->GetCurrentAttack();
-		toReturn->SetComponents(components, Cadenzas, playerNumber);
+		toReturn->ProjectileMovementComponent->HomingTargetComponent = (currentTarget != nullptr) ? currentTarget->GetRootComponent() : nullptr;
+		//handed straight over rather than through a named copy
+		toReturn->SetComponents(playerAttackFactory->GetCurrentAttack(), Cadenzas, playerNumber);
 		toReturn->SetPropertiesBasedOnSecondaryModulator();
 		toReturn->SetPropertiesBasedOnTertiaryModulator();
 		toReturn->SetPropertiesBasedOnComponents(LaunchDirection);
 		toReturn->ProjectileMovementComponent->Velocity = LaunchDirection * toReturn->ProjectileMovementComponent->InitialSpeed;
 		toReturn->Initialized = true;
+
+		//the game mode flies every attack in one batch and ages it there; without one, or with no room
+		//left in the batch, the movement component flies it and a timer takes it back
+		if (gameMode == nullptr || !gameMode->LaunchProjectile(toReturn, currentTarget))
+		{
+			StartAttackLifeSpan(toReturn);
+		}
 	}
 	playerAttackFactory->ClearCurrentAttack();
 	OnSendAttack.Broadcast(playerNumber);
 }
 
-void AZhengCharacter::StartDash(FVector i_dashDirection)
+//Takes back an attack that hit or expired, instead of destroying it
+void AZhengCharacter::ReleaseAttack(APlayerAttack* i_attack)
 {
-	if (dashOnCooldown)
+	if (i_attack == nullptr)
+		return;
+
+	if (gameMode != nullptr)
 	{
+		gameMode->RemoveProjectile(i_attack);
+	}
+
+	FTimerHandle lifeSpan;
+	if (attackLifeSpans.RemoveAndCopyValue(i_attack, lifeSpan))
+	{
+		GetWorldTimerManager().ClearTimer(lifeSpan);
+	}
+
+	i_attack->Initialized = false;
+	attackPool.Release(i_attack);
+}
+
+//Takes an attack back once the blueprint's lifespan for it is up. The pool cleared the lifespan itself,
+//which would have destroyed the attack behind the pool's back.
+void AZhengCharacter::StartAttackLifeSpan(APlayerAttack* i_attack)
+{
+	if (i_attack->InitialLifeSpan <= 0.0f)
 		return;
+
+	FTimerDelegate expire = FTimerDelegate::CreateUObject(this, &AZhengCharacter::OnAttackLifeSpanExpired, TWeakObjectPtr<APlayerAttack>(i_attack));
+	GetWorldTimerManager().SetTimer(attackLifeSpans.FindOrAdd(i_attack), expire, i_attack->InitialLifeSpan, false);
+}
+
+void AZhengCharacter::OnAttackLifeSpanExpired(TWeakObjectPtr<APlayerAttack> i_attack)
+{
+	if (i_attack.IsValid())
+	{
+		ReleaseAttack(i_attack.Get());
 	}
+}
+
+//Hands the blueprint a pooled fire orb for AddFireOrb to show
+AActor* AZhengCharacter::SpawnFireOrb(const FTransform& i_transform)
+{
+	return fireOrbPool.Acquire(i_transform.GetLocation(), i_transform.Rotator(), this);
+}
 
+//Takes back a fire orb from ConsumeFireOrbs, instead of destroying it
+void AZhengCharacter::ReleaseFireOrb(AActor* i_fireOrb)
+{
+	fireOrbPool.Release(i_fireOrb);
+}
+
+//Starts the dash the rules decided on, in the pressed direction relative to how we're facing right now
+void AZhengCharacter::StartDash()
+{
 	GetCharacterMovement()->MaxWalkSpeed = DashWalkSpeed;
 
-	dashing = true;
-	dashCurrentTime = 0.0f;
-	dashEnding = false;
-	dashEndingCurrentTime = 0.0f;
-	dashDirection = i_dashDirection;
+	switch (static_cast<SimInput>(fighterSim.GetState().dashDirection))
+	{
+	case SimInput::Right:
+		dashDirection = GetFacingRight();
+		break;
+	case SimInput::Left:
+		dashDirection = GetFacingRight() * -1;
+		break;
+	case SimInput::Up:
+		dashDirection = GetFacingForward();
+		break;
+	case SimInput::Down:
+		dashDirection = GetFacingForward() * -1;
+		break;
+	}
 }
 
 void AZhengCharacter::EndDash()
 {
 	GetCharacterMovement()->MaxWalkSpeed = DefaultWalkSpeed;
 
-	dashing = false;
-	dashCurrentTime = 0.0f;
-	dashEnding = false;
-	dashEndingCurrentTime = 0.0f;
 	dashDirection = FVector(0, 0, 0);
-
-	dashOnCooldown = true;
-	dashOnCooldownCurrentTime = 0.0f;
 }
 
 void AZhengCharacter::TakeDamage(int i_damage)
 {
-	if (!alive)
+	if (!IsAlive())
 		return;
 
 
-	health -= i_damage;
-	printf_2("new health: %d, max health: %d", health, MaxHealth);
-	if (health <= 0)
+	fighterSim.TakeDamage(i_damage);
+	printf_2("new health: %d, max health: %d", GetHealth(), MaxHealth);
+	if (!IsAlive())
 		Die();
-	OnUpdateHealth.Broadcast(playerNumber, health, MaxHealth);
+	ReportHealth();
 }
 
 void AZhengCharacter::RecoverHealth(int i_health)
 {
-	health += i_health;
-	if (health > MaxHealth)
-		health = MaxHealth;
-	OnUpdateHealth.Broadcast(playerNumber, health, MaxHealth);
+	fighterSim.RecoverHealth(i_health);
+	ReportHealth();
 }
 
+//Collision callbacks land here. With a game mode the hit waits for its resolve phase at the end of the
+//frame, so the outcome doesn't depend on which callback fired first; without one it lands right away.
 void AZhengCharacter::GetHitByAttack(AttackInformation * i_AttackInfo)
 {
-	if (blocking && i_AttackInfo->PrimaryAttackType == EPlayerAttackComponent::Magical) { //Magical attacks can be blocked
+	if (gameMode != nullptr && rosterIndex >= 0)
+	{
+		gameMode->QueueHit(this, rosterIndex, *i_AttackInfo);
+		return;
+	}
+
+	bool blocked;
+	ZhengHitResult result;
+	JudgeHit(*i_AttackInfo, blocked, result);
+
+	FVector launchVector = FVector::ZeroVector;
+	ShowHit(*i_AttackInfo, blocked, result, launchVector);
+	if (!launchVector.IsZero())
+	{
+		LaunchCharacter(launchVector, false, false);
+	}
+}
+
+//The rules' half of a hit: whether it's blocked and what it does to us. Only touches our own fighter,
+//so hits on different characters can be judged on different threads.
+void AZhengCharacter::JudgeHit(const AttackInformation& i_attackInfo, bool& o_blocked, ZhengHitResult& o_result)
+{
+	ZhengAttackInfo attack;
+	attack.primaryType = ToSimComponent(i_attackInfo.PrimaryAttackType);
+	attack.physicalCount = static_cast<uint8>(i_attackInfo.PhysicalCount);
+	attack.magicalCount = static_cast<uint8>(i_attackInfo.MagicalCount);
+	attack.pushbackCount = static_cast<uint8>(i_attackInfo.PushbackCount);
+	attack.specialCount = static_cast<uint8>(i_attackInfo.SpecialCount);
+	attack.generalScaler = i_attackInfo.GeneralScaler;
+
+	FMemory::Memzero(o_result);
+	o_blocked = fighterSim.BlocksAttack(attack);
+
+	//cadenzas do their own thing on impact
+	if (o_blocked || i_attackInfo.Cadenza)
+		return;
+
+	o_result = fighterSim.ApplyHit(attack);
+}
+
+//The world's half of a judged hit, on the game thread. Knockback is added to io_launchVector so several
+//hits in one frame launch us once.
+void AZhengCharacter::ShowHit(const AttackInformation& i_attackInfo, bool i_blocked, const ZhengHitResult& i_result, FVector& io_launchVector)
+{
+	if (i_blocked) {
 		print("Attack Blocked!");
 		return;
 	}
 
-	if (i_AttackInfo->Cadenza) {
-		i_AttackInfo->Cadenza->ImpactPlayer(this);
+	if (i_attackInfo.Cadenza) {
+		i_attackInfo.Cadenza->ImpactPlayer(this);
 		return;
 	}
 
 	print("Got hit by attack.");
-	int mpSum = i_AttackInfo->PhysicalCount + i_AttackInfo->MagicalCount;
-	if (mpSum) { TakeDamage((3 + mpSum) * static_cast<int>(i_AttackInfo->GeneralScaler)); } //Temporary
+	if (i_result.damage) {
+		printf_2("new health: %d, max health: %d", GetHealth(), MaxHealth);
+		if (i_result.died)
+			Die();
+		ReportHealth();
+	}
 
-	FVector PlayerLocation;
-	FRotator PlayerRotation;
-	GetActorEyesViewPoint(PlayerLocation, PlayerRotation);
-	FVector LaunchVector = GetActorForwardVector() *= (-i_AttackInfo->PushbackCount * 200);
-	LaunchVector.Z += 50 + 150 * i_AttackInfo->PushbackCount;
-	LaunchCharacter(LaunchVector, false, false);
-	//This is not abstracted per character
-	if (i_AttackInfo->PrimaryAttackType == EPlayerAttackComponent::Special) {
-		for (int i = 0; i < i_AttackInfo->SpecialCount-1; i++) {
-			if (fireOrbs.Num() <= 5) {
-				AddFireOrb();
-			}
-		}
-		ConsumeFireOrbs();
+	FVector LaunchVector = GetActorForwardVector() *= (-i_result.pushbackCount * 200);
+	LaunchVector.Z += 50 + 150 * i_result.pushbackCount;
+	io_launchVector += LaunchVector;
+
+	//the rules already decided how many orbs change, this only shows them
+	for (int i = 0; i < i_result.fireOrbsAdded; i++) {
+		AddFireOrb();
 	}
-	else {
-		for (int i = 0; i < i_AttackInfo->SpecialCount; i++) {
-			if (fireOrbs.Num() < 5) {
-				AddFireOrb();
-			}
-		}
+	if (i_result.fireOrbsConsumed) {
+		ConsumeFireOrbs();
 	}
 }
 
 void AZhengCharacter::FallOffMap()
 {
-	health = 0;
-	OnUpdateHealth.Broadcast(playerNumber, health, MaxHealth);
+	fighterSim.FallOffMap();
+	ReportHealth();
 
 	Die();
 }
 
 void AZhengCharacter::Die()
 {
-	alive = false;
+	fighterSim.Die();
+	UpdateRoster();
 	OnDie.Broadcast(playerNumber);
 }
 
 void AZhengCharacter::ResetForBattle()
 {
-	roundsWon = 0;
-	OnWonRound.Broadcast(playerNumber, roundsWon);
+	fighterSim.ResetForBattle();
+	OnWonRound.Broadcast(playerNumber, GetRoundsWon());
 	OnRestartBattle.Broadcast();
 	ResetForRound();
 }
@@ -806,54 +920,40 @@ void AZhengCharacter::ResetForRound()
 	GetCharacterMovement()->MaxWalkSpeed = DefaultWalkSpeed;
 	GetCharacterMovement()->Velocity = FVector(0.0f, 0.0f, 0.0f);
 
-	alive = true;
-	health = MaxHealth;
-
-	dashing = false;
-	dashCurrentTime = 0.0f;
-	dashEnding = false;
-	dashEndingCurrentTime = 0.0f;
+	fighterSim.ResetForRound();
 	dashDirection = FVector(0, 0, 0);
-	dashOnCooldown = false;
-	dashOnCooldownCurrentTime = 0.0f;
-
-	attackEnding = false;
-	attackEndingCurrentTime = 0.0f;
 
-	strumming = false;
-	strumToCommandCurrentTime = 0.0f;
-
-	beatConsumed = false;
-	beatPassed = false;
-
-	rightPressed = false;
-	rightPressedLastTime = 0.0f;
-	leftPressed = false;
-	leftPressedLastTime = 0.0f;
-	upPressed = false;
-	upPressedLastTime = 0.0f;
-	downPressed = false;
-	downPressedLastTime = 0.0f;
-
-	stumblePressed = false;
-	damagePressed = false;
-	stumbleBlockPressed = false;
-	damageBlockPressed = false;
+	simAccumulator = 0.0f;
+	FMemory::Memzero(pendingInput);
+	inputQueue.Clear();
 
 	playerAttackFactory->ClearCurrentAttack();
-	OnUpdateHealth.Broadcast(playerNumber, health, MaxHealth);
+	ReportHealth();
 	OnSendAttack.Broadcast(playerNumber); //should have a different thing for clearing the command UI but yeah
 }
 
-void AZhengCharacter::ReceiveInput(ControllerInput* i_controllerInput)
+//Queues an input for the next tick. Inputs are copied by value, so callers can pass a stack object.
+//Safe to call from one thread other than the game thread (e.g. a dedicated input thread).
+//Inputs should be stamped with FPlatformTime::Seconds() when the device reports them; unstamped ones are stamped here.
+void AZhengCharacter::ReceiveInput(const ControllerInput& i_controllerInput)
 {
-	inputQueue.push_front(i_controllerInput);
+	ControllerInput stampedInput = i_controllerInput;
+	if (stampedInput.Timestamp <= 0.0)
+	{
+		stampedInput.Timestamp = FPlatformTime::Seconds();
+	}
+
+	if (!inputQueue.Push(stampedInput))
+	{
+		print("Input queue full, dropping input.");
+	}
 }
 
-//Checks to see if we can process the player's inputs at the moment
 bool AZhengCharacter::CanProcessInputs() const
 {
-	if (alive && !dashing && !GetCharacterMovement()->IsFalling())
+	const ZhengFighterState& fighter = fighterSim.GetState();
+
+	if (fighter.alive && !fighter.dashing && !GetCharacterMovement()->IsFalling())
 	{
 		return true;
 	}
@@ -3,14 +3,124 @@
 #include "ZhengGameMode.h"
 #include "ZhengPlayerController.h"
 #include "ZhengCharacter.h"
+#include "ZhengSimulation.h"
+#include "ZhengReplay.h"
+#include "ZhengBeatClock.h"
+#include "ZhengBeatMap.h"
+#include "ZhengProjectileSystem.h"
+#include "ZhengKinematics.h"
+#include "ZhengRoster.h"
+#include "ZhengSpatialGrid.h"
+#include "PlayerAttack-inl.h"
+#include "AudioDevice.h"
+#include "Components/AudioComponent.h"
+#include "Kismet/GameplayStatics.h"
+#include "Sound/SoundWave.h"
+#include "Async/ParallelFor.h"
+#include "Sound/SoundSubmix.h"
+#include "GameFramework/ProjectileMovementComponent.h"
 #include "UObject/ConstructorHelpers.h"
 
+//attacks the projectile system can fly at once; more than that fall back to their own movement component
+const int MAX_PROJECTILES_IN_FLIGHT = 1024;
+//free-for-all targeting looks for neighbours in cells this big
+const float FREE_FOR_ALL_CELL_SIZE = 800.0f;
+//players without a player start of their own stand on a circle this far from the middle
+const float EXTRA_SPAWN_RADIUS = 600.0f;
+//hits a frame usually takes, so the buffer doesn't grow during play
+const int HIT_BUFFER_RESERVE = 64;
+//who sent a hit when it didn't come from an attack the projectile system flew; sorts after everyone
+const int HIT_UNKNOWN_ATTACKER = SIM_MAX_FIGHTERS;
+//the music jumping by more than this (a seek, a pause, a restart) moves the beats with it
+const double MUSIC_RESYNC_SECONDS = 0.1;
+//how far the beats move towards each new reading of where the music is, since readings jitter by about a buffer
+const double MUSIC_ORIGIN_FILTER_GAIN = 0.05;
+//with fewer players hit than this in a frame, judging them on other threads costs more than it saves
+const int PARALLEL_HIT_MIN_TARGETS = 8;
+
+//Feeds the beat clock from the audio render thread, every time the main output has a new buffer.
+//Frames are counted from when it was registered; that's only a timeline, where the music sits on it
+//comes from the music's own playback position (see OnMusicPlaybackPercent).
+class FZhengBeatClockListener : public ISubmixBufferListener
+{
+public:
+	FZhengBeatClockListener(ZhengBeatClock* i_beatClock)
+	{
+		beatClock = i_beatClock;
+		framesRendered = 0;
+	}
+
+	virtual void OnNewSubmixBuffer(const USoundSubmix* OwningSubmix, float* AudioData, int32 NumSamples, int32 NumChannels, const int32 SampleRate, double AudioClock) override
+	{
+		if (NumChannels <= 0)
+			return;
+
+		framesRendered += NumSamples / NumChannels;
+		beatClock->PublishAudioPosition(framesRendered, FPlatformTime::Seconds(), SampleRate);
+	}
+
+private:
+	ZhengBeatClock* beatClock;
+	uint64 framesRendered;
+};
+
+void FZhengHitResolveTickFunction::ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent)
+{
+	if (gameMode != nullptr)
+	{
+		gameMode->ResolveHits();
+	}
+}
+
+FString FZhengHitResolveTickFunction::DiagnosticMessage()
+{
+	return TEXT("AZhengGameMode::ResolveHits");
+}
+
+//The order hits on the same frame are resolved in: by target, then the cadenzas after the rest, then by
+//what the attack does, so it comes out the same whichever collision fired first. Hits that differ in
+//nothing the rules read go by who sent them and in what order. Only hits from attacks the projectile
+//system didn't fly, which have no sender, fall back to the order they arrived in.
+static bool HitComesBefore(const FZhengPendingHit& i_a, const FZhengPendingHit& i_b)
+{
+	if (i_a.targetIndex != i_b.targetIndex)
+		return i_a.targetIndex < i_b.targetIndex;
+
+	bool aCadenza = i_a.attackInfo.Cadenza != nullptr;
+	bool bCadenza = i_b.attackInfo.Cadenza != nullptr;
+	if (aCadenza != bCadenza)
+		return bCadenza;
+
+	const AttackInformation& a = i_a.attackInfo;
+	const AttackInformation& b = i_b.attackInfo;
+	if (a.PrimaryAttackType != b.PrimaryAttackType)
+		return a.PrimaryAttackType < b.PrimaryAttackType;
+	if (a.PhysicalCount != b.PhysicalCount)
+		return a.PhysicalCount < b.PhysicalCount;
+	if (a.MagicalCount != b.MagicalCount)
+		return a.MagicalCount < b.MagicalCount;
+	if (a.PushbackCount != b.PushbackCount)
+		return a.PushbackCount < b.PushbackCount;
+	if (a.SpecialCount != b.SpecialCount)
+		return a.SpecialCount < b.SpecialCount;
+	if (a.GeneralScaler != b.GeneralScaler)
+		return a.GeneralScaler < b.GeneralScaler;
+
+	if (i_a.attackerIndex != i_b.attackerIndex)
+		return i_a.attackerIndex < i_b.attackerIndex;
+	if (i_a.launchSequence != i_b.launchSequence)
+		return i_a.launchSequence < i_b.launchSequence;
+
+	return i_a.arrival < i_b.arrival;
+}
+
 AZhengGameMode::AZhengGameMode()
 {
 	// use our custom PlayerController class
 	PlayerControllerClass = AZhengPlayerController::StaticClass();
 
 	NumPlayers = 2;
+	bFreeForAll = false;
 	NumRoundsToWin = 3;
 
 	TimeSinceBattleStarted = 0.0f;
@@ -18,37 +128,586 @@ AZhengGameMode::AZhengGameMode()
 	RoundTime = 99.0f;
 
 	roundCurrentTime = RoundTime;
-
-	midBattle = false;
-	midRound = false;
+	simAccumulator = 0.0f;
+	simTick = 0;
+	frameFirstTick = 0;
+	frameNumTicks = 0;
+	frameLastTickEndTime = 0.0;
+	replayStartTick = 0;
+	bRecordReplays = false;
+
+	BeatsPerMinute = 120.0f;
+	AudioOutputLatency = 0.0f;
+	beatMap.sampleRate = 0;
+	beatOriginTime = 0.0;
+	beatClockListener = nullptr;
+	Music = nullptr;
+	musicComponent = nullptr;
+	bBeatsFollowMusic = false;
+
+	projectileSystem.Initialize(MAX_PROJECTILES_IN_FLIGHT);
+	projectileAttacks.SetNum(MAX_PROJECTILES_IN_FLIGHT);
+	projectileAttackers.SetNum(MAX_PROJECTILES_IN_FLIGHT);
+	projectileLaunchSequences.SetNum(MAX_PROJECTILES_IN_FLIGHT);
+	FMemory::Memzero(launchCounts);
+	sweepAttacker = HIT_UNKNOWN_ATTACKER;
+	sweepLaunchSequence = 0;
+
+	//hits are resolved once everything that could collide this frame has moved
+	hitResolveTick.gameMode = this;
+	hitResolveTick.bCanEverTick = true;
+	hitResolveTick.TickGroup = TG_PostUpdateWork;
+	pendingHits.Reserve(HIT_BUFFER_RESERVE);
+	resolvingHits.Reserve(HIT_BUFFER_RESERVE);
+	nextHitArrival = 0;
+
+	ApplySimTuning();
+	roundSim.Initialize(&simTuning);
 }
 
 void AZhengGameMode::BeginPlay()
 {
 	Super::BeginPlay();
 
+	NumPlayers = FMath::Clamp(NumPlayers, 1, SIM_MAX_FIGHTERS);
 	AssignPlayerStarts();
 
+	hitResolveTick.RegisterTickFunction(GetLevel());
+
+	//the beat comes from the audio device when there is one, otherwise it runs off the host clock
+	FAudioDevice* audioDevice = GetWorld()->GetAudioDevice();
+	if (audioDevice != nullptr)
+	{
+		beatClockListener = new FZhengBeatClockListener(&beatClock);
+		audioDevice->RegisterSubmixBufferListener(beatClockListener);
+	}
+
+	//a beat map made with ZhengBeatMapExtract lets the beats follow the track's own tempo
+	if (!BeatMapFile.IsEmpty())
+	{
+		LoadBeatMap(TCHAR_TO_UTF8(*(FPaths::ProjectContentDir() / BeatMapFile)), beatMap);
+	}
+
+	//the beats come from the music's playback position once it's playing; without music they run from now
+	if (Music != nullptr)
+	{
+		PlayMusic(Music);
+	}
+	else
+	{
+		StartBeatClock();
+	}
+
+	ApplySimTuning();
 	BeginBattle();
+
+	if (bRecordReplays)
+	{
+		StartRecordingReplay(FPaths::ProjectSavedDir() / TEXT("Replays") / FDateTime::Now().ToString() + TEXT(".zrpl"));
+	}
 	BeginRound();
 }
 
+void AZhengGameMode::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (beatClockListener != nullptr)
+	{
+		FAudioDevice* audioDevice = GetWorld()->GetAudioDevice();
+		if (audioDevice != nullptr)
+		{
+			audioDevice->UnregisterSubmixBufferListener(beatClockListener);
+		}
+	}
+
+	if (musicComponent != nullptr)
+	{
+		musicComponent->OnAudioPlaybackPercentNative.RemoveAll(this);
+		musicComponent->Stop();
+	}
+
+	hitResolveTick.UnRegisterTickFunction();
+	pendingHits.Reset();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+//The listener is only freed here, well after the audio thread has stopped calling it
+void AZhengGameMode::BeginDestroy()
+{
+	delete beatClockListener;
+	beatClockListener = nullptr;
+
+	Super::BeginDestroy();
+}
+
 void AZhengGameMode::Tick(float deltaTime)
 {
 	Super::Tick(deltaTime);
 
-	if (midBattle)
+	SyncRoster();
+	if (bFreeForAll)
 	{
-		if (midRound)
+		UpdateTargets();
+	}
+
+	//the characters tick after us, so their facing is ready when they move
+	UpdateKinematics();
+
+	//if beats without music started before the first audio buffer, pin them to the audio now that it's running
+	if (!bBeatsFollowMusic && !beatClock.IsLockedToAudio() && beatClock.HasAudio())
+	{
+		beatClock.StartBeats(BeatsPerMinute, beatOriginTime, AudioOutputLatency, GetBeatMap());
+	}
+
+	//the round clock runs on the same fixed ticks as the characters; they step exactly the ticks we ran
+	simAccumulator += deltaTime;
+	frameFirstTick = simTick;
+	frameNumTicks = 0;
+
+	while (simAccumulator >= SIM_TICK_SECONDS)
+	{
+		simAccumulator -= SIM_TICK_SECONDS;
+		simTick++;
+		frameNumTicks++;
+
+		if (roundSim.Step())
 		{
-			roundCurrentTime -= deltaTime;
-			if (roundCurrentTime <= 0)
+			EndRound();
+		}
+	}
+
+	frameLastTickEndTime = FPlatformTime::Seconds() - simAccumulator;
+
+	roundCurrentTime = roundSim.GetState().roundTicksRemaining * SIM_TICK_SECONDS;
+
+	UpdateProjectiles(deltaTime);
+}
+
+//Starts the roster over whenever players come or go, and tells each player where it is in it
+void AZhengGameMode::SyncRoster()
+{
+	int numPlayers = FMath::Min(ZhengPlayers.Num(), SIM_MAX_FIGHTERS);
+	if (roster.GetNumFighters() == numPlayers)
+		return;
+
+	roster.Reset(numPlayers);
+	for (int i = 0; i < numPlayers; i++)
+	{
+		ZhengPlayers[i]->SetRosterIndex(i);
+		UpdateRoster(i);
+	}
+}
+
+//Called by a player whenever its health, life or rounds won changed
+void AZhengGameMode::UpdateRoster(int i_rosterIndex)
+{
+	if (i_rosterIndex < 0 || i_rosterIndex >= roster.GetNumFighters())
+		return;
+
+	const ZhengFighterState& fighter = ZhengPlayers[i_rosterIndex]->GetFighterSim()->GetState();
+	roster.SetFighter(i_rosterIndex, fighter.alive, fighter.health);
+	roster.SetRoundsWon(i_rosterIndex, fighter.roundsWon);
+}
+
+//Free for all: everyone standing goes after whoever standing is closest
+void AZhengGameMode::UpdateTargets()
+{
+	float x[SIM_MAX_FIGHTERS];
+	float y[SIM_MAX_FIGHTERS];
+	bool standing[SIM_MAX_FIGHTERS];
+	int numPlayers = roster.GetNumFighters();
+
+	for (int i = 0; i < numPlayers; i++)
+	{
+		FVector location = ZhengPlayers[i]->GetActorLocation();
+		x[i] = location.X;
+		y[i] = location.Y;
+		standing[i] = roster.IsAlive(i);
+	}
+
+	targetGrid.Build(x, y, standing, numPlayers, FREE_FOR_ALL_CELL_SIZE);
+
+	for (int i = 0; i < numPlayers; i++)
+	{
+		if (!standing[i])
+			continue;
+
+		//with nobody left to fight, keep the last target; the round is about to end anyway
+		int nearest = targetGrid.FindNearest(i);
+		if (nearest >= 0)
+		{
+			ZhengPlayers[i]->SetTarget(ZhengPlayers[nearest]);
+		}
+	}
+}
+
+//Turns every fighter towards its target and works out the directions they move and dash in, in one pass
+void AZhengGameMode::UpdateKinematics()
+{
+	ZhengKinematicsBatch batch;
+	batch.count = FMath::Min(ZhengPlayers.Num(), SIM_MAX_FIGHTERS);
+
+	for (int i = 0; i < batch.count; i++)
+	{
+		AZhengCharacter* player = ZhengPlayers[i];
+		FVector location = player->GetActorLocation();
+		FVector facing = player->GetActorForwardVector();
+		AActor* target = player->GetTarget();
+		FVector targetLocation = (target != nullptr) ? target->GetActorLocation() : location;
+
+		batch.positionX[i] = location.X;
+		batch.positionY[i] = location.Y;
+		batch.targetX[i] = targetLocation.X;
+		batch.targetY[i] = targetLocation.Y;
+		batch.facingX[i] = facing.X;
+		batch.facingY[i] = facing.Y;
+		batch.lookAt[i] = player->ShouldFaceTarget() ? 1.0f : 0.0f;
+	}
+
+	//the last group of four reads past count, keep it tidy
+	for (int i = batch.count; i < ((batch.count + 3) & ~3); i++)
+	{
+		batch.positionX[i] = batch.positionY[i] = 0.0f;
+		batch.targetX[i] = batch.targetY[i] = 0.0f;
+		batch.facingX[i] = 1.0f;
+		batch.facingY[i] = 0.0f;
+		batch.lookAt[i] = 0.0f;
+	}
+
+	ComputeKinematics(batch);
+
+	for (int i = 0; i < batch.count; i++)
+	{
+		ZhengPlayers[i]->ApplyKinematics(batch.yaw[i], FVector(batch.forwardX[i], batch.forwardY[i], 0.0f),
+			FVector(batch.rightX[i], batch.rightY[i], 0.0f), batch.turned[i] > 0.0f);
+	}
+}
+
+//Takes over moving an attack that was just sent at i_target, from its projectile movement component.
+//Returns false if there's no room, in which case the component keeps moving it.
+bool AZhengGameMode::LaunchProjectile(APlayerAttack* i_attack, AActor* i_target)
+{
+	UProjectileMovementComponent* movement = i_attack->ProjectileMovementComponent;
+	FVector location = i_attack->GetActorLocation();
+
+	ZhengProjectileLaunch launch;
+	launch.x = location.X;
+	launch.y = location.Y;
+	launch.z = location.Z;
+	launch.vx = movement->Velocity.X;
+	launch.vy = movement->Velocity.Y;
+	launch.vz = movement->Velocity.Z;
+	launch.maxSpeed = movement->GetMaxSpeed();
+	launch.homingAcceleration = movement->bIsHomingProjectile ? movement->HomingAccelerationMagnitude : 0.0f;
+	launch.gravityZ = movement->GetGravityZ();
+	launch.lifetime = (i_attack->InitialLifeSpan > 0.0f) ? i_attack->InitialLifeSpan : FLT_MAX;
+
+	int32 target = ZhengPlayers.IndexOfByKey(Cast<AZhengCharacter>(i_target));
+	launch.target = (target == INDEX_NONE) ? PROJECTILE_NO_TARGET : target;
+
+	//the system only deals in raw pointers, so the attack is kept weakly here, by slot, instead
+	uint32 handle = projectileSystem.Add(launch, nullptr);
+	if (handle == PROJECTILE_INVALID_HANDLE)
+		return false;
+
+	//we age it now, so nothing else should
+	movement->Deactivate();
+	//numbered per sender, so hits that tie in ResolveHits have an order that doesn't depend on callbacks
+	uint32 slot = ZhengProjectileSystem::GetSlot(handle);
+	int32 attacker = ZhengPlayers.IndexOfByKey(Cast<AZhengCharacter>(i_attack->GetOwner()));
+	if (attacker == INDEX_NONE || attacker >= SIM_MAX_FIGHTERS)
+	{
+		projectileAttackers[slot] = HIT_UNKNOWN_ATTACKER;
+		projectileLaunchSequences[slot] = 0;
+	}
+	else
+	{
+		projectileAttackers[slot] = attacker;
+		projectileLaunchSequences[slot] = launchCounts[attacker]++;
+	}
+
+	projectileAttacks[slot] = i_attack;
+	projectileHandles.Add(i_attack, handle);
+	return true;
+}
+
+//Stops moving an attack that hit something or is going back to its pool
+void AZhengGameMode::RemoveProjectile(APlayerAttack* i_attack)
+{
+	uint32 handle;
+	if (projectileHandles.RemoveAndCopyValue(i_attack, handle))
+	{
+		projectileAttacks[ZhengProjectileSystem::GetSlot(handle)].Reset();
+		projectileSystem.Remove(handle);
+	}
+}
+
+//Moves every attack in flight in one pass, then puts the actors where the pass says they are
+void AZhengGameMode::UpdateProjectiles(float i_deltaTime)
+{
+	if (projectileSystem.GetNumActive() == 0)
+		return;
+
+	float targetX[SIM_MAX_FIGHTERS];
+	float targetY[SIM_MAX_FIGHTERS];
+	float targetZ[SIM_MAX_FIGHTERS];
+	int numTargets = FMath::Min(ZhengPlayers.Num(), SIM_MAX_FIGHTERS);
+
+	for (int i = 0; i < numTargets; i++)
+	{
+		FVector location = ZhengPlayers[i]->GetActorLocation();
+		targetX[i] = location.X;
+		targetY[i] = location.Y;
+		targetZ[i] = location.Z;
+	}
+
+	projectileSystem.Update(i_deltaTime, targetX, targetY, targetZ, numTargets);
+
+	//backwards, so removing one only moves an entry we've already been through
+	for (int i = static_cast<int>(projectileSystem.GetNumActive()) - 1; i >= 0; i--)
+	{
+		uint32 handle = projectileSystem.GetHandle(i);
+		TWeakObjectPtr<APlayerAttack>& flying = projectileAttacks[ZhengProjectileSystem::GetSlot(handle)];
+		APlayerAttack* attack = flying.Get();
+
+		//destroyed, maybe even collected, since it was launched
+		if (attack == nullptr)
+		{
+			projectileHandles.Remove(flying);
+			flying.Reset();
+			projectileSystem.Remove(handle);
+			continue;
+		}
+
+		if (projectileSystem.IsExpired(i))
+		{
+			RetireProjectile(attack);
+			continue;
+		}
+
+		float position[3];
+		float velocity[3];
+		projectileSystem.GetMotion(i, position, velocity);
+
+		//swept like the movement component did, so the attack's own hit handling still runs and fast
+		//attacks can't skip through a fighter between frames
+		FVector direction(velocity[0], velocity[1], velocity[2]);
+		//any hit the sweep queues is stamped with who sent this attack
+		uint32 slot = ZhengProjectileSystem::GetSlot(handle);
+		sweepAttacker = projectileAttackers[slot];
+		sweepLaunchSequence = projectileLaunchSequences[slot];
+
+		FHitResult hit;
+		attack->SetActorLocationAndRotation(FVector(position[0], position[1], position[2]), direction.Rotation(), true, &hit);
+
+		if (hit.bBlockingHit)
+		{
+			//the sweep told the attack about the hit; the stop is what the movement component would have added
+			if (IsValid(attack))
 			{
-				EndRound();
+				attack->ProjectileMovementComponent->StopSimulating(hit);
+			}
+
+			//unless handling the hit already took it back, it's done flying
+			if (!IsValid(attack))
+			{
+				RemoveProjectile(attack);
+			}
+			else if (projectileHandles.Contains(attack))
+			{
+				RetireProjectile(attack);
 			}
 		}
+
+		sweepAttacker = HIT_UNKNOWN_ATTACKER;
+		sweepLaunchSequence = 0;
+	}
+}
+
+//Stops flying an attack that expired or hit something and gives it back to its owner's pool
+void AZhengGameMode::RetireProjectile(APlayerAttack* i_attack)
+{
+	AZhengCharacter* owner = Cast<AZhengCharacter>(i_attack->GetOwner());
+	if (owner != nullptr)
+	{
+		owner->ReleaseAttack(i_attack);
+	}
+	else
+	{
+		RemoveProjectile(i_attack);
+		i_attack->Destroy();
+	}
+}
+
+//The fixed ticks this frame's Tick ran: i_numTicks of them from o_firstTick, the last ending at
+//o_lastTickEndTime on the FPlatformTime::Seconds clock. The characters tick after us and step exactly these.
+void AZhengGameMode::GetFrameTicks(uint32& o_firstTick, int& o_numTicks, double& o_lastTickEndTime) const
+{
+	o_firstTick = frameFirstTick;
+	o_numTicks = frameNumTicks;
+	o_lastTickEndTime = frameLastTickEndTime;
+}
+
+//Where a shared tick falls in the replay being recorded. False for ticks from before the recording started.
+bool AZhengGameMode::GetReplayTick(uint32 i_tick, uint32& o_replayTick) const
+{
+	if (i_tick < replayStartTick)
+		return false;
+
+	o_replayTick = i_tick - replayStartTick;
+	return true;
+}
+
+//Called by a player an attack just collided with. The hit waits for ResolveHits at the end of the frame.
+void AZhengGameMode::QueueHit(AZhengCharacter* i_target, int i_targetIndex, const AttackInformation& i_attackInfo)
+{
+	FZhengPendingHit& hit = pendingHits.AddDefaulted_GetRef();
+	hit.target = i_target;
+	hit.targetIndex = i_targetIndex;
+	hit.attackInfo = i_attackInfo;
+	hit.attackerIndex = sweepAttacker;
+	hit.launchSequence = sweepLaunchSequence;
+	hit.arrival = nextHitArrival++;
+	hit.blocked = false;
+	FMemory::Memzero(hit.result);
+}
+
+//Applies every hit queued this frame, in HitComesBefore order. The rules are judged first, each target's
+//hits together and big fights spread over worker threads, since a hit only touches the fighter it lands
+//on. What the world sees (cadenza impacts, deaths, orbs, knockback) then happens here on the game thread,
+//each target launched once by the sum of its hits' knockback.
+void AZhengGameMode::ResolveHits()
+{
+	if (pendingHits.Num() == 0)
+		return;
+
+	//hits that land while these resolve (a cadenza's impact, say) wait for next frame's pass
+	Swap(pendingHits, resolvingHits);
+	nextHitArrival = 0;
+
+	resolvingHits.RemoveAll([](const FZhengPendingHit& i_hit) { return !IsValid(i_hit.target); });
+	resolvingHits.Sort(&HitComesBefore);
+
+	TArray<int32, TInlineAllocator<SIM_MAX_FIGHTERS + 1>> groupStart;
+	for (int i = 0; i < resolvingHits.Num(); i++)
+	{
+		if (i == 0 || resolvingHits[i].target != resolvingHits[i - 1].target)
+			groupStart.Add(i);
+	}
+	groupStart.Add(resolvingHits.Num());
+	int numGroups = groupStart.Num() - 1;
+
+	ParallelFor(numGroups, [this, &groupStart](int32 i_group)
+	{
+		for (int i = groupStart[i_group]; i < groupStart[i_group + 1]; i++)
+		{
+			FZhengPendingHit& hit = resolvingHits[i];
+			hit.target->JudgeHit(hit.attackInfo, hit.blocked, hit.result);
+		}
+	}, numGroups < PARALLEL_HIT_MIN_TARGETS);
+
+	for (int group = 0; group < numGroups; group++)
+	{
+		AZhengCharacter* target = resolvingHits[groupStart[group]].target;
+		FVector launchVector = FVector::ZeroVector;
+
+		for (int i = groupStart[group]; i < groupStart[group + 1]; i++)
+		{
+			const FZhengPendingHit& hit = resolvingHits[i];
+			target->ShowHit(hit.attackInfo, hit.blocked, hit.result, launchVector);
+		}
+
+		if (!launchVector.IsZero())
+		{
+			target->LaunchCharacter(launchVector, false, false);
+		}
+	}
+
+	resolvingHits.Reset();
+}
+
+//Copies the editable round properties into what the round rules read
+void AZhengGameMode::ApplySimTuning()
+{
+	simTuning.RoundTime = RoundTime;
+	simTuning.NumRoundsToWin = NumRoundsToWin;
+	simTuning.BeatsPerMinute = BeatsPerMinute;
+}
+
+//Puts the first beat right now, for playing without music. With music, OnMusicPlaybackPercent places the beats.
+void AZhengGameMode::StartBeatClock()
+{
+	bBeatsFollowMusic = false;
+	beatOriginTime = FPlatformTime::Seconds();
+	beatClock.StartBeats(BeatsPerMinute, beatOriginTime, AudioOutputLatency, GetBeatMap());
+}
+
+//Plays i_music from the start and has the beats follow it. The beats stop until it's actually playing.
+void AZhengGameMode::PlayMusic(USoundBase* i_music)
+{
+	if (i_music == nullptr)
+		return;
+
+	if (musicComponent == nullptr)
+	{
+		musicComponent = UGameplayStatics::CreateSound2D(this, i_music, 1.0f, 1.0f, 0.0f, nullptr, false, false);
+		if (musicComponent == nullptr)
+		{
+			StartBeatClock();
+			return;
+		}
+
+		//has to be bound before playing, or the playback position is never reported
+		musicComponent->OnAudioPlaybackPercentNative.AddUObject(this, &AZhengGameMode::OnMusicPlaybackPercent);
+	}
+
+	beatClock.StopBeats();
+	bBeatsFollowMusic = true;
+	beatOriginTime = 0.0;
+
+	musicComponent->SetSound(i_music);
+	musicComponent->Play();
+}
+
+//Where the music is, reported from the audio renderer. The beats' origin is when the track's first frame
+//was rendered: the latest rendered buffer's time minus how far into the track playback is. The position
+//and that buffer can be a buffer apart either way, so after the first reading the origin only eases
+//towards new ones, unless the music clearly jumped.
+void AZhengGameMode::OnMusicPlaybackPercent(const UAudioComponent* i_component, const USoundWave* i_wave, const float i_percent)
+{
+	if (!bBeatsFollowMusic || i_wave == nullptr || i_wave->Duration <= 0.0f)
+		return;
+
+	double renderedTime;
+	if (!beatClock.GetLatestAudioTime(renderedTime))
+	{
+		renderedTime = FPlatformTime::Seconds();
+	}
+
+	double origin = renderedTime - static_cast<double>(i_percent) * i_wave->Duration;
+	bool running = beatOriginTime > 0.0;
+
+	if (running && FMath::Abs(origin - beatOriginTime) < MUSIC_RESYNC_SECONDS)
+	{
+		beatOriginTime += (origin - beatOriginTime) * MUSIC_ORIGIN_FILTER_GAIN;
 	}
+	else
+	{
+		beatOriginTime = origin;
+	}
+
+	beatClock.StartBeats(BeatsPerMinute, beatOriginTime, AudioOutputLatency, GetBeatMap());
+}
+
+//The track's beat map if BeatMapFile loaded, nullptr to keep a constant BeatsPerMinute
+const ZhengBeatMap* AZhengGameMode::GetBeatMap() const
+{
+	return beatMap.beatFrames.empty() ? nullptr : &beatMap;
+}
 
+const ZhengBeatClock& AZhengGameMode::GetBeatClock() const
+{
+	return beatClock;
 }
 
 void AZhengGameMode::AssignPlayerStarts()
@@ -70,52 +729,107 @@ void AZhengGameMode::AssignPlayerStarts()
 
 bool AZhengGameMode::IsMidBattle()
 {
-	return midBattle;
+	return roundSim.GetState().midBattle;
 }
 
 bool AZhengGameMode::IsMidRound()
 {
-	return midRound;
+	return roundSim.GetState().midRound;
 }
 
 void AZhengGameMode::BeginBattle()
 {
+	roundSim.BeginBattle();
 	roundCurrentTime = RoundTime;
-	midBattle = true;
 }
 
 void AZhengGameMode::EndBattle()
 {
-	midBattle = false;
+	roundSim.EndBattle();
+	StopRecordingReplay();
 }
 
-bool AZhengGameMode::CheckForEndOfBattle()
+//Records every player's input from here on so the battle can be played back headless with ZhengReplayPlayer
+bool AZhengGameMode::StartRecordingReplay(const FString& i_path)
 {
+	if (ZhengPlayers.Num() <= 0)
+	{
+		print("No players to record.");
+		return false;
+	}
+
+	IFileManager::Get().MakeDirectory(*FPaths::GetPath(i_path), true);
+
+	//the characters own the combat tuning, the round tuning is ours
+	ZhengTuning replayTuning = ZhengPlayers[0]->GetSimTuning();
+	replayTuning.RoundTime = simTuning.RoundTime;
+	replayTuning.NumRoundsToWin = simTuning.NumRoundsToWin;
+	replayTuning.BeatsPerMinute = simTuning.BeatsPerMinute;
+
+	//nothing in the rules is random yet; anything added later should get its own stream seeded from this,
+	//never the engine's global one
+	uint32 seed = FPlatformTime::Cycles();
+
+	//no keyframes, the characters don't share a ZhengSimulation to snapshot; playback seeks by simulating from the start
+	if (!replayWriter.Open(TCHAR_TO_UTF8(*i_path), replayTuning, ZhengPlayers.Num(), seed, 0, true))
+		return false;
+
+	//every fighter's input is recorded against our tick, counted from the next one we run
+	replayStartTick = simTick;
 	for (int i = 0; i < ZhengPlayers.Num(); i++)
 	{
-		if (ZhengPlayers[i]->GetRoundsWon() >= NumRoundsToWin)
-		{
-			return true;
-		}
+		ZhengPlayers[i]->StartReplayRecording(&replayWriter, i);
 	}
 
-	return false;
+	printf_2("Recording replay to %s", *i_path);
+	return true;
+}
+
+void AZhengGameMode::StopRecordingReplay()
+{
+	if (!replayWriter.IsOpen())
+		return;
+
+	for (int i = 0; i < ZhengPlayers.Num(); i++)
+	{
+		ZhengPlayers[i]->StopReplayRecording();
+	}
+
+	replayWriter.Close();
+}
+
+bool AZhengGameMode::CheckForEndOfBattle()
+{
+	SyncRoster();
+
+	int leader;
+	int roundsWon = roster.GetMostRoundsWon(leader);
+	return roundSim.DeclareBattleWinner(leader, roundsWon);
 }
 
 void AZhengGameMode::BeginRound()
 {
+	roundSim.BeginRound();
 	roundCurrentTime = RoundTime;
-	midRound = true;
 }
 
 void AZhengGameMode::EndRound()
 {
-	midRound = false;
-	GetRoundWinner()->IncrementRoundsWon();
+	if (ZhengPlayers.Num() <= 0)
+	{
+		print("No players to end the round for.");
+		return;
+	}
+
+	SyncRoster();
+	roundSim.FinishRound();
+
+	AZhengCharacter* winner = ZhengPlayers[roster.GetLeader()];
+	winner->IncrementRoundsWon();
 
 	if (CheckForEndOfBattle())
 	{
-		GetRoundWinner()->WinBattle();
+		winner->WinBattle();
 	}
 	else
 	{
@@ -125,89 +839,65 @@ void AZhengGameMode::EndRound()
 
 }
 
+//A round is also over once at most one player is left standing
 bool AZhengGameMode::CheckForEndOfRound()
 {
-	if (GetNumberOfRemainingPlayers() <= 1)
-	{
-		return true;
-	}
+	SyncRoster();
 
-	return false;
+	return IsMidRound() && roster.GetNumAlive() <= 1;
 }
 
 void AZhengGameMode::ResetPlayers()
 {
+	//anything still in flight from the last round shouldn't land on the next one
+	pendingHits.Reset();
+	FMemory::Memzero(launchCounts);
+
 	for (int i = 0; i < ZhengPlayers.Num(); i++)
 	{
-		if (playerStarts.Num() >= i)
-		{
-			ZhengPlayers[i]->SetActorLocation(playerStarts[i]->GetActorLocation());
-		}
-		else
-		{
-			ZhengPlayers[i]->SetActorLocation(FVector(0, 0, 0));
-		}
+		ZhengPlayers[i]->SetActorLocation(GetSpawnLocation(i));
 		ZhengPlayers[i]->ResetForRound();
 	}
 }
 
 void AZhengGameMode::ResetPlayersForBattle()
 {
-	midBattle = true;
+	roundSim.BeginBattle();
 	for (int i = 0; i < ZhengPlayers.Num(); i++)
 	{
-		if (playerStarts.Num() >= i)
-		{
-			ZhengPlayers[i]->SetActorLocation(playerStarts[i]->GetActorLocation());
-		}
-		else
-		{
-			ZhengPlayers[i]->SetActorLocation(FVector(0, 0, 0));
-		}
+		ZhengPlayers[i]->SetActorLocation(GetSpawnLocation(i));
 		ZhengPlayers[i]->ResetForBattle();
 	}
 }
 
-int AZhengGameMode::GetNumberOfRemainingPlayers()
+//Where player i_player starts a round: its own player start if there are enough, else around the middle
+FVector AZhengGameMode::GetSpawnLocation(int i_player) const
 {
-	int remainingPlayers = 0;
-
-	for (int i = 0; i < ZhengPlayers.Num(); i++)
+	if (i_player < playerStarts.Num())
 	{
-		if (ZhengPlayers[i]->IsAlive())
-			remainingPlayers++;
+		return playerStarts[i_player]->GetActorLocation();
 	}
 
-	return remainingPlayers;
+	float angle = 2.0f * PI * i_player / FMath::Max(ZhengPlayers.Num(), 1);
+	return FVector(FMath::Cos(angle) * EXTRA_SPAWN_RADIUS, FMath::Sin(angle) * EXTRA_SPAWN_RADIUS, 0.0f);
 }
 
-AZhengCharacter* AZhengGameMode::GetRoundWinner()
+int AZhengGameMode::GetNumberOfRemainingPlayers()
 {
-	AZhengCharacter* highestHealthCharacter = nullptr;
+	SyncRoster();
 
-	for (int i = 0; i < ZhengPlayers.Num(); i++)
-	{
-		if (ZhengPlayers[i]->IsAlive())
-		{
-			if (highestHealthCharacter == nullptr)
-			{
-				highestHealthCharacter = ZhengPlayers[i];
-			}
-			else
-			{
-				if (ZhengPlayers[i]->GetHealth() > highestHealthCharacter->GetHealth())
-				{
-					highestHealthCharacter = ZhengPlayers[i];
-				}
-			}
-		}
-	}
+	return roster.GetNumAlive();
+}
 
-	if (highestHealthCharacter != nullptr)
+AZhengCharacter* AZhengGameMode::GetRoundWinner()
+{
+	if (ZhengPlayers.Num() <= 0)
 	{
-		return highestHealthCharacter;
+		print("No players to pick a round winner from.");
+		return nullptr;
 	}
 
-	print("Did not find any alive characters. Returning the 1st player.");
-	return ZhengPlayers[0];
-}
\ No newline at end of file
+	SyncRoster();
+
+	return ZhengPlayers[roster.GetLeader()];
+}
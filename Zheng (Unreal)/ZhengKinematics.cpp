@@ -0,0 +1,102 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "ZhengKinematics.h"
+
+#include <math.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define ZHENG_KINEMATICS_SSE 1
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// Fighter kinematics
+//
+// Works out every fighter's facing in one pass: the yaw that looks at its target and the forward and
+// right vectors that movement and dashes are relative to. Fighters that aren't turning towards a target
+// (none set, or in the air) keep the facing they came in with. All on the ground plane, like the
+// yaw-only rotations the characters use, so right is just forward turned a quarter.
+
+const float KINEMATICS_RADIANS_TO_DEGREES = 57.2957795f;
+//targets closer than this give no direction to look in
+const float KINEMATICS_MIN_DISTANCE = 0.001f;
+
+#if defined(ZHENG_KINEMATICS_SSE)
+//atan2 of four vectors at once, in degrees, to within about a hundredth of a degree
+static __m128 Atan2Degrees(__m128 i_y, __m128 i_x)
+{
+	const __m128 signBit = _mm_set1_ps(-0.0f);
+	const __m128 halfPi = _mm_set1_ps(1.57079633f);
+	const __m128 pi = _mm_set1_ps(3.14159265f);
+
+	__m128 absX = _mm_andnot_ps(signBit, i_x);
+	__m128 absY = _mm_andnot_ps(signBit, i_y);
+
+	//fold into the first octant, where the polynomial holds
+	__m128 steep = _mm_cmpgt_ps(absY, absX);
+	__m128 ratio = _mm_div_ps(_mm_min_ps(absX, absY), _mm_max_ps(_mm_max_ps(absX, absY), _mm_set1_ps(1e-30f)));
+	__m128 squared = _mm_mul_ps(ratio, ratio);
+
+	__m128 angle = _mm_mul_ps(_mm_set1_ps(-0.0464964749f), squared);
+	angle = _mm_mul_ps(_mm_add_ps(angle, _mm_set1_ps(0.15931422f)), squared);
+	angle = _mm_mul_ps(_mm_sub_ps(angle, _mm_set1_ps(0.327622764f)), squared);
+	angle = _mm_add_ps(_mm_mul_ps(angle, ratio), ratio);
+
+	//and back out to the right octant and quadrant
+	angle = _mm_or_ps(_mm_and_ps(steep, _mm_sub_ps(halfPi, angle)), _mm_andnot_ps(steep, angle));
+	__m128 behind = _mm_cmplt_ps(i_x, _mm_setzero_ps());
+	angle = _mm_or_ps(_mm_and_ps(behind, _mm_sub_ps(pi, angle)), _mm_andnot_ps(behind, angle));
+	angle = _mm_xor_ps(angle, _mm_and_ps(i_y, signBit));
+
+	return _mm_mul_ps(angle, _mm_set1_ps(KINEMATICS_RADIANS_TO_DEGREES));
+}
+#endif
+
+//Fills in yaw, forward and right for the first io_batch.count fighters
+void ComputeKinematics(ZhengKinematicsBatch& io_batch)
+{
+	int i = 0;
+
+#if defined(ZHENG_KINEMATICS_SSE)
+	const __m128 minDistance = _mm_set1_ps(KINEMATICS_MIN_DISTANCE);
+	const __m128 zero = _mm_setzero_ps();
+
+	//the arrays hold SIM_MAX_FIGHTERS, a whole number of groups, so the last group can run over count
+	for (; i < io_batch.count; i += 4)
+	{
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(io_batch.targetX + i), _mm_loadu_ps(io_batch.positionX + i));
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(io_batch.targetY + i), _mm_loadu_ps(io_batch.positionY + i));
+		__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+		__m128 inverse = _mm_div_ps(_mm_set1_ps(1.0f), _mm_max_ps(distance, minDistance));
+
+		__m128 turns = _mm_and_ps(_mm_cmpgt_ps(_mm_loadu_ps(io_batch.lookAt + i), zero), _mm_cmpgt_ps(distance, minDistance));
+		__m128 forwardX = _mm_or_ps(_mm_and_ps(turns, _mm_mul_ps(dx, inverse)), _mm_andnot_ps(turns, _mm_loadu_ps(io_batch.facingX + i)));
+		__m128 forwardY = _mm_or_ps(_mm_and_ps(turns, _mm_mul_ps(dy, inverse)), _mm_andnot_ps(turns, _mm_loadu_ps(io_batch.facingY + i)));
+
+		_mm_storeu_ps(io_batch.forwardX + i, forwardX);
+		_mm_storeu_ps(io_batch.forwardY + i, forwardY);
+		_mm_storeu_ps(io_batch.rightX + i, _mm_sub_ps(zero, forwardY));
+		_mm_storeu_ps(io_batch.rightY + i, forwardX);
+		_mm_storeu_ps(io_batch.yaw + i, Atan2Degrees(forwardY, forwardX));
+		_mm_storeu_ps(io_batch.turned + i, _mm_and_ps(turns, _mm_set1_ps(1.0f)));
+	}
+#else
+	for (; i < io_batch.count; i++)
+	{
+		float dx = io_batch.targetX[i] - io_batch.positionX[i];
+		float dy = io_batch.targetY[i] - io_batch.positionY[i];
+		float distance = sqrtf(dx * dx + dy * dy);
+		bool turns = io_batch.lookAt[i] > 0.0f && distance > KINEMATICS_MIN_DISTANCE;
+
+		float forwardX = turns ? dx / distance : io_batch.facingX[i];
+		float forwardY = turns ? dy / distance : io_batch.facingY[i];
+
+		io_batch.forwardX[i] = forwardX;
+		io_batch.forwardY[i] = forwardY;
+		io_batch.rightX[i] = -forwardY;
+		io_batch.rightY[i] = forwardX;
+		io_batch.yaw[i] = atan2f(forwardY, forwardX) * KINEMATICS_RADIANS_TO_DEGREES;
+		io_batch.turned[i] = turns ? 1.0f : 0.0f;
+	}
+#endif
+}
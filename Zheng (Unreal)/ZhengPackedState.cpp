@@ -0,0 +1,224 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "ZhengPackedState.h"
+
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+// Packed fighter state
+//
+// ZhengFighterState laid out as ZHENG_PACKED_FIGHTER_BYTES of tightly packed bits, for snapshots,
+// replays and network sync. Timers are kept as the low PACKED_TICK_BITS of their absolute deadline,
+// so a fighter whose timers aren't changing packs to the same bytes every tick and deltas stay small.
+//
+// Packing keeps everything the rules can observe. What it drops: launchedAttack (only read in the tick
+// the attack launches), deadlines more than PACKED_TICK_WINDOW ticks away from the current tick (only
+// possible for timers nothing will check again), and presses too old to ever make a double press.
+
+const int PACKED_TICK_BITS = 12;
+const uint32_t PACKED_TICK_MASK = (1 << PACKED_TICK_BITS) - 1;
+const uint32_t PACKED_TICK_WINDOW = 1 << (PACKED_TICK_BITS - 1);
+
+//the furthest deadline is the dash's ending, which can follow a full-length dash
+static_assert(2 * SIM_MAX_TIMER_TICKS < PACKED_TICK_WINDOW, "fighter timers must end inside the packed tick window");
+
+static void WriteBits(uint8_t* io_bytes, size_t& io_bitPosition, uint32_t i_value, int i_numBits)
+{
+	for (int i = 0; i < i_numBits; i++, io_bitPosition++)
+	{
+		if (i_value & (1u << i))
+			io_bytes[io_bitPosition >> 3] |= static_cast<uint8_t>(1 << (io_bitPosition & 7));
+	}
+}
+
+static uint32_t ReadBits(const uint8_t* i_bytes, size_t& io_bitPosition, int i_numBits)
+{
+	uint32_t value = 0;
+
+	for (int i = 0; i < i_numBits; i++, io_bitPosition++)
+	{
+		if (i_bytes[io_bitPosition >> 3] & (1 << (io_bitPosition & 7)))
+			value |= 1u << i;
+	}
+
+	return value;
+}
+
+//Turns a packed deadline back into an absolute tick, picking the one within PACKED_TICK_WINDOW of i_tick
+static uint32_t UnpackDeadline(uint32_t i_packed, uint32_t i_tick)
+{
+	uint32_t offset = (i_packed - i_tick) & PACKED_TICK_MASK;
+
+	if (offset >= PACKED_TICK_WINDOW)
+		return i_tick + offset - (1 << PACKED_TICK_BITS);
+
+	return i_tick + offset;
+}
+
+//Packs a fighter as of i_tick, the next tick it will simulate
+void PackFighterState(const ZhengFighterState& i_state, uint32_t i_tick, ZhengPackedFighterState& o_packed)
+{
+	memset(&o_packed, 0, sizeof(o_packed));
+	size_t bit = 0;
+
+	WriteBits(o_packed.bytes, bit, static_cast<uint16_t>(i_state.health), 16);
+	WriteBits(o_packed.bytes, bit, i_state.roundsWon, 8);
+	WriteBits(o_packed.bytes, bit, i_state.fireOrbs, 4);
+
+	WriteBits(o_packed.bytes, bit, i_state.alive, 1);
+	WriteBits(o_packed.bytes, bit, i_state.dashing, 1);
+	WriteBits(o_packed.bytes, bit, i_state.dashEnding, 1);
+	WriteBits(o_packed.bytes, bit, i_state.dashOnCooldown, 1);
+	WriteBits(o_packed.bytes, bit, i_state.attackEnding, 1);
+	WriteBits(o_packed.bytes, bit, i_state.strumming, 1);
+	WriteBits(o_packed.bytes, bit, i_state.beatConsumed, 1);
+	WriteBits(o_packed.bytes, bit, i_state.beatPassed, 1);
+	WriteBits(o_packed.bytes, bit, i_state.strumOnFreeBeat, 1);
+	WriteBits(o_packed.bytes, bit, i_state.blocking, 1);
+
+	WriteBits(o_packed.bytes, bit, i_state.dashDirection, 2);
+	WriteBits(o_packed.bytes, bit, i_state.heldButtons, 8);
+	WriteBits(o_packed.bytes, bit, i_state.comboState, 8);
+	WriteBits(o_packed.bytes, bit, i_state.lastAddedComponent, 2);
+
+	WriteBits(o_packed.bytes, bit, i_state.numAttackComponents, 4);
+	for (int i = 0; i < SIM_MAX_ATTACK_COMPONENTS; i++)
+		WriteBits(o_packed.bytes, bit, i_state.attackComponents[i], 2);
+
+	WriteBits(o_packed.bytes, bit, i_state.dashEndTick & PACKED_TICK_MASK, PACKED_TICK_BITS);
+	WriteBits(o_packed.bytes, bit, i_state.dashEndingEndTick & PACKED_TICK_MASK, PACKED_TICK_BITS);
+	WriteBits(o_packed.bytes, bit, i_state.dashCooldownEndTick & PACKED_TICK_MASK, PACKED_TICK_BITS);
+	WriteBits(o_packed.bytes, bit, i_state.attackEndingEndTick & PACKED_TICK_MASK, PACKED_TICK_BITS);
+	WriteBits(o_packed.bytes, bit, i_state.strumEndTick & PACKED_TICK_MASK, PACKED_TICK_BITS);
+	WriteBits(o_packed.bytes, bit, i_state.blockEndTick & PACKED_TICK_MASK, PACKED_TICK_BITS);
+
+	//a press from before the window can never count towards a double press, so it's as good as none
+	for (int i = 0; i < SIM_NUM_DIRECTIONS; i++)
+	{
+		bool recent = i_state.lastPressTick[i] != SIM_NEVER && i_tick - i_state.lastPressTick[i] < PACKED_TICK_WINDOW;
+		WriteBits(o_packed.bytes, bit, recent, 1);
+		WriteBits(o_packed.bytes, bit, recent ? (i_state.lastPressTick[i] & PACKED_TICK_MASK) : 0, PACKED_TICK_BITS);
+		WriteBits(o_packed.bytes, bit, recent ? i_state.lastPressSubtick[i] : 0, 8);
+	}
+}
+
+//Unpacks a fighter packed as of i_tick. Returns false if the bytes don't describe a fighter the rules could be in,
+//which only happens when they came from a corrupt or foreign file.
+bool UnpackFighterState(const ZhengPackedFighterState& i_packed, uint32_t i_tick, ZhengFighterState& o_state)
+{
+	memset(&o_state, 0, sizeof(o_state));
+	size_t bit = 0;
+
+	o_state.health = static_cast<int16_t>(ReadBits(i_packed.bytes, bit, 16));
+	o_state.roundsWon = static_cast<uint8_t>(ReadBits(i_packed.bytes, bit, 8));
+	o_state.fireOrbs = static_cast<uint8_t>(ReadBits(i_packed.bytes, bit, 4));
+
+	o_state.alive = ReadBits(i_packed.bytes, bit, 1) != 0;
+	o_state.dashing = ReadBits(i_packed.bytes, bit, 1) != 0;
+	o_state.dashEnding = ReadBits(i_packed.bytes, bit, 1) != 0;
+	o_state.dashOnCooldown = ReadBits(i_packed.bytes, bit, 1) != 0;
+	o_state.attackEnding = ReadBits(i_packed.bytes, bit, 1) != 0;
+	o_state.strumming = ReadBits(i_packed.bytes, bit, 1) != 0;
+	o_state.beatConsumed = ReadBits(i_packed.bytes, bit, 1) != 0;
+	o_state.beatPassed = ReadBits(i_packed.bytes, bit, 1) != 0;
+	o_state.strumOnFreeBeat = ReadBits(i_packed.bytes, bit, 1) != 0;
+	o_state.blocking = ReadBits(i_packed.bytes, bit, 1) != 0;
+
+	o_state.dashDirection = static_cast<uint8_t>(ReadBits(i_packed.bytes, bit, 2));
+	o_state.heldButtons = static_cast<uint8_t>(ReadBits(i_packed.bytes, bit, 8));
+	o_state.comboState = static_cast<uint8_t>(ReadBits(i_packed.bytes, bit, 8));
+	o_state.lastAddedComponent = static_cast<uint8_t>(ReadBits(i_packed.bytes, bit, 2));
+
+	o_state.numAttackComponents = static_cast<uint8_t>(ReadBits(i_packed.bytes, bit, 4));
+	if (o_state.numAttackComponents > SIM_MAX_ATTACK_COMPONENTS)
+		return false;
+
+	for (int i = 0; i < SIM_MAX_ATTACK_COMPONENTS; i++)
+		o_state.attackComponents[i] = static_cast<uint8_t>(ReadBits(i_packed.bytes, bit, 2));
+
+	o_state.dashEndTick = UnpackDeadline(ReadBits(i_packed.bytes, bit, PACKED_TICK_BITS), i_tick);
+	o_state.dashEndingEndTick = UnpackDeadline(ReadBits(i_packed.bytes, bit, PACKED_TICK_BITS), i_tick);
+	o_state.dashCooldownEndTick = UnpackDeadline(ReadBits(i_packed.bytes, bit, PACKED_TICK_BITS), i_tick);
+	o_state.attackEndingEndTick = UnpackDeadline(ReadBits(i_packed.bytes, bit, PACKED_TICK_BITS), i_tick);
+	o_state.strumEndTick = UnpackDeadline(ReadBits(i_packed.bytes, bit, PACKED_TICK_BITS), i_tick);
+	o_state.blockEndTick = UnpackDeadline(ReadBits(i_packed.bytes, bit, PACKED_TICK_BITS), i_tick);
+
+	for (int i = 0; i < SIM_NUM_DIRECTIONS; i++)
+	{
+		bool recent = ReadBits(i_packed.bytes, bit, 1) != 0;
+		uint32_t pressTick = ReadBits(i_packed.bytes, bit, PACKED_TICK_BITS);
+		o_state.lastPressTick[i] = recent ? UnpackDeadline(pressTick, i_tick) : SIM_NEVER;
+		o_state.lastPressSubtick[i] = static_cast<uint8_t>(ReadBits(i_packed.bytes, bit, 8));
+	}
+
+	return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Delta encoding
+//
+// Every group of 8 bytes becomes a mask byte saying which of them changed, followed by just the
+// changed bytes. Unchanged state costs one byte per 8, and works for any blob, from one packed
+// fighter to a whole snapshot.
+
+//Most bytes EncodeDelta can write for a blob of i_size bytes
+size_t GetMaxDeltaSize(size_t i_size)
+{
+	return i_size + (i_size + 7) / 8;
+}
+
+//Writes the difference between two blobs of i_size bytes to o_delta, which needs GetMaxDeltaSize(i_size) bytes.
+//Returns the bytes written.
+size_t EncodeDelta(const uint8_t* i_base, const uint8_t* i_current, size_t i_size, uint8_t* o_delta)
+{
+	uint8_t* out = o_delta;
+
+	for (size_t group = 0; group < i_size; group += 8)
+	{
+		uint8_t* mask = out++;
+		*mask = 0;
+
+		for (size_t i = group; i < group + 8 && i < i_size; i++)
+		{
+			if (i_base[i] != i_current[i])
+			{
+				*mask |= static_cast<uint8_t>(1 << (i - group));
+				*out++ = i_current[i];
+			}
+		}
+	}
+
+	return out - o_delta;
+}
+
+//Rebuilds the current blob from the base it was encoded against. Returns false if the delta is cut short.
+bool DecodeDelta(const uint8_t* i_base, const uint8_t* i_delta, size_t i_deltaSize, size_t i_size, uint8_t* o_current)
+{
+	const uint8_t* in = i_delta;
+	const uint8_t* end = i_delta + i_deltaSize;
+
+	if (o_current != i_base)
+		memcpy(o_current, i_base, i_size);
+
+	for (size_t group = 0; group < i_size; group += 8)
+	{
+		if (in >= end)
+			return false;
+
+		uint8_t mask = *in++;
+
+		for (size_t i = group; i < group + 8 && i < i_size; i++)
+		{
+			if (mask & (1 << (i - group)))
+			{
+				if (in >= end)
+					return false;
+
+				o_current[i] = *in++;
+			}
+		}
+	}
+
+	return true;
+}
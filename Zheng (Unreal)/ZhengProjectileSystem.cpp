@@ -0,0 +1,288 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "ZhengProjectileSystem.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define ZHENG_PROJECTILES_SSE 1
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// ZhengProjectileSystem
+//
+// Moves every homing attack in flight in one pass, instead of one projectile movement component tick per
+// actor. Projectiles are kept as parallel arrays (position, velocity, speed limit, homing, lifetime,
+// target), packed so the first GetNumActive() entries are the live ones, and stepped four at a time in
+// SSE registers. The steering matches the projectile movement component's: accelerate straight at the
+// target, then clamp to the max speed. Whoever owns the visuals reads the results back and moves the
+// actors in one go. Handles stay valid while entries get moved around by removals.
+
+const uint32_t PROJECTILE_INDEX_BITS = 16;
+const uint32_t PROJECTILE_INDEX_MASK = (1 << PROJECTILE_INDEX_BITS) - 1;
+//closer than this to the target, steering has no direction to push in
+const float PROJECTILE_MIN_STEER_DISTANCE = 0.001f;
+
+ZhengProjectileSystem::ZhengProjectileSystem()
+{
+	numActive = 0;
+}
+
+//Makes room for i_capacity projectiles in flight at once
+void ZhengProjectileSystem::Initialize(uint32_t i_capacity)
+{
+	if (i_capacity > PROJECTILE_INDEX_MASK)
+	{
+		printf("Projectile capacity too large, clamping.\n");
+		i_capacity = PROJECTILE_INDEX_MASK;
+	}
+
+	//padded to whole SSE lanes, so the last group never reads past the end
+	size_t padded = (i_capacity + 3) & ~static_cast<size_t>(3);
+
+	positionX.assign(padded, 0.0f);
+	positionY.assign(padded, 0.0f);
+	positionZ.assign(padded, 0.0f);
+	velocityX.assign(padded, 0.0f);
+	velocityY.assign(padded, 0.0f);
+	velocityZ.assign(padded, 0.0f);
+	maxSpeed.assign(padded, 0.0f);
+	homingAcceleration.assign(padded, 0.0f);
+	gravityZ.assign(padded, 0.0f);
+	lifetime.assign(padded, 0.0f);
+	targetX.assign(padded, 0.0f);
+	targetY.assign(padded, 0.0f);
+	targetZ.assign(padded, 0.0f);
+	target.assign(i_capacity, PROJECTILE_NO_TARGET);
+	users.assign(i_capacity, nullptr);
+	handles.assign(i_capacity, PROJECTILE_INVALID_HANDLE);
+
+	slotIndex.assign(i_capacity, 0);
+	slotGeneration.assign(i_capacity, 0);
+	freeSlots.resize(i_capacity);
+	for (uint32_t i = 0; i < i_capacity; i++)
+		freeSlots[i] = i_capacity - 1 - i;
+
+	numActive = 0;
+}
+
+//Starts moving a projectile. i_user is handed back with it, for finding the actor it moves.
+//Returns PROJECTILE_INVALID_HANDLE if every slot is taken.
+uint32_t ZhengProjectileSystem::Add(const ZhengProjectileLaunch& i_launch, void* i_user)
+{
+	if (freeSlots.empty())
+	{
+		printf("Projectile system is full.\n");
+		return PROJECTILE_INVALID_HANDLE;
+	}
+
+	uint32_t slot = freeSlots.back();
+	freeSlots.pop_back();
+
+	uint32_t index = numActive++;
+	positionX[index] = i_launch.x;
+	positionY[index] = i_launch.y;
+	positionZ[index] = i_launch.z;
+	velocityX[index] = i_launch.vx;
+	velocityY[index] = i_launch.vy;
+	velocityZ[index] = i_launch.vz;
+	maxSpeed[index] = i_launch.maxSpeed;
+	homingAcceleration[index] = i_launch.homingAcceleration;
+	gravityZ[index] = i_launch.gravityZ;
+	lifetime[index] = i_launch.lifetime;
+	target[index] = i_launch.target;
+	users[index] = i_user;
+
+	uint32_t handle = (static_cast<uint32_t>(slotGeneration[slot]) << PROJECTILE_INDEX_BITS) | slot;
+	handles[index] = handle;
+	slotIndex[slot] = index;
+	return handle;
+}
+
+//Stops moving a projectile. The last one moves into its place. Stale handles are ignored.
+void ZhengProjectileSystem::Remove(uint32_t i_handle)
+{
+	if (i_handle == PROJECTILE_INVALID_HANDLE)
+		return;
+
+	uint32_t slot = i_handle & PROJECTILE_INDEX_MASK;
+	if (slot >= slotIndex.size() || slotGeneration[slot] != static_cast<uint16_t>(i_handle >> PROJECTILE_INDEX_BITS))
+		return;
+
+	uint32_t index = slotIndex[slot];
+	uint32_t last = --numActive;
+
+	if (index != last)
+	{
+		positionX[index] = positionX[last];
+		positionY[index] = positionY[last];
+		positionZ[index] = positionZ[last];
+		velocityX[index] = velocityX[last];
+		velocityY[index] = velocityY[last];
+		velocityZ[index] = velocityZ[last];
+		maxSpeed[index] = maxSpeed[last];
+		homingAcceleration[index] = homingAcceleration[last];
+		gravityZ[index] = gravityZ[last];
+		lifetime[index] = lifetime[last];
+		target[index] = target[last];
+		users[index] = users[last];
+		handles[index] = handles[last];
+		slotIndex[handles[index] & PROJECTILE_INDEX_MASK] = index;
+	}
+
+	//the vacated lane still gets stepped with its group, keep it still
+	velocityX[last] = 0.0f;
+	velocityY[last] = 0.0f;
+	velocityZ[last] = 0.0f;
+	homingAcceleration[last] = 0.0f;
+	gravityZ[last] = 0.0f;
+	handles[last] = PROJECTILE_INVALID_HANDLE;
+	users[last] = nullptr;
+	slotGeneration[slot]++;
+	freeSlots.push_back(slot);
+}
+
+//Drops every projectile, e.g. between rounds. Old handles become stale.
+void ZhengProjectileSystem::Clear()
+{
+	while (numActive > 0)
+		Remove(handles[numActive - 1]);
+}
+
+//Steers, moves and ages every projectile by i_deltaTime. Targets are looked up in i_targetX/Y/Z by the
+//index each projectile was launched at; PROJECTILE_NO_TARGET (or one past i_numTargets) flies straight.
+void ZhengProjectileSystem::Update(float i_deltaTime, const float* i_targetX, const float* i_targetY, const float* i_targetZ, int i_numTargets)
+{
+	//gather each projectile's target next to it; no target means aiming at itself, which doesn't steer
+	for (uint32_t i = 0; i < numActive; i++)
+	{
+		int32_t aim = target[i];
+		bool hasTarget = aim >= 0 && aim < i_numTargets;
+
+		targetX[i] = hasTarget ? i_targetX[aim] : positionX[i];
+		targetY[i] = hasTarget ? i_targetY[aim] : positionY[i];
+		targetZ[i] = hasTarget ? i_targetZ[aim] : positionZ[i];
+	}
+
+	uint32_t i = 0;
+
+#if defined(ZHENG_PROJECTILES_SSE)
+	const __m128 deltaTime = _mm_set1_ps(i_deltaTime);
+	const __m128 minDistance = _mm_set1_ps(PROJECTILE_MIN_STEER_DISTANCE);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	for (; i < numActive; i += 4)
+	{
+		__m128 px = _mm_loadu_ps(&positionX[i]);
+		__m128 py = _mm_loadu_ps(&positionY[i]);
+		__m128 pz = _mm_loadu_ps(&positionZ[i]);
+		__m128 vx = _mm_loadu_ps(&velocityX[i]);
+		__m128 vy = _mm_loadu_ps(&velocityY[i]);
+		__m128 vz = _mm_loadu_ps(&velocityZ[i]);
+
+		//homing: accelerate along the unit vector to the target
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(&targetX[i]), px);
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(&targetY[i]), py);
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(&targetZ[i]), pz);
+		__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+		__m128 steers = _mm_cmpgt_ps(distance, minDistance);
+		__m128 scale = _mm_div_ps(_mm_mul_ps(_mm_loadu_ps(&homingAcceleration[i]), deltaTime), _mm_max_ps(distance, minDistance));
+		scale = _mm_and_ps(scale, steers);
+
+		vx = _mm_add_ps(vx, _mm_mul_ps(dx, scale));
+		vy = _mm_add_ps(vy, _mm_mul_ps(dy, scale));
+		vz = _mm_add_ps(vz, _mm_add_ps(_mm_mul_ps(dz, scale), _mm_mul_ps(_mm_loadu_ps(&gravityZ[i]), deltaTime)));
+
+		//clamp to the max speed, where there is one
+		__m128 limit = _mm_loadu_ps(&maxSpeed[i]);
+		__m128 speed = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz)));
+		__m128 tooFast = _mm_and_ps(_mm_cmpgt_ps(limit, zero), _mm_cmpgt_ps(speed, limit));
+		__m128 clamp = _mm_div_ps(limit, _mm_max_ps(speed, minDistance));
+		clamp = _mm_or_ps(_mm_and_ps(tooFast, clamp), _mm_andnot_ps(tooFast, one));
+
+		vx = _mm_mul_ps(vx, clamp);
+		vy = _mm_mul_ps(vy, clamp);
+		vz = _mm_mul_ps(vz, clamp);
+
+		_mm_storeu_ps(&velocityX[i], vx);
+		_mm_storeu_ps(&velocityY[i], vy);
+		_mm_storeu_ps(&velocityZ[i], vz);
+		_mm_storeu_ps(&positionX[i], _mm_add_ps(px, _mm_mul_ps(vx, deltaTime)));
+		_mm_storeu_ps(&positionY[i], _mm_add_ps(py, _mm_mul_ps(vy, deltaTime)));
+		_mm_storeu_ps(&positionZ[i], _mm_add_ps(pz, _mm_mul_ps(vz, deltaTime)));
+		_mm_storeu_ps(&lifetime[i], _mm_sub_ps(_mm_loadu_ps(&lifetime[i]), deltaTime));
+	}
+#else
+	for (; i < numActive; i++)
+	{
+		float dx = targetX[i] - positionX[i];
+		float dy = targetY[i] - positionY[i];
+		float dz = targetZ[i] - positionZ[i];
+		float distance = sqrtf(dx * dx + dy * dy + dz * dz);
+
+		if (distance > PROJECTILE_MIN_STEER_DISTANCE)
+		{
+			float scale = homingAcceleration[i] * i_deltaTime / distance;
+			velocityX[i] += dx * scale;
+			velocityY[i] += dy * scale;
+			velocityZ[i] += dz * scale;
+		}
+		velocityZ[i] += gravityZ[i] * i_deltaTime;
+
+		float speed = sqrtf(velocityX[i] * velocityX[i] + velocityY[i] * velocityY[i] + velocityZ[i] * velocityZ[i]);
+		if (maxSpeed[i] > 0.0f && speed > maxSpeed[i])
+		{
+			float clamp = maxSpeed[i] / speed;
+			velocityX[i] *= clamp;
+			velocityY[i] *= clamp;
+			velocityZ[i] *= clamp;
+		}
+
+		positionX[i] += velocityX[i] * i_deltaTime;
+		positionY[i] += velocityY[i] * i_deltaTime;
+		positionZ[i] += velocityZ[i] * i_deltaTime;
+		lifetime[i] -= i_deltaTime;
+	}
+#endif
+}
+
+uint32_t ZhengProjectileSystem::GetNumActive() const
+{
+	return numActive;
+}
+
+//The projectile at i_index this frame; indices shift whenever one is removed
+void* ZhengProjectileSystem::GetUser(uint32_t i_index) const
+{
+	return users[i_index];
+}
+
+uint32_t ZhengProjectileSystem::GetHandle(uint32_t i_index) const
+{
+	return handles[i_index];
+}
+
+//The slot behind a handle. Slots don't move when entries do, so callers can keep their own
+//per-projectile data in an array indexed by it.
+uint32_t ZhengProjectileSystem::GetSlot(uint32_t i_handle)
+{
+	return i_handle & PROJECTILE_INDEX_MASK;
+}
+
+void ZhengProjectileSystem::GetMotion(uint32_t i_index, float o_position[3], float o_velocity[3]) const
+{
+	o_position[0] = positionX[i_index];
+	o_position[1] = positionY[i_index];
+	o_position[2] = positionZ[i_index];
+	o_velocity[0] = velocityX[i_index];
+	o_velocity[1] = velocityY[i_index];
+	o_velocity[2] = velocityZ[i_index];
+}
+
+bool ZhengProjectileSystem::IsExpired(uint32_t i_index) const
+{
+	return lifetime[i_index] <= 0.0f;
+}
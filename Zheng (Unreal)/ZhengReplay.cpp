@@ -0,0 +1,692 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "ZhengReplay.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#pragma warning( disable : 4996) //fopen is fine here
+
+//////////////////////////////////////////////////////////////////////////
+// Replay files
+//
+// A header (seed, tuning) followed by an append-only stream of records:
+//     input:    type, tick delta (varint), fighter, held, pressed, then for each pressed direction its
+//               press count, first and last press (sub-ticks)
+//     keyframe: type, tick, each fighter's held buttons, state size, ZhengSimulation::SaveState blob
+//     end:      type, tick
+// An input is only written when it isn't what the previous tick's held buttons predict, so a match is
+// mostly a few bytes per button press. A file cut short by a crash plays back up to its last whole record.
+//
+// Recordings of a game (ReplayFlag_FromGame) hold the characters' inputs on the game mode's shared tick,
+// but playback runs them through ZhengSimulation's flat arena, whose movement, projectiles and hits only
+// approximate the level's. The combat rules are the same, so they're good for reading what was pressed
+// when and for rough reruns, but they don't reproduce the match itself.
+
+const uint32_t REPLAY_MAGIC = 0x4C50525A; //"ZRPL"
+const uint16_t REPLAY_VERSION = 3;
+
+enum ReplayRecordType : uint8_t
+{
+	ReplayRecord_Input = 1,
+	ReplayRecord_Keyframe = 2,
+	ReplayRecord_End = 3
+};
+
+enum ReplayFlags : uint8_t
+{
+	ReplayFlag_FromGame = 1
+};
+
+struct ReplayFileHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint8_t numFighters;
+	uint8_t flags;
+	uint32_t keyframeInterval;
+	uint32_t tuningSize;
+	uint64_t seed;
+};
+
+static size_t WriteVarint(uint8_t* o_bytes, uint32_t i_value)
+{
+	size_t size = 0;
+
+	while (i_value >= 0x80)
+	{
+		o_bytes[size++] = static_cast<uint8_t>(i_value | 0x80);
+		i_value >>= 7;
+	}
+
+	o_bytes[size++] = static_cast<uint8_t>(i_value);
+	return size;
+}
+
+//Bytes an input record has after its tick delta, going by its pressed buttons
+static size_t InputRecordSize(uint8_t i_pressed)
+{
+	size_t size = 3;
+
+	for (int i = 0; i < SIM_NUM_DIRECTIONS; i++)
+	{
+		if (i_pressed & (1 << i))
+			size += 3;
+	}
+
+	return size;
+}
+
+static bool ReadVarint(const uint8_t*& io_cursor, const uint8_t* i_end, uint32_t& o_value)
+{
+	o_value = 0;
+
+	for (int shift = 0; shift < 35; shift += 7)
+	{
+		if (io_cursor >= i_end)
+			return false;
+
+		uint8_t byte = *io_cursor++;
+		o_value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// ZhengReplayWriter
+
+ZhengReplayWriter::ZhengReplayWriter()
+{
+	file = nullptr;
+	numFighters = 0;
+	keyframeInterval = 0;
+	lastRecordTick = 0;
+	lastTick = 0;
+	flushedTick = 0;
+	lastKeyframeTick = 0;
+	keyframeWritten = false;
+	memset(lastHeld, 0, sizeof(lastHeld));
+	memset(fighterTicks, 0, sizeof(fighterTicks));
+}
+
+ZhengReplayWriter::~ZhengReplayWriter()
+{
+	Close();
+}
+
+//Starts a new replay. i_seed is whatever seeded the match's randomness. i_keyframeInterval is how many
+//ticks apart RecordKeyframe actually writes a snapshot, 0 for never. i_fromGame marks a recording of the
+//game rather than of a ZhengSimulation, which playback can't reproduce faithfully.
+bool ZhengReplayWriter::Open(const char* i_path, const ZhengTuning& i_tuning, int i_numFighters, uint64_t i_seed, uint32_t i_keyframeInterval, bool i_fromGame)
+{
+	Close();
+
+	if (i_numFighters > SIM_MAX_FIGHTERS)
+	{
+		printf("Too many fighters to record.\n");
+		return false;
+	}
+
+	file = fopen(i_path, "wb");
+	if (file == nullptr)
+	{
+		printf("Could not open replay %s for writing.\n", i_path);
+		return false;
+	}
+
+	ReplayFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = REPLAY_MAGIC;
+	header.version = REPLAY_VERSION;
+	header.numFighters = static_cast<uint8_t>(i_numFighters);
+	header.flags = i_fromGame ? ReplayFlag_FromGame : 0;
+	header.keyframeInterval = i_keyframeInterval;
+	header.tuningSize = sizeof(ZhengTuning);
+	header.seed = i_seed;
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(&i_tuning, sizeof(ZhengTuning), 1, file);
+
+	numFighters = i_numFighters;
+	keyframeInterval = i_keyframeInterval;
+	lastRecordTick = 0;
+	lastTick = 0;
+	flushedTick = 0;
+	keyframeWritten = false;
+	memset(lastHeld, 0, sizeof(lastHeld));
+	memset(fighterTicks, 0, sizeof(fighterTicks));
+	pendingInputs.clear();
+	return true;
+}
+
+//Records one fighter's input for a tick. Each fighter's ticks must go forwards, but fighters can run a little
+//ahead of each other (like characters stepping in their own actor ticks); inputs are held back and written in
+//tick order once every fighter has caught up.
+void ZhengReplayWriter::RecordInput(uint32_t i_tick, int i_fighter, const SimInputFrame& i_input)
+{
+	if (file == nullptr || i_fighter >= numFighters || i_tick < flushedTick)
+		return;
+
+	ReplayPendingInput pending;
+	pending.tick = i_tick;
+	pending.fighter = static_cast<uint8_t>(i_fighter);
+	pending.input = i_input;
+	pendingInputs.push_back(pending);
+
+	if (i_tick + 1 > fighterTicks[i_fighter])
+		fighterTicks[i_fighter] = i_tick + 1;
+
+	uint32_t readyTick = fighterTicks[0];
+	for (int i = 1; i < numFighters; i++)
+	{
+		if (fighterTicks[i] < readyTick)
+			readyTick = fighterTicks[i];
+	}
+
+	FlushInputs(readyTick);
+}
+
+//Writes out every held back input from before i_beforeTick
+void ZhengReplayWriter::FlushInputs(uint32_t i_beforeTick)
+{
+	if (i_beforeTick <= flushedTick)
+		return;
+
+	std::stable_sort(pendingInputs.begin(), pendingInputs.end(), [](const ReplayPendingInput& i_a, const ReplayPendingInput& i_b)
+	{
+		return i_a.tick < i_b.tick || (i_a.tick == i_b.tick && i_a.fighter < i_b.fighter);
+	});
+
+	size_t written = 0;
+	while (written < pendingInputs.size() && pendingInputs[written].tick < i_beforeTick)
+	{
+		WriteInput(pendingInputs[written]);
+		written++;
+	}
+
+	pendingInputs.erase(pendingInputs.begin(), pendingInputs.begin() + written);
+	flushedTick = i_beforeTick;
+}
+
+void ZhengReplayWriter::WriteInput(const ReplayPendingInput& i_pending)
+{
+	if (i_pending.tick + 1 > lastTick)
+		lastTick = i_pending.tick + 1;
+
+	//nothing new, playback will assume exactly this
+	if (i_pending.input.pressed == 0 && i_pending.input.held == lastHeld[i_pending.fighter])
+		return;
+
+	uint8_t record[32];
+	size_t size = 0;
+
+	record[size++] = ReplayRecord_Input;
+	size += WriteVarint(record + size, i_pending.tick - lastRecordTick);
+	record[size++] = i_pending.fighter;
+	record[size++] = i_pending.input.held;
+	record[size++] = i_pending.input.pressed;
+
+	for (int i = 0; i < SIM_NUM_DIRECTIONS; i++)
+	{
+		if (i_pending.input.pressed & (1 << i))
+		{
+			record[size++] = i_pending.input.pressCount[i];
+			record[size++] = i_pending.input.firstPress[i];
+			record[size++] = i_pending.input.lastPress[i];
+		}
+	}
+
+	fwrite(record, 1, size, file);
+
+	lastRecordTick = i_pending.tick;
+	lastHeld[i_pending.fighter] = i_pending.input.held;
+}
+
+//Records every fighter's input for the next tick of a headless simulation, with a keyframe first when one is due.
+//Call right before i_simulation.Step(i_inputs).
+void ZhengReplayWriter::RecordTick(const ZhengSimulation& i_simulation, const SimInputFrame* i_inputs)
+{
+	RecordKeyframe(i_simulation);
+
+	uint32_t tick = i_simulation.GetArena().tick;
+	for (int i = 0; i < numFighters; i++)
+		RecordInput(tick, i, i_inputs[i]);
+}
+
+//Snapshots the simulation so playback can seek here, if a keyframe is due at its current tick
+void ZhengReplayWriter::RecordKeyframe(const ZhengSimulation& i_simulation)
+{
+	uint32_t tick = i_simulation.GetArena().tick;
+
+	if (file == nullptr || keyframeInterval == 0 || tick % keyframeInterval != 0 || tick < flushedTick)
+		return;
+
+	//the same tick can come around twice once the battle is over and the clock stops
+	if (tick == lastKeyframeTick && keyframeWritten)
+		return;
+
+	//the keyframe's held buttons have to include everything up to it
+	FlushInputs(tick);
+
+	stateBuffer.resize(i_simulation.GetMaxStateSize());
+	uint32_t stateSize = static_cast<uint32_t>(i_simulation.SaveState(stateBuffer.data(), stateBuffer.size()));
+
+	uint8_t type = ReplayRecord_Keyframe;
+	fwrite(&type, 1, 1, file);
+	fwrite(&tick, sizeof(tick), 1, file);
+	fwrite(lastHeld, 1, numFighters, file);
+	fwrite(&stateSize, sizeof(stateSize), 1, file);
+	fwrite(stateBuffer.data(), 1, stateSize, file);
+
+	//keyframes are where a crash should leave us at worst
+	fflush(file);
+
+	lastRecordTick = tick;
+	lastKeyframeTick = tick;
+	keyframeWritten = true;
+}
+
+void ZhengReplayWriter::Close()
+{
+	if (file == nullptr)
+		return;
+
+	FlushInputs(UINT32_MAX);
+
+	uint8_t type = ReplayRecord_End;
+	fwrite(&type, 1, 1, file);
+	fwrite(&lastTick, sizeof(lastTick), 1, file);
+
+	fclose(file);
+	file = nullptr;
+	keyframeWritten = false;
+}
+
+bool ZhengReplayWriter::IsOpen() const
+{
+	return file != nullptr;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// ZhengReplayPlayer
+//
+// Maps a replay file and drives a ZhengSimulation from it as fast as the CPU allows. Keyframes make
+// Seek cost at most one keyframe interval of simulation, and double as desync checks on the way through.
+
+ZhengReplayPlayer::ZhengReplayPlayer()
+{
+	mappedData = nullptr;
+	mappedSize = 0;
+	numFighters = 0;
+	seed = 0;
+	fromGame = false;
+	endTick = 0;
+	recordsStart = 0;
+	cursor = 0;
+	cursorTick = 0;
+	currentTick = 0;
+	keyframeMismatches = 0;
+	memset(lastHeld, 0, sizeof(lastHeld));
+}
+
+ZhengReplayPlayer::~ZhengReplayPlayer()
+{
+	Close();
+}
+
+bool ZhengReplayPlayer::Open(const char* i_path)
+{
+	Close();
+
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(i_path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		printf("Could not open replay %s.\n", i_path);
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(file, &fileSize);
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (mapping == nullptr)
+		return false;
+
+	void* mapped = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (mapped == nullptr)
+		return false;
+
+	mappedSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+	int fd = open(i_path, O_RDONLY);
+	if (fd < 0)
+	{
+		printf("Could not open replay %s.\n", i_path);
+		return false;
+	}
+
+	struct stat fileInfo;
+	if (fstat(fd, &fileInfo) != 0 || fileInfo.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	mappedSize = fileInfo.st_size;
+	void* mapped = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+		return false;
+
+	//playback reads front to back
+	madvise(mapped, mappedSize, MADV_SEQUENTIAL);
+#endif
+
+	mappedData = static_cast<const uint8_t*>(mapped);
+
+	ReplayFileHeader header;
+	if (mappedSize < sizeof(header))
+	{
+		printf("Replay %s is too small.\n", i_path);
+		Close();
+		return false;
+	}
+
+	memcpy(&header, mappedData, sizeof(header));
+	if (header.magic != REPLAY_MAGIC || header.version != REPLAY_VERSION || header.tuningSize != sizeof(ZhengTuning) ||
+		header.numFighters == 0 || header.numFighters > SIM_MAX_FIGHTERS || mappedSize < sizeof(header) + header.tuningSize)
+	{
+		printf("Replay %s was written by a different version, or isn't a replay.\n", i_path);
+		Close();
+		return false;
+	}
+
+	memcpy(&tuning, mappedData + sizeof(header), sizeof(ZhengTuning));
+	numFighters = header.numFighters;
+	seed = header.seed;
+	fromGame = (header.flags & ReplayFlag_FromGame) != 0;
+	recordsStart = sizeof(header) + header.tuningSize;
+
+	IndexRecords();
+	return Seek(0);
+}
+
+void ZhengReplayPlayer::Close()
+{
+	if (mappedData == nullptr)
+		return;
+
+#if defined(_WIN32)
+	UnmapViewOfFile(mappedData);
+#else
+	munmap(const_cast<uint8_t*>(mappedData), mappedSize);
+#endif
+
+	mappedData = nullptr;
+	mappedSize = 0;
+	keyframes.clear();
+}
+
+//One pass over the records to find the keyframes and where the last whole record ends
+void ZhengReplayPlayer::IndexRecords()
+{
+	keyframes.clear();
+	endTick = 0;
+	recordsEnd = recordsStart;
+
+	const uint8_t* data = mappedData + recordsStart;
+	const uint8_t* end = mappedData + mappedSize;
+	uint32_t tick = 0;
+
+	while (data < end)
+	{
+		const uint8_t* recordStart = data;
+		uint8_t type = *data++;
+
+		if (type == ReplayRecord_Input)
+		{
+			uint32_t delta;
+			if (!ReadVarint(data, end, delta) || end - data < 3 || static_cast<size_t>(end - data) < InputRecordSize(data[2]))
+				break;
+
+			tick += delta;
+			data += InputRecordSize(data[2]);
+			if (tick + 1 > endTick)
+				endTick = tick + 1;
+		}
+		else if (type == ReplayRecord_Keyframe)
+		{
+			uint32_t stateSize;
+			if (static_cast<size_t>(end - data) < sizeof(uint32_t) + numFighters + sizeof(uint32_t))
+				break;
+
+			memcpy(&tick, data, sizeof(uint32_t));
+			memcpy(&stateSize, data + sizeof(uint32_t) + numFighters, sizeof(uint32_t));
+			data += sizeof(uint32_t) + numFighters + sizeof(uint32_t);
+
+			if (static_cast<size_t>(end - data) < stateSize)
+				break;
+
+			data += stateSize;
+
+			ReplayKeyframe keyframe;
+			keyframe.tick = tick;
+			keyframe.offset = recordStart - mappedData;
+			keyframes.push_back(keyframe);
+
+			if (tick > endTick)
+				endTick = tick;
+		}
+		else if (type == ReplayRecord_End)
+		{
+			if (static_cast<size_t>(end - data) < sizeof(uint32_t))
+				break;
+
+			uint32_t lastTick;
+			memcpy(&lastTick, data, sizeof(uint32_t));
+			data += sizeof(uint32_t);
+
+			if (lastTick > endTick)
+				endTick = lastTick;
+		}
+		else
+		{
+			printf("Replay has an unknown record, stopping at tick %u.\n", tick);
+			break;
+		}
+
+		recordsEnd = data - mappedData;
+	}
+}
+
+//Jumps to the start of a tick by restoring the nearest keyframe at or before it and simulating the rest of the way
+bool ZhengReplayPlayer::Seek(uint32_t i_tick)
+{
+	if (mappedData == nullptr)
+		return false;
+
+	//the latest keyframe at or before i_tick
+	size_t keyframe = keyframes.size();
+	for (size_t i = 0; i < keyframes.size() && keyframes[i].tick <= i_tick; i++)
+		keyframe = i;
+
+	if (keyframe == keyframes.size())
+	{
+		simulation.Initialize(tuning, numFighters);
+		cursor = recordsStart;
+		cursorTick = 0;
+		currentTick = 0;
+		memset(lastHeld, 0, sizeof(lastHeld));
+	}
+	else
+	{
+		const uint8_t* data = mappedData + keyframes[keyframe].offset + 1;
+		uint32_t stateSize;
+
+		memcpy(&currentTick, data, sizeof(uint32_t));
+		data += sizeof(uint32_t);
+		memcpy(lastHeld, data, numFighters);
+		data += numFighters;
+		memcpy(&stateSize, data, sizeof(uint32_t));
+		data += sizeof(uint32_t);
+
+		simulation.Initialize(tuning, numFighters);
+		if (!simulation.LoadState(data, stateSize))
+			return false;
+
+		cursor = (data + stateSize) - mappedData;
+		cursorTick = currentTick;
+	}
+
+	while (currentTick < i_tick)
+	{
+		if (!Step())
+			break;
+	}
+
+	return currentTick == i_tick;
+}
+
+//Plays the next tick. Returns false once the replay has run out.
+bool ZhengReplayPlayer::Step()
+{
+	if (currentTick >= endTick)
+		return false;
+
+	SimInputFrame inputs[SIM_MAX_FIGHTERS];
+	memset(inputs, 0, sizeof(inputs));
+	for (int i = 0; i < numFighters; i++)
+	{
+		inputs[i].held = lastHeld[i];
+	}
+
+	const uint8_t* end = mappedData + recordsEnd;
+
+	while (mappedData + cursor < end)
+	{
+		const uint8_t* data = mappedData + cursor;
+		uint8_t type = *data++;
+
+		if (type == ReplayRecord_Input)
+		{
+			uint32_t delta;
+			ReadVarint(data, end, delta);
+			if (cursorTick + delta != currentTick)
+				break;
+
+			uint8_t fighter = data[0];
+			const uint8_t* timing = data + 3;
+			if (fighter < numFighters)
+			{
+				SimInputFrame& input = inputs[fighter];
+				input.held = data[1];
+				input.pressed = data[2];
+				lastHeld[fighter] = data[1];
+
+				for (int i = 0; i < SIM_NUM_DIRECTIONS; i++)
+				{
+					if (input.pressed & (1 << i))
+					{
+						input.pressCount[i] = timing[0];
+						input.firstPress[i] = timing[1];
+						input.lastPress[i] = timing[2];
+						timing += 3;
+					}
+				}
+			}
+
+			cursorTick = currentTick;
+			cursor = (data + InputRecordSize(data[2])) - mappedData;
+		}
+		else if (type == ReplayRecord_Keyframe)
+		{
+			uint32_t keyframeTick;
+			memcpy(&keyframeTick, data, sizeof(uint32_t));
+			if (keyframeTick != currentTick)
+				break;
+
+			uint32_t stateSize;
+			memcpy(&stateSize, data + sizeof(uint32_t) + numFighters, sizeof(uint32_t));
+			data += sizeof(uint32_t) + numFighters + sizeof(uint32_t);
+
+			//we got here by simulating, so we should be exactly where the recording was
+			CheckKeyframe(data, stateSize);
+
+			cursorTick = keyframeTick;
+			cursor = (data + stateSize) - mappedData;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	simulation.Step(inputs);
+	currentTick++;
+	return true;
+}
+
+void ZhengReplayPlayer::CheckKeyframe(const uint8_t* i_state, uint32_t i_stateSize)
+{
+	stateBuffer.resize(simulation.GetMaxStateSize());
+	size_t size = simulation.SaveState(stateBuffer.data(), stateBuffer.size());
+
+	if (size != i_stateSize || memcmp(stateBuffer.data(), i_state, size) != 0)
+	{
+		if (keyframeMismatches == 0)
+			printf("Replay diverged from the recording at tick %u.\n", currentTick);
+
+		keyframeMismatches++;
+	}
+}
+
+uint32_t ZhengReplayPlayer::GetCurrentTick() const
+{
+	return currentTick;
+}
+
+uint32_t ZhengReplayPlayer::GetEndTick() const
+{
+	return endTick;
+}
+
+uint64_t ZhengReplayPlayer::GetSeed() const
+{
+	return seed;
+}
+
+//Whether this is a recording of the game, which plays back through the flat arena rather than as it happened
+bool ZhengReplayPlayer::IsFromGame() const
+{
+	return fromGame;
+}
+
+//Keyframes the playback didn't match. Anything but 0 means the simulation is no longer deterministic with the recording.
+uint32_t ZhengReplayPlayer::GetKeyframeMismatches() const
+{
+	return keyframeMismatches;
+}
+
+const ZhengSimulation& ZhengReplayPlayer::GetSimulation() const
+{
+	return simulation;
+}
@@ -0,0 +1,83 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+//////////////////////////////////////////////////////////////////////////
+// Replay playback
+//
+// Standalone program, built outside the game module together with ZhengSimulation.cpp, ZhengPackedState.cpp
+// and ZhengReplay.cpp. Plays a recorded match back headless as fast as it can, for regression and performance
+// runs. Exits with 1 if the playback stopped matching the recording's keyframes.
+//
+// Recordings made in the game are replayed through the headless flat arena, not the level, so their
+// movement, projectiles and hits differ from the real match; the tool says so when it opens one.
+//
+// usage: ZhengReplayPlayback <replay> [seekTick] [repeats]
+
+#include "ZhengReplay.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		printf("usage: ZhengReplayPlayback <replay> [seekTick] [repeats]\n");
+		return 1;
+	}
+
+	uint32_t seekTick = (argc > 2) ? static_cast<uint32_t>(atoi(argv[2])) : 0;
+	int repeats = (argc > 3) ? atoi(argv[3]) : 1;
+
+	ZhengReplayPlayer player;
+	if (!player.Open(argv[1]))
+		return 1;
+
+	printf("%s: %u ticks (%.1f s), seed %llu\n", argv[1], player.GetEndTick(), player.GetEndTick() * SIM_TICK_SECONDS,
+		static_cast<unsigned long long>(player.GetSeed()));
+
+	if (player.IsFromGame())
+	{
+		printf("Recorded in the game: the inputs are played through the headless arena, so movement, projectiles\n"
+			"and hits only approximate the real match, and the outcome can differ from what happened.\n");
+	}
+
+	uint64_t ticksPlayed = 0;
+	double seekSeconds = 0.0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < repeats; i++)
+	{
+		std::chrono::steady_clock::time_point seekStart = std::chrono::steady_clock::now();
+		if (!player.Seek(seekTick))
+		{
+			printf("Couldn't seek to tick %u.\n", seekTick);
+			return 1;
+		}
+		seekSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - seekStart).count();
+
+		while (player.Step())
+			ticksPlayed++;
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double playSeconds = seconds - seekSeconds;
+
+	printf("seek to %u took %.3f ms, played %llu ticks in %.3f s (%.0f ticks/s, %.0fx real time)\n",
+		seekTick, seekSeconds * 1000.0 / repeats, static_cast<unsigned long long>(ticksPlayed), playSeconds,
+		ticksPlayed / playSeconds, ticksPlayed * SIM_TICK_SECONDS / playSeconds);
+
+	const ZhengSimulation& simulation = player.GetSimulation();
+	printf("final checksum %08x, round %u, rounds won", simulation.GetChecksum(), simulation.GetRound().GetState().roundNumber);
+	for (int i = 0; i < simulation.GetNumFighters(); i++)
+		printf(" %u", simulation.GetFighter(i).GetState().roundsWon);
+	printf("\n");
+
+	if (player.GetKeyframeMismatches() > 0)
+	{
+		printf("%u keyframes didn't match the recording.\n", player.GetKeyframeMismatches());
+		return 1;
+	}
+
+	return 0;
+}
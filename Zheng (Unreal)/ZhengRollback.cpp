@@ -0,0 +1,304 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "ZhengRollback.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+// RollbackSession
+//
+// Runs a two-player ZhengSimulation without waiting on the network. The remote player's input is
+// predicted (they keep holding what they held, and press nothing new), a snapshot of the match is
+// kept for every recent tick, and when a real input arrives that doesn't match the prediction the
+// match is restored to that tick and resimulated up to the present.
+
+static double NowSeconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool InputsMatch(const SimInputFrame& i_a, const SimInputFrame& i_b)
+{
+	if (i_a.held != i_b.held || i_a.pressed != i_b.pressed)
+		return false;
+
+	//when in the tick a direction was pressed decides double presses, so it has to match too
+	for (int i = 0; i < SIM_NUM_DIRECTIONS; i++)
+	{
+		if (i_a.pressCount[i] != i_b.pressCount[i] || i_a.firstPress[i] != i_b.firstPress[i] || i_a.lastPress[i] != i_b.lastPress[i])
+			return false;
+	}
+
+	return true;
+}
+
+RollbackSession::RollbackSession()
+{
+	simulation = nullptr;
+	snapshotData = nullptr;
+	snapshotCapacity = 0;
+}
+
+RollbackSession::~RollbackSession()
+{
+	delete[] snapshotData;
+}
+
+//i_inputDelay ticks are added to every local input before it is used, which trades a little latency for
+//fewer rollbacks. i_maxRollbackFrames is how far ahead of the remote player we let ourselves predict
+//before stalling, which caps how much a single rollback can cost.
+bool RollbackSession::Initialize(ZhengSimulation* i_simulation, int i_localPlayer, uint32_t i_inputDelay, uint32_t i_maxRollbackFrames)
+{
+	if (i_simulation->GetNumFighters() != ROLLBACK_NUM_PLAYERS)
+	{
+		printf("Rollback sessions only support %d players.\n", ROLLBACK_NUM_PLAYERS);
+		return false;
+	}
+
+	if (i_maxRollbackFrames >= ROLLBACK_SNAPSHOT_FRAMES)
+	{
+		printf("Can only roll back %u frames, clamping.\n", ROLLBACK_SNAPSHOT_FRAMES - 1);
+		i_maxRollbackFrames = ROLLBACK_SNAPSHOT_FRAMES - 1;
+	}
+
+	if (i_inputDelay >= ROLLBACK_INPUT_FRAMES / 2)
+	{
+		printf("Input delay of %u ticks is too long.\n", i_inputDelay);
+		return false;
+	}
+
+	simulation = i_simulation;
+	localPlayer = i_localPlayer;
+	remotePlayer = 1 - i_localPlayer;
+	inputDelay = i_inputDelay;
+	maxRollbackFrames = i_maxRollbackFrames;
+
+	currentTick = simulation->GetArena().tick;
+	rollbackTick = SIM_NEVER;
+
+	memset(inputs, 0, sizeof(inputs));
+	memset(&stats, 0, sizeof(stats));
+
+	//both sides know nobody pressed anything during the input delay
+	for (uint32_t tick = currentTick; tick < currentTick + inputDelay; tick++)
+	{
+		for (int player = 0; player < ROLLBACK_NUM_PLAYERS; player++)
+		{
+			RollbackInputSlot& slot = inputs[player][tick & (ROLLBACK_INPUT_FRAMES - 1)];
+			slot.tick = tick;
+			slot.confirmed = true;
+		}
+	}
+
+	nextLocalTick = currentTick + inputDelay;
+	nextRemoteTick = currentTick + inputDelay;
+
+	delete[] snapshotData;
+	snapshotCapacity = simulation->GetMaxStateSize();
+	snapshotData = new unsigned char[snapshotCapacity * ROLLBACK_SNAPSHOT_FRAMES];
+
+	for (uint32_t i = 0; i < ROLLBACK_SNAPSHOT_FRAMES; i++)
+	{
+		snapshots[i].tick = SIM_NEVER;
+		snapshots[i].size = 0;
+	}
+
+	return true;
+}
+
+//Queues this frame's local input, to be used inputDelay ticks from now. Returns false while the session is
+//stalled and already has all the local input it can take; keep accumulating presses and try again next frame.
+bool RollbackSession::AddLocalInput(const SimInputFrame& i_input)
+{
+	if (nextLocalTick > currentTick + inputDelay)
+		return false;
+
+	RollbackInputSlot& slot = inputs[localPlayer][nextLocalTick & (ROLLBACK_INPUT_FRAMES - 1)];
+	slot.tick = nextLocalTick;
+	slot.input = i_input;
+	slot.confirmed = true;
+
+	nextLocalTick++;
+	return true;
+}
+
+//Takes the remote player's input for a tick. Duplicates and stale inputs are ignored, so the sender can
+//repeat every input until it is acknowledged.
+void RollbackSession::AddRemoteInput(uint32_t i_tick, const SimInputFrame& i_input)
+{
+	if (i_tick < nextRemoteTick || i_tick >= currentTick + ROLLBACK_INPUT_FRAMES / 2)
+		return;
+
+	RollbackInputSlot& slot = inputs[remotePlayer][i_tick & (ROLLBACK_INPUT_FRAMES - 1)];
+	if (slot.tick == i_tick && slot.confirmed)
+		return;
+
+	//this tick was already simulated on a guess, rewind if the guess was wrong
+	if (i_tick < currentTick && slot.tick == i_tick && !InputsMatch(slot.input, i_input))
+	{
+		stats.mispredictions++;
+		if (rollbackTick == SIM_NEVER || i_tick < rollbackTick)
+			rollbackTick = i_tick;
+	}
+
+	slot.tick = i_tick;
+	slot.input = i_input;
+	slot.confirmed = true;
+
+	//inputs can arrive out of order, so only move past ticks we have everything up to
+	while (true)
+	{
+		const RollbackInputSlot& next = inputs[remotePlayer][nextRemoteTick & (ROLLBACK_INPUT_FRAMES - 1)];
+		if (next.tick != nextRemoteTick || !next.confirmed)
+			break;
+
+		nextRemoteTick++;
+	}
+}
+
+//Simulates the next tick. Returns false if the local input for it isn't in yet, or we're too far ahead of the
+//remote player and have to wait for them.
+bool RollbackSession::AdvanceFrame()
+{
+	Resimulate();
+
+	if (nextLocalTick <= currentTick)
+		return false;
+
+	if (currentTick >= nextRemoteTick + maxRollbackFrames)
+	{
+		stats.stalls++;
+		return false;
+	}
+
+	SaveSnapshot();
+	SimulateTick();
+	stats.framesSimulated++;
+	return true;
+}
+
+//Restores and resimulates if a remote input contradicted a prediction. AdvanceFrame calls this itself.
+void RollbackSession::Resimulate()
+{
+	if (rollbackTick == SIM_NEVER)
+		return;
+
+	uint32_t targetTick = currentTick;
+	const RollbackSnapshot& snapshot = snapshots[rollbackTick & (ROLLBACK_SNAPSHOT_FRAMES - 1)];
+
+	if (snapshot.tick != rollbackTick)
+	{
+		//can't happen while the stall check holds, but don't desync quietly if it does
+		printf("No snapshot for tick %u, can't roll back.\n", rollbackTick);
+		rollbackTick = SIM_NEVER;
+		return;
+	}
+
+	double startTime = NowSeconds();
+
+	simulation->LoadState(snapshotData + (rollbackTick & (ROLLBACK_SNAPSHOT_FRAMES - 1)) * snapshotCapacity, snapshot.size);
+	currentTick = rollbackTick;
+
+	//the restored tick's snapshot is still good, every later one gets retaken with the corrected inputs
+	SimulateTick();
+	while (currentTick < targetTick)
+	{
+		SaveSnapshot();
+		SimulateTick();
+	}
+
+	double elapsed = NowSeconds() - startTime;
+	uint32_t frames = targetTick - rollbackTick;
+
+	stats.rollbacks++;
+	stats.framesResimulated += frames;
+	stats.resimulateSeconds += elapsed;
+	if (frames > stats.maxRollbackFrames)
+		stats.maxRollbackFrames = frames;
+	if (elapsed > stats.maxResimulateSeconds)
+		stats.maxResimulateSeconds = elapsed;
+
+	rollbackTick = SIM_NEVER;
+}
+
+void RollbackSession::SaveSnapshot()
+{
+	uint32_t index = currentTick & (ROLLBACK_SNAPSHOT_FRAMES - 1);
+
+	snapshots[index].tick = currentTick;
+	snapshots[index].size = simulation->SaveState(snapshotData + index * snapshotCapacity, snapshotCapacity);
+}
+
+void RollbackSession::SimulateTick()
+{
+	SimInputFrame frame[ROLLBACK_NUM_PLAYERS];
+
+	frame[localPlayer] = inputs[localPlayer][currentTick & (ROLLBACK_INPUT_FRAMES - 1)].input;
+
+	RollbackInputSlot& remote = inputs[remotePlayer][currentTick & (ROLLBACK_INPUT_FRAMES - 1)];
+	if (remote.tick != currentTick || !remote.confirmed)
+	{
+		//remember the guess so we can tell if the real input disagrees
+		remote.tick = currentTick;
+		remote.input = PredictRemoteInput(currentTick);
+		remote.confirmed = false;
+	}
+	frame[remotePlayer] = remote.input;
+
+	simulation->Step(frame);
+	currentTick++;
+}
+
+//Guesses the remote player keeps holding whatever they last held and presses nothing new
+SimInputFrame RollbackSession::PredictRemoteInput(uint32_t i_tick) const
+{
+	SimInputFrame prediction;
+	memset(&prediction, 0, sizeof(prediction));
+
+	for (uint32_t tick = i_tick; tick > 0 && i_tick - tick < ROLLBACK_INPUT_FRAMES / 2; tick--)
+	{
+		const RollbackInputSlot& slot = inputs[remotePlayer][(tick - 1) & (ROLLBACK_INPUT_FRAMES - 1)];
+		if (slot.tick == tick - 1 && slot.confirmed)
+		{
+			prediction.held = slot.input.held;
+			break;
+		}
+	}
+
+	return prediction;
+}
+
+//Gets the local input queued for a tick, for sending to the remote player. False if there isn't one.
+bool RollbackSession::GetLocalInput(uint32_t i_tick, SimInputFrame& o_input) const
+{
+	const RollbackInputSlot& slot = inputs[localPlayer][i_tick & (ROLLBACK_INPUT_FRAMES - 1)];
+	if (slot.tick != i_tick || !slot.confirmed || i_tick >= nextLocalTick)
+		return false;
+
+	o_input = slot.input;
+	return true;
+}
+
+uint32_t RollbackSession::GetCurrentTick() const
+{
+	return currentTick;
+}
+
+//The first local tick with no input yet
+uint32_t RollbackSession::GetNextLocalTick() const
+{
+	return nextLocalTick;
+}
+
+//The first tick we don't have the remote player's input for. Everything before it is final.
+uint32_t RollbackSession::GetNextRemoteTick() const
+{
+	return nextRemoteTick;
+}
+
+const RollbackStats& RollbackSession::GetStats() const
+{
+	return stats;
+}
@@ -0,0 +1,340 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+//////////////////////////////////////////////////////////////////////////
+// Rollback loopback harness
+//
+// Standalone program, built outside the game module together with ZhengSimulation.cpp and ZhengRollback.cpp.
+// Plays two bot-driven peers against each other over real UDP sockets on 127.0.0.1, holding each packet back
+// for a configurable latency plus jitter, then reports how much each peer had to resimulate and whether
+// both ended the match in the same state.
+//
+// usage: ZhengRollbackLoopback [latencyMs] [jitterMs] [lossPercent] [ticks] [inputDelay] [maxRollbackFrames]
+
+#include "ZhengRollback.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef int socklen_t;
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
+
+const uint32_t LOOPBACK_PACKET_MAGIC = 0x424C525A; //"ZRLB"
+const uint32_t LOOPBACK_MAX_INPUTS_PER_PACKET = 64;
+
+//Every packet repeats all the inputs the other side hasn't acknowledged yet, so lost packets cost nothing
+//but a little lateness
+struct LoopbackPacket
+{
+	uint32_t magic;
+	uint32_t firstTick;
+	uint32_t ackTick;
+	uint32_t numInputs;
+	SimInputFrame inputs[LOOPBACK_MAX_INPUTS_PER_PACKET];
+};
+
+struct DelayedPacket
+{
+	double releaseTime;
+	LoopbackPacket packet;
+};
+
+struct LoopbackPeer
+{
+	ZhengSimulation simulation;
+	RollbackSession session;
+	SOCKET socket;
+	sockaddr_in remoteAddress;
+	std::vector<DelayedPacket> outgoing;
+
+	uint32_t remoteAckTick; //the remote side has all our inputs before this tick
+	SimInputFrame pendingInput;
+	uint8_t botHeld;
+	uint64_t randomState;
+};
+
+static uint32_t NextRandom(uint64_t& io_state)
+{
+	io_state ^= io_state << 13;
+	io_state ^= io_state >> 7;
+	io_state ^= io_state << 17;
+	return static_cast<uint32_t>(io_state >> 32);
+}
+
+//Mashes like a person would: walks somewhere for a while, double-taps now and then, and strums in bursts
+static SimInputFrame NextBotInput(LoopbackPeer& io_peer)
+{
+	SimInputFrame input;
+	memset(&input, 0, sizeof(input));
+
+	uint32_t roll = NextRandom(io_peer.randomState) % 1000;
+
+	if (roll < 20)
+	{
+		//change direction
+		uint8_t direction = static_cast<uint8_t>(1 << (NextRandom(io_peer.randomState) % SIM_NUM_DIRECTIONS));
+		input.pressed |= direction;
+		io_peer.botHeld = direction;
+	}
+	else if (roll < 25)
+	{
+		io_peer.botHeld = 0;
+	}
+	else if (roll < 60)
+	{
+		//a strum button
+		input.pressed |= static_cast<uint8_t>(1 << (SIM_NUM_DIRECTIONS + NextRandom(io_peer.randomState) % SIM_NUM_ATTACK_COMPONENT_TYPES));
+	}
+	else if (roll < 64 && io_peer.botHeld != 0)
+	{
+		//tap the held direction again to dash
+		input.pressed |= io_peer.botHeld;
+	}
+
+	input.held = io_peer.botHeld | input.pressed;
+	return input;
+}
+
+static bool OpenSocket(LoopbackPeer& o_peer, uint16_t& o_port)
+{
+	o_peer.socket = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (o_peer.socket == INVALID_SOCKET)
+	{
+		printf("Couldn't create a UDP socket.\n");
+		return false;
+	}
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = 0;
+
+	if (bind(o_peer.socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+	{
+		printf("Couldn't bind a UDP socket on loopback.\n");
+		return false;
+	}
+
+	socklen_t addressSize = sizeof(address);
+	getsockname(o_peer.socket, reinterpret_cast<sockaddr*>(&address), &addressSize);
+	o_port = ntohs(address.sin_port);
+
+#if defined(_WIN32)
+	u_long nonBlocking = 1;
+	ioctlsocket(o_peer.socket, FIONBIO, &nonBlocking);
+#else
+	fcntl(o_peer.socket, F_SETFL, fcntl(o_peer.socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	return true;
+}
+
+//Queues this tick's packet, to go out after the latency plus up to the jitter (so packets can overtake each other)
+static void QueuePacket(LoopbackPeer& io_peer, double i_now, double i_latency, double i_jitter, int i_lossPercent)
+{
+	if (i_lossPercent > 0 && static_cast<int>(NextRandom(io_peer.randomState) % 100) < i_lossPercent)
+		return;
+
+	DelayedPacket delayed;
+	memset(&delayed, 0, sizeof(delayed));
+
+	LoopbackPacket& packet = delayed.packet;
+	packet.magic = LOOPBACK_PACKET_MAGIC;
+	packet.firstTick = io_peer.remoteAckTick;
+	packet.ackTick = io_peer.session.GetNextRemoteTick();
+
+	SimInputFrame input;
+	while (packet.numInputs < LOOPBACK_MAX_INPUTS_PER_PACKET && io_peer.session.GetLocalInput(packet.firstTick + packet.numInputs, input))
+	{
+		packet.inputs[packet.numInputs++] = input;
+	}
+
+	double jitter = (i_jitter > 0.0) ? (NextRandom(io_peer.randomState) % 1000) / 1000.0 * i_jitter : 0.0;
+	delayed.releaseTime = i_now + i_latency + jitter;
+	io_peer.outgoing.push_back(delayed);
+}
+
+static void SendDuePackets(LoopbackPeer& io_peer, double i_now)
+{
+	size_t kept = 0;
+
+	for (size_t i = 0; i < io_peer.outgoing.size(); i++)
+	{
+		const DelayedPacket& delayed = io_peer.outgoing[i];
+		if (delayed.releaseTime <= i_now)
+		{
+			size_t size = offsetof(LoopbackPacket, inputs) + delayed.packet.numInputs * sizeof(SimInputFrame);
+			sendto(io_peer.socket, reinterpret_cast<const char*>(&delayed.packet), static_cast<int>(size), 0,
+				reinterpret_cast<const sockaddr*>(&io_peer.remoteAddress), sizeof(io_peer.remoteAddress));
+		}
+		else
+		{
+			io_peer.outgoing[kept++] = delayed;
+		}
+	}
+
+	io_peer.outgoing.resize(kept);
+}
+
+static void ReceivePackets(LoopbackPeer& io_peer)
+{
+	LoopbackPacket packet;
+
+	while (true)
+	{
+		int received = static_cast<int>(recv(io_peer.socket, reinterpret_cast<char*>(&packet), sizeof(packet), 0));
+		if (received <= 0)
+			break;
+
+		if (received < static_cast<int>(offsetof(LoopbackPacket, inputs)) || packet.magic != LOOPBACK_PACKET_MAGIC ||
+			packet.numInputs > LOOPBACK_MAX_INPUTS_PER_PACKET ||
+			received < static_cast<int>(offsetof(LoopbackPacket, inputs) + packet.numInputs * sizeof(SimInputFrame)))
+		{
+			continue;
+		}
+
+		for (uint32_t i = 0; i < packet.numInputs; i++)
+			io_peer.session.AddRemoteInput(packet.firstTick + i, packet.inputs[i]);
+
+		if (packet.ackTick > io_peer.remoteAckTick)
+			io_peer.remoteAckTick = packet.ackTick;
+	}
+}
+
+static void PrintStats(int i_player, const RollbackStats& i_stats, uint32_t i_ticks)
+{
+	double frameBudgetMs = SIM_TICK_SECONDS * 1000.0;
+
+	printf("peer %d: %llu ticks simulated, %llu stalls\n", i_player,
+		static_cast<unsigned long long>(i_stats.framesSimulated), static_cast<unsigned long long>(i_stats.stalls));
+	printf("  %llu mispredictions, %llu rollbacks, %llu frames resimulated (%.2f per tick), deepest rollback %u frames\n",
+		static_cast<unsigned long long>(i_stats.mispredictions), static_cast<unsigned long long>(i_stats.rollbacks),
+		static_cast<unsigned long long>(i_stats.framesResimulated), static_cast<double>(i_stats.framesResimulated) / i_ticks,
+		i_stats.maxRollbackFrames);
+	printf("  resimulation took %.3f ms total, %.4f ms worst (%.2f%% of the %.2f ms frame budget)\n",
+		i_stats.resimulateSeconds * 1000.0, i_stats.maxResimulateSeconds * 1000.0,
+		i_stats.maxResimulateSeconds * 1000.0 / frameBudgetMs * 100.0, frameBudgetMs);
+}
+
+int main(int argc, char** argv)
+{
+	double latency = ((argc > 1) ? atof(argv[1]) : 60.0) / 1000.0;
+	double jitter = ((argc > 2) ? atof(argv[2]) : 20.0) / 1000.0;
+	int lossPercent = (argc > 3) ? atoi(argv[3]) : 0;
+	uint32_t ticks = (argc > 4) ? static_cast<uint32_t>(atoi(argv[4])) : 120 * SIM_TICKS_PER_SECOND;
+	uint32_t inputDelay = (argc > 5) ? static_cast<uint32_t>(atoi(argv[5])) : 2;
+	uint32_t maxRollbackFrames = (argc > 6) ? static_cast<uint32_t>(atoi(argv[6])) : ROLLBACK_DEFAULT_MAX_FRAMES;
+
+#if defined(_WIN32)
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+	ZhengTuning tuning;
+	LoopbackPeer* peers = new LoopbackPeer[ROLLBACK_NUM_PLAYERS];
+	uint16_t ports[ROLLBACK_NUM_PLAYERS];
+
+	for (int i = 0; i < ROLLBACK_NUM_PLAYERS; i++)
+	{
+		if (!OpenSocket(peers[i], ports[i]))
+			return 1;
+
+		peers[i].simulation.Initialize(tuning, ROLLBACK_NUM_PLAYERS);
+		if (!peers[i].session.Initialize(&peers[i].simulation, i, inputDelay, maxRollbackFrames))
+			return 1;
+
+		peers[i].remoteAckTick = 0;
+		peers[i].botHeld = 0;
+		memset(&peers[i].pendingInput, 0, sizeof(peers[i].pendingInput));
+		peers[i].randomState = 0x9E3779B97F4A7C15ULL * (i + 1);
+	}
+
+	for (int i = 0; i < ROLLBACK_NUM_PLAYERS; i++)
+	{
+		memset(&peers[i].remoteAddress, 0, sizeof(peers[i].remoteAddress));
+		peers[i].remoteAddress.sin_family = AF_INET;
+		peers[i].remoteAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		peers[i].remoteAddress.sin_port = htons(ports[1 - i]);
+	}
+
+	printf("%u ticks, %.0f ms latency, %.0f ms jitter, %d%% loss, %u ticks input delay, up to %u frames of rollback\n",
+		ticks, latency * 1000.0, jitter * 1000.0, lossPercent, inputDelay, maxRollbackFrames);
+
+	//time is simulated so the run doesn't take as long as the match would; the sockets and resimulation are real
+	double now = 0.0;
+	bool finished = false;
+
+	while (!finished)
+	{
+		finished = true;
+
+		for (int i = 0; i < ROLLBACK_NUM_PLAYERS; i++)
+		{
+			LoopbackPeer& peer = peers[i];
+			ReceivePackets(peer);
+
+			if (peer.session.GetNextLocalTick() < ticks + inputDelay)
+			{
+				//presses made while stalled carry over to the next tick that takes input
+				SimInputFrame input = NextBotInput(peer);
+				peer.pendingInput.pressed |= input.pressed;
+				peer.pendingInput.held = input.held;
+
+				if (peer.session.AddLocalInput(peer.pendingInput))
+					peer.pendingInput.pressed = 0;
+			}
+
+			if (peer.session.GetCurrentTick() < ticks)
+			{
+				peer.session.AdvanceFrame();
+			}
+			else
+			{
+				peer.session.Resimulate();
+			}
+
+			QueuePacket(peer, now, latency, jitter, lossPercent);
+			SendDuePackets(peer, now);
+
+			if (peer.session.GetCurrentTick() < ticks || peer.session.GetNextRemoteTick() < ticks)
+				finished = false;
+		}
+
+		now += SIM_TICK_SECONDS;
+	}
+
+	bool inSync = true;
+	for (int i = 0; i < ROLLBACK_NUM_PLAYERS; i++)
+	{
+		PrintStats(i, peers[i].session.GetStats(), ticks);
+		if (peers[i].simulation.GetChecksum() != peers[0].simulation.GetChecksum())
+			inSync = false;
+	}
+
+	printf("final state %s (checksum %08x)\n", inSync ? "matches" : "DESYNCED", peers[0].simulation.GetChecksum());
+
+	for (int i = 0; i < ROLLBACK_NUM_PLAYERS; i++)
+		closesocket(peers[i].socket);
+	delete[] peers;
+
+#if defined(_WIN32)
+	WSACleanup();
+#endif
+
+	return inSync ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "ZhengRoster.h"
+
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+// ZhengRoster
+//
+// Who is still standing and who is ahead, kept up to date as fighters change instead of counted over
+// every fighter each time someone asks. The alive count moves by one per change. The leader (alive
+// fighter with the most health, ties to the lowest index, same as ZhengRoundSim::GetRoundWinner) sits
+// at the root of a tournament tree, so a change replays only the matches on its way up.
+
+ZhengRoster::ZhengRoster()
+{
+	Reset(0);
+}
+
+//Starts over with i_numFighters fighters, none of them alive until SetFighter says so
+void ZhengRoster::Reset(int i_numFighters)
+{
+	numFighters = (i_numFighters < SIM_MAX_FIGHTERS) ? i_numFighters : SIM_MAX_FIGHTERS;
+	numAlive = 0;
+	mostRoundsWonFighter = 0;
+
+	memset(alive, 0, sizeof(alive));
+	memset(health, 0, sizeof(health));
+	memset(roundsWon, 0, sizeof(roundsWon));
+
+	for (int i = 0; i < SIM_MAX_FIGHTERS; i++)
+		tree[SIM_MAX_FIGHTERS + i] = (i < numFighters) ? static_cast<uint8_t>(i) : SIM_NO_FIGHTER;
+
+	for (int node = SIM_MAX_FIGHTERS - 1; node > 0; node--)
+		tree[node] = Winner(tree[node * 2], tree[node * 2 + 1]);
+}
+
+int ZhengRoster::GetNumFighters() const
+{
+	return numFighters;
+}
+
+//Records a fighter's current state
+void ZhengRoster::SetFighter(int i_fighter, bool i_alive, int32_t i_health)
+{
+	if (i_fighter < 0 || i_fighter >= numFighters)
+		return;
+
+	if (alive[i_fighter] != i_alive)
+		numAlive += i_alive ? 1 : -1;
+
+	if (alive[i_fighter] == i_alive && health[i_fighter] == i_health)
+		return;
+
+	alive[i_fighter] = i_alive;
+	health[i_fighter] = i_health;
+
+	//replay the matches from the leaf up
+	for (int node = (SIM_MAX_FIGHTERS + i_fighter) / 2; node > 0; node /= 2)
+		tree[node] = Winner(tree[node * 2], tree[node * 2 + 1]);
+}
+
+void ZhengRoster::SetRoundsWon(int i_fighter, int i_roundsWon)
+{
+	if (i_fighter < 0 || i_fighter >= numFighters)
+		return;
+
+	int previous = roundsWon[i_fighter];
+	roundsWon[i_fighter] = i_roundsWon;
+
+	const int best = roundsWon[mostRoundsWonFighter];
+	if (i_roundsWon > best || (i_roundsWon == best && i_fighter < mostRoundsWonFighter))
+	{
+		mostRoundsWonFighter = i_fighter;
+	}
+	else if (i_fighter == mostRoundsWonFighter && i_roundsWon < previous)
+	{
+		//only happens when a battle restarts; look again
+		mostRoundsWonFighter = 0;
+		for (int i = 1; i < numFighters; i++)
+		{
+			if (roundsWon[i] > roundsWon[mostRoundsWonFighter])
+				mostRoundsWonFighter = i;
+		}
+	}
+}
+
+int ZhengRoster::GetNumAlive() const
+{
+	return numAlive;
+}
+
+//The alive fighter with the most health, ties going to the lowest index. The 1st fighter if nobody is alive.
+int ZhengRoster::GetLeader() const
+{
+	uint8_t leader = tree[1];
+	return (leader != SIM_NO_FIGHTER && alive[leader]) ? leader : 0;
+}
+
+//The fighter with the most rounds won, ties going to the lowest index
+int ZhengRoster::GetMostRoundsWon(int& o_fighter) const
+{
+	o_fighter = mostRoundsWonFighter;
+	return (numFighters > 0) ? roundsWon[mostRoundsWonFighter] : 0;
+}
+
+bool ZhengRoster::IsAlive(int i_fighter) const
+{
+	return i_fighter >= 0 && i_fighter < numFighters && alive[i_fighter];
+}
+
+//One match of the tournament: alive beats dead, then more health, then the lower index
+uint8_t ZhengRoster::Winner(uint8_t i_a, uint8_t i_b) const
+{
+	if (i_b == SIM_NO_FIGHTER)
+		return i_a;
+	if (i_a == SIM_NO_FIGHTER)
+		return i_b;
+
+	if (alive[i_a] != alive[i_b])
+		return alive[i_a] ? i_a : i_b;
+
+	if (health[i_a] != health[i_b])
+		return (health[i_a] > health[i_b]) ? i_a : i_b;
+
+	return (i_a < i_b) ? i_a : i_b;
+}
@@ -0,0 +1,1451 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "ZhengSimulation.h"
+#include "ZhengPackedState.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+// Plain C++ core of the Zheng combat rules. Nothing in here touches Unreal, so matches can be run,
+// tested and benchmarked headless. Everything advances in fixed ticks of SIM_TICK_SECONDS, so the
+// outcome only depends on the inputs, never on the frame rate.
+
+//The input bits that strum: Physical, Magical, Pushback and Special
+const uint8_t SIM_STRUM_INPUT_BITS = (1 << static_cast<int>(SimInput::Physical)) | (1 << static_cast<int>(SimInput::Magical)) |
+	(1 << static_cast<int>(SimInput::Pushback)) | (1 << static_cast<int>(SimInput::Special));
+
+//Converts a tuning value in seconds to a whole number of ticks
+uint32_t SecondsToTicks(float i_seconds)
+{
+	if (i_seconds <= 0.0f)
+		return 0;
+
+	return static_cast<uint32_t>(i_seconds * SIM_TICKS_PER_SECOND + 0.5f);
+}
+
+//Converts a fighter timer's duration to ticks, capped at SIM_MAX_TIMER_TICKS so its deadline always packs
+static uint32_t TimerTicks(float i_seconds)
+{
+	uint32_t ticks = SecondsToTicks(i_seconds);
+	return ticks < SIM_MAX_TIMER_TICKS ? ticks : SIM_MAX_TIMER_TICKS;
+}
+
+//Converts a tuning value in seconds to a whole number of sub-ticks, the resolution presses are timed at
+uint32_t SecondsToSubticks(float i_seconds)
+{
+	if (i_seconds <= 0.0f)
+		return 0;
+
+	return static_cast<uint32_t>(i_seconds * SIM_TICKS_PER_SECOND * SIM_SUBTICKS_PER_TICK + 0.5f);
+}
+
+ZhengTuning::ZhengTuning()
+{
+	MaxHealth = 100;
+	DefaultWalkSpeed = 400.0f;
+	DashWalkSpeed = 800.0f;
+	DashMaxTime = 0.5f;
+	DashEndingTime = 0.2f;
+	DashCooldownTime = 0.5f;
+	AttackEndingTime = 0.3f;
+	ForwardWalkSpeedMod = 0.5f;
+	SideWalkSpeedMod = 1.0f;
+	BlockTime = 5.0f;
+	DoublePressTimingWindow = 0.2f;
+	StrumToCommandTime = 0.1f;
+
+	BeatsPerMinute = 120.0f;
+	GeneralScaler = 1.0f;
+	BaseDamage = 3;
+
+	NumRoundsToWin = 3;
+	RoundTime = 99.0f;
+
+	ArenaRadius = 1500.0f;
+	SpawnDistance = 600.0f;
+	AttackSpeed = 1500.0f;
+	AttackHitRadius = 90.0f;
+	AttackLifetime = 3.0f;
+	PushbackDistance = 200.0f;
+	Gravity = 980.0f;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Strum combos
+//
+// Each strum press steps a small DFA that is generated at compile time from SIM_COMBOS. Recognising a
+// combo therefore costs one table lookup per press and one when the strum ends, however many combos
+// there are. A DFA state is a node in the trie of ordered combos, plus what the any-order combos and
+// the fallback need: which components were strummed, the first one, and how many (up to
+// SIM_NUM_ATTACK_COMPONENT_TYPES). State 0 is always the empty strum.
+
+enum class SimComboAction : uint8_t
+{
+	None,		//nothing was strummed, the beat is still there
+	Fizzle,		//too many components to add one and not a combo, the beat is spent for nothing
+	AddFirst,	//adds the first component strummed
+	LaunchAttack	//sends whatever has been composed
+};
+
+enum class SimComboMatch : uint8_t
+{
+	Sequence,	//exactly these presses, in this order
+	Set		//every one of these components and no others, in any order and any number of times
+};
+
+const int SIM_COMBO_MAX_LENGTH = 8;
+const int SIM_COMBO_MAX_NODES = 64;
+const int SIM_COMBO_MAX_STATES = 256;
+const int SIM_COMBO_COUNT_LIMIT = SIM_NUM_ATTACK_COMPONENT_TYPES;
+
+struct SimComboDefinition
+{
+	SimComboMatch match;
+	SimComboAction action;
+	uint8_t length;
+	SimAttackComponent components[SIM_COMBO_MAX_LENGTH];
+};
+
+//When a strum matches more than one combo, the earlier one wins
+constexpr SimComboDefinition SIM_COMBOS[] =
+{
+	//the cadenza: all four components launch the attack
+	{ SimComboMatch::Set, SimComboAction::LaunchAttack, 4,
+		{ SimAttackComponent::Physical, SimAttackComponent::Magical, SimAttackComponent::Pushback, SimAttackComponent::Special } },
+};
+
+const int SIM_NUM_COMBOS = sizeof(SIM_COMBOS) / sizeof(SIM_COMBOS[0]);
+
+struct SimComboTable
+{
+	uint8_t next[SIM_COMBO_MAX_STATES][SIM_NUM_ATTACK_COMPONENT_TYPES];
+	SimComboAction action[SIM_COMBO_MAX_STATES];
+	uint8_t firstComponent[SIM_COMBO_MAX_STATES];
+	int numStates;
+	bool overflowed;
+};
+
+//What a DFA state stands for while the table is being built
+struct SimComboKey
+{
+	uint8_t node, mask, first, count;
+};
+
+constexpr SimComboAction GetComboAction(const SimComboKey& i_key, const int* i_sequenceEnds)
+{
+	for (int i = 0; i < SIM_NUM_COMBOS; i++)
+	{
+		const SimComboDefinition& combo = SIM_COMBOS[i];
+
+		if (combo.match == SimComboMatch::Sequence)
+		{
+			if (i_sequenceEnds[i] == i_key.node)
+				return combo.action;
+		}
+		else
+		{
+			uint8_t mask = 0;
+			for (int j = 0; j < combo.length; j++)
+				mask |= static_cast<uint8_t>(1 << static_cast<int>(combo.components[j]));
+
+			if (i_key.mask == mask)
+				return combo.action;
+		}
+	}
+
+	if (i_key.count == 0)
+		return SimComboAction::None;
+
+	return (i_key.count < SIM_COMBO_COUNT_LIMIT) ? SimComboAction::AddFirst : SimComboAction::Fizzle;
+}
+
+constexpr SimComboTable BuildComboTable()
+{
+	SimComboTable table = {};
+
+	//trie of the ordered combos; node 0 is off every one of them, node 1 the root
+	uint8_t trie[SIM_COMBO_MAX_NODES][SIM_NUM_ATTACK_COMPONENT_TYPES] = {};
+	int sequenceEnds[SIM_NUM_COMBOS] = {};
+	int numNodes = 2;
+
+	for (int i = 0; i < SIM_NUM_COMBOS; i++)
+	{
+		sequenceEnds[i] = -1;
+		if (SIM_COMBOS[i].match != SimComboMatch::Sequence)
+			continue;
+
+		int node = 1;
+		for (int j = 0; j < SIM_COMBOS[i].length; j++)
+		{
+			int component = static_cast<int>(SIM_COMBOS[i].components[j]);
+
+			if (trie[node][component] == 0)
+			{
+				if (numNodes == SIM_COMBO_MAX_NODES)
+				{
+					table.overflowed = true;
+					return table;
+				}
+				trie[node][component] = static_cast<uint8_t>(numNodes++);
+			}
+			node = trie[node][component];
+		}
+		sequenceEnds[i] = node;
+	}
+
+	//walk every reachable state breadth first, numbering them as they're found
+	SimComboKey keys[SIM_COMBO_MAX_STATES] = {};
+	keys[0].node = 1;
+	table.numStates = 1;
+
+	for (int state = 0; state < table.numStates; state++)
+	{
+		const SimComboKey key = keys[state];
+
+		for (int component = 0; component < SIM_NUM_ATTACK_COMPONENT_TYPES; component++)
+		{
+			SimComboKey after = {};
+			after.node = trie[key.node][component];
+			after.mask = static_cast<uint8_t>(key.mask | (1 << component));
+			after.first = static_cast<uint8_t>((key.count == 0) ? component : key.first);
+			after.count = static_cast<uint8_t>((key.count < SIM_COMBO_COUNT_LIMIT) ? key.count + 1 : key.count);
+
+			int found = 0;
+			while (found < table.numStates && (keys[found].node != after.node || keys[found].mask != after.mask ||
+				keys[found].first != after.first || keys[found].count != after.count))
+			{
+				found++;
+			}
+
+			if (found == table.numStates)
+			{
+				if (table.numStates == SIM_COMBO_MAX_STATES)
+				{
+					table.overflowed = true;
+					return table;
+				}
+				keys[table.numStates++] = after;
+			}
+
+			table.next[state][component] = static_cast<uint8_t>(found);
+		}
+
+		table.action[state] = GetComboAction(key, sequenceEnds);
+		table.firstComponent[state] = key.first;
+	}
+
+	return table;
+}
+
+constexpr SimComboTable SIM_COMBO_TABLE = BuildComboTable();
+static_assert(!SIM_COMBO_TABLE.overflowed, "Too many strum combos for the combo table, raise SIM_COMBO_MAX_NODES or SIM_COMBO_MAX_STATES.");
+
+
+//////////////////////////////////////////////////////////////////////////
+// ZhengFighterSim
+
+ZhengFighterSim::ZhengFighterSim()
+{
+	tuning = nullptr;
+	timerWheel = nullptr;
+	timerPayloadBase = 0;
+	dueTimers = 0;
+	memset(&state, 0, sizeof(state));
+
+	for (int i = 0; i < SIM_NUM_TIMERS; i++)
+		timerHandles[i] = TIMER_INVALID_HANDLE;
+}
+
+//Timers are scheduled on i_timerWheel with payloads i_timerPayloadBase + SimTimer. Whoever owns the wheel
+//advances it to each tick before calling Step and passes the payloads back through OnTimerDue.
+void ZhengFighterSim::Initialize(const ZhengTuning* i_tuning, TimingWheel* i_timerWheel, uint32_t i_timerPayloadBase)
+{
+	tuning = i_tuning;
+	timerWheel = i_timerWheel;
+	timerPayloadBase = i_timerPayloadBase;
+	ResetForBattle();
+}
+
+void ZhengFighterSim::ResetForBattle()
+{
+	state.roundsWon = 0;
+	ResetForRound();
+}
+
+void ZhengFighterSim::ResetForRound()
+{
+	uint8_t roundsWon = state.roundsWon;
+
+	CancelAllTimers();
+	memset(&state, 0, sizeof(state));
+	state.roundsWon = roundsWon;
+	state.health = tuning->MaxHealth;
+	state.alive = true;
+
+	for (int i = 0; i < SIM_NUM_DIRECTIONS; i++)
+		state.lastPressTick[i] = SIM_NEVER;
+}
+
+//Advances this fighter by one tick. i_airborne is whether the fighter is off the ground (knocked back, falling).
+//Returns the SimFighterEvent flags for whatever happened this tick.
+uint32_t ZhengFighterSim::Step(uint32_t i_tick, const SimInputFrame& i_input, const SimBeat& i_beat, bool i_airborne)
+{
+	events = 0;
+
+	if (!state.alive)
+		return events;
+
+	airborne = i_airborne;
+	currentTick = i_tick;
+
+	//a strum whose window closed before this tick's inputs ends before they are looked at
+	if (state.strumming && TakeTimer(SimTimer_StrumEnd))
+		EndStrum();
+
+	//a strum is judged against the beat lock where the beat was when it was pressed, not where it is at the end of the tick
+	if (i_input.pressed & SIM_STRUM_INPUT_BITS)
+		UpdateBeatLock(i_beat.pressElapsed, i_beat.pressRemaining);
+
+	//presses are handled in a fixed order so two presses in one tick always resolve the same way
+	for (int i = 0; i < SIM_NUM_INPUTS; i++)
+	{
+		if (i_input.pressed & (1 << i))
+			PressInput(static_cast<SimInput>(i), i_input);
+	}
+
+	state.heldButtons = i_input.held;
+
+	UpdateTimers(i_beat);
+
+	return events;
+}
+
+//i_frame is the tick's whole input frame, for when within the tick the presses happened
+void ZhengFighterSim::PressInput(SimInput i_input, const SimInputFrame& i_frame)
+{
+	switch (i_input)
+	{
+	case SimInput::Right:
+	case SimInput::Left:
+	case SimInput::Up:
+	case SimInput::Down:
+	{
+		int direction = static_cast<int>(i_input);
+		const uint32_t pressCount = i_frame.pressCount[direction];
+		const uint32_t firstPress = i_frame.firstPress[direction];
+		const uint32_t lastPress = i_frame.lastPress[direction];
+
+		if (CanDash())
+		{
+			const uint32_t window = SecondsToSubticks(tuning->DoublePressTimingWindow);
+			bool doublePress = false;
+
+			//the first press this tick against the last one before it, both to the sub-tick
+			uint32_t ticksSince = currentTick - state.lastPressTick[direction];
+			if (state.lastPressTick[direction] != SIM_NEVER && ticksSince <= window / SIM_SUBTICKS_PER_TICK + 1)
+			{
+				doublePress = ticksSince * SIM_SUBTICKS_PER_TICK + firstPress - state.lastPressSubtick[direction] < window;
+			}
+
+			//two or more presses inside this tick: some pair of them is no further apart than the average gap
+			if (!doublePress && pressCount >= 2)
+			{
+				doublePress = (lastPress - firstPress) / (pressCount - 1) < window;
+			}
+
+			if (doublePress)
+			{
+				StartDash(static_cast<uint8_t>(direction));
+			}
+		}
+		state.lastPressTick[direction] = currentTick;
+		state.lastPressSubtick[direction] = static_cast<uint8_t>(lastPress);
+		break;
+	}
+	case SimInput::Physical:
+	case SimInput::Magical:
+	case SimInput::Pushback:
+	case SimInput::Special:
+		if (CanStrum())
+		{
+			if (!state.strumming)
+			{
+				StartStrum();
+			}
+
+			int component = static_cast<int>(InputToComponent(i_input));
+			state.comboState = SIM_COMBO_TABLE.next[state.comboState][component];
+			state.strumEndTick = currentTick + TimerTicks(tuning->StrumToCommandTime);
+			ScheduleTimer(SimTimer_StrumEnd, state.strumEndTick);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void ZhengFighterSim::UpdateTimers(const SimBeat& i_beat)
+{
+	if (state.dashing)
+	{
+		if (!state.dashEnding)
+		{
+			if (TakeTimer(SimTimer_DashEnd))
+			{
+				state.dashEnding = true;
+				state.dashEndingEndTick = state.dashEndTick + TimerTicks(tuning->DashEndingTime);
+				ScheduleTimer(SimTimer_DashEndingEnd, state.dashEndingEndTick);
+			}
+		}
+		else //if in the end of the dash
+		{
+			if (TakeTimer(SimTimer_DashEndingEnd))
+			{
+				EndDash();
+			}
+		}
+	}
+
+	if (state.dashOnCooldown && TakeTimer(SimTimer_DashCooldownEnd))
+	{
+		state.dashOnCooldown = false;
+	}
+
+	if (state.attackEnding && TakeTimer(SimTimer_AttackEndingEnd))
+	{
+		state.attackEnding = false;
+	}
+
+	if (state.strumming && TakeTimer(SimTimer_StrumEnd))
+	{
+		EndStrum();
+	}
+
+	if (state.blocking && TakeTimer(SimTimer_BlockEnd))
+	{
+		state.blocking = false;
+		events |= SimFighterEvent_BlockEnded;
+	}
+
+	UpdateBeatLock(i_beat.elapsed, i_beat.remaining);
+}
+
+//This two-part lock prevents the player from playing more than one note, and refreshes on the off-beat.
+//The first part checks that a beat has passed (we're closer to the last beat than the next one),
+//the second that the next beat is incoming (past the off-beat). Then the lock is released fully.
+void ZhengFighterSim::UpdateBeatLock(float i_elapsed, float i_remaining)
+{
+	if (state.beatConsumed)
+	{
+		if (!state.beatPassed)
+		{
+			if (i_elapsed < i_remaining)
+			{
+				state.beatPassed = true;
+			}
+		}
+		else
+		{
+			if (i_elapsed > i_remaining)
+			{
+				state.beatConsumed = false;
+				state.beatPassed = false;
+				events |= SimFighterEvent_BeatLockReset;
+			}
+		}
+	}
+}
+
+void ZhengFighterSim::StartDash(uint8_t i_direction)
+{
+	if (state.dashOnCooldown)
+	{
+		return;
+	}
+
+	state.dashing = true;
+	state.dashEnding = false;
+	state.dashDirection = i_direction;
+	state.dashEndTick = currentTick + TimerTicks(tuning->DashMaxTime);
+	ScheduleTimer(SimTimer_DashEnd, state.dashEndTick);
+	events |= SimFighterEvent_DashStarted;
+}
+
+void ZhengFighterSim::EndDash()
+{
+	state.dashing = false;
+	state.dashEnding = false;
+
+	state.dashOnCooldown = true;
+	state.dashCooldownEndTick = currentTick + TimerTicks(tuning->DashCooldownTime);
+	ScheduleTimer(SimTimer_DashCooldownEnd, state.dashCooldownEndTick);
+	events |= SimFighterEvent_DashEnded;
+}
+
+//The beat is judged as the strum starts: a strum started while the beat is locked won't play, even if the lock
+//comes off before its window closes
+void ZhengFighterSim::StartStrum()
+{
+	state.strumming = true;
+	state.strumOnFreeBeat = !state.beatConsumed;
+	ClearStrum(); //empty out our strum list just in case
+}
+
+//Throws away what has been strummed so far but keeps the strum open, with its window starting over from now
+void ZhengFighterSim::CancelStrum()
+{
+	if (!state.strumming)
+		StartStrum();
+	else
+		ClearStrum();
+
+	state.strumEndTick = currentTick + TimerTicks(tuning->StrumToCommandTime);
+	ScheduleTimer(SimTimer_StrumEnd, state.strumEndTick);
+}
+
+//Ends and finalizes the strum
+void ZhengFighterSim::EndStrum()
+{
+	//the strum always ends here; previously a consumed beat or an empty strum left it open forever, which also blocked dashing
+	state.strumming = false;
+	CancelTimer(SimTimer_StrumEnd);
+
+	if (!state.strumOnFreeBeat)
+	{
+		ClearStrum();
+		return;
+	}
+
+	switch (SIM_COMBO_TABLE.action[state.comboState])
+	{
+	case SimComboAction::None:
+		ClearStrum();
+		return;
+	case SimComboAction::Fizzle:
+		break;
+	case SimComboAction::AddFirst:
+	{
+		//we strum the first one we strummed
+		uint8_t component = SIM_COMBO_TABLE.firstComponent[state.comboState];
+		if (state.numAttackComponents < SIM_MAX_ATTACK_COMPONENTS)
+		{
+			state.attackComponents[state.numAttackComponents++] = component;
+		}
+		state.lastAddedComponent = component;
+		events |= SimFighterEvent_ComponentAdded;
+		break;
+	}
+	case SimComboAction::LaunchAttack:
+		LaunchAttack();
+		break;
+	}
+
+	state.beatConsumed = true;
+	ClearStrum();
+}
+
+void ZhengFighterSim::ClearStrum()
+{
+	state.comboState = 0;
+}
+
+//Sends whatever has been composed. A lone Special becomes a block instead of a projectile.
+void ZhengFighterSim::LaunchAttack()
+{
+	state.attackEnding = true;
+	state.attackEndingEndTick = currentTick + TimerTicks(tuning->AttackEndingTime);
+	ScheduleTimer(SimTimer_AttackEndingEnd, state.attackEndingEndTick);
+
+	if (state.numAttackComponents == 1 && state.attackComponents[0] == static_cast<uint8_t>(SimAttackComponent::Special))
+	{
+		state.blocking = true;
+		state.blockEndTick = currentTick + TimerTicks(tuning->BlockTime);
+		ScheduleTimer(SimTimer_BlockEnd, state.blockEndTick);
+		events |= SimFighterEvent_BlockStarted;
+	}
+	else
+	{
+		//the caller reads the components out before the next Step clears them
+		state.launchedAttack = BuildAttack();
+		events |= SimFighterEvent_AttackLaunched;
+	}
+
+	state.numAttackComponents = 0;
+}
+
+//Sums up the composed components into what a projectile carries
+ZhengAttackInfo ZhengFighterSim::BuildAttack() const
+{
+	ZhengAttackInfo attack;
+	memset(&attack, 0, sizeof(attack));
+	attack.generalScaler = tuning->GeneralScaler;
+
+	if (state.numAttackComponents > 0)
+		attack.primaryType = state.attackComponents[0];
+
+	for (int i = 0; i < state.numAttackComponents; i++)
+	{
+		switch (static_cast<SimAttackComponent>(state.attackComponents[i]))
+		{
+		case SimAttackComponent::Physical:
+			attack.physicalCount++;
+			break;
+		case SimAttackComponent::Magical:
+			attack.magicalCount++;
+			break;
+		case SimAttackComponent::Pushback:
+			attack.pushbackCount++;
+			break;
+		case SimAttackComponent::Special:
+			attack.specialCount++;
+			break;
+		}
+	}
+
+	return attack;
+}
+
+//Resolves an attack landing on this fighter. Knockback and visuals are up to the caller.
+ZhengHitResult ZhengFighterSim::ApplyHit(const ZhengAttackInfo& i_attack)
+{
+	ZhengHitResult result;
+	memset(&result, 0, sizeof(result));
+
+	if (BlocksAttack(i_attack))
+	{
+		result.blocked = true;
+		return result;
+	}
+
+	int mpSum = i_attack.physicalCount + i_attack.magicalCount;
+	if (mpSum)
+	{
+		result.damage = (tuning->BaseDamage + mpSum) * static_cast<int>(i_attack.generalScaler);
+		TakeDamage(result.damage);
+	}
+
+	result.pushbackCount = i_attack.pushbackCount;
+
+	//This is not abstracted per character
+	if (i_attack.primaryType == static_cast<uint8_t>(SimAttackComponent::Special))
+	{
+		for (int i = 0; i < i_attack.specialCount - 1; i++)
+		{
+			if (state.fireOrbs <= SIM_MAX_FIRE_ORBS)
+			{
+				state.fireOrbs++;
+				result.fireOrbsAdded++;
+			}
+		}
+		state.fireOrbs = 0;
+		result.fireOrbsConsumed = true;
+	}
+	else
+	{
+		for (int i = 0; i < i_attack.specialCount; i++)
+		{
+			if (state.fireOrbs < SIM_MAX_FIRE_ORBS)
+			{
+				state.fireOrbs++;
+				result.fireOrbsAdded++;
+			}
+		}
+	}
+
+	result.died = !state.alive;
+	return result;
+}
+
+//Magical attacks can be blocked
+bool ZhengFighterSim::BlocksAttack(const ZhengAttackInfo& i_attack) const
+{
+	return state.blocking && i_attack.primaryType == static_cast<uint8_t>(SimAttackComponent::Magical);
+}
+
+void ZhengFighterSim::TakeDamage(int i_damage)
+{
+	if (!state.alive)
+		return;
+
+	state.health -= i_damage;
+	if (state.health <= 0)
+		Die();
+}
+
+void ZhengFighterSim::RecoverHealth(int i_health)
+{
+	state.health += i_health;
+	if (state.health > tuning->MaxHealth)
+		state.health = tuning->MaxHealth;
+}
+
+void ZhengFighterSim::FallOffMap()
+{
+	state.health = 0;
+	Die();
+}
+
+void ZhengFighterSim::Die()
+{
+	state.alive = false;
+}
+
+void ZhengFighterSim::IncrementRoundsWon()
+{
+	state.roundsWon++;
+}
+
+bool ZhengFighterSim::CanMove() const
+{
+	return state.alive && !state.dashing && !state.attackEnding && !airborne;
+}
+
+bool ZhengFighterSim::CanAttack() const
+{
+	return state.alive && !state.dashing && !state.attackEnding && !airborne;
+}
+
+bool ZhengFighterSim::CanStrum() const
+{
+	return state.alive && !state.dashing && !state.attackEnding && !airborne && !state.blocking;
+}
+
+bool ZhengFighterSim::CanDash() const
+{
+	return state.alive && !state.dashing && !state.attackEnding && !state.strumming && !airborne;
+}
+
+//Gets the movement input for this tick as (right, forward) amounts in the fighter's own frame, already scaled
+//the same way AddMovementInput would clamp it. Zero when the fighter can't walk or dash right now.
+void ZhengFighterSim::GetMovementInput(float& o_right, float& o_forward, float& o_maxSpeed) const
+{
+	o_right = 0.0f;
+	o_forward = 0.0f;
+	o_maxSpeed = tuning->DefaultWalkSpeed;
+
+	if (state.dashing)
+	{
+		o_maxSpeed = tuning->DashWalkSpeed;
+
+		//end of dash, can't move
+		if (state.dashEnding)
+			return;
+
+		switch (state.dashDirection)
+		{
+		case static_cast<uint8_t>(SimInput::Right): o_right = 1.0f; break;
+		case static_cast<uint8_t>(SimInput::Left): o_right = -1.0f; break;
+		case static_cast<uint8_t>(SimInput::Up): o_forward = 1.0f; break;
+		case static_cast<uint8_t>(SimInput::Down): o_forward = -1.0f; break;
+		}
+		return;
+	}
+
+	if (!CanMove())
+		return;
+
+	float x = 0.0f;
+	float y = 0.0f;
+	float scaleValue = 1.0f;
+
+	if (state.heldButtons & (1 << static_cast<int>(SimInput::Right)))
+		x += 1.0f;
+	if (state.heldButtons & (1 << static_cast<int>(SimInput::Left)))
+		x -= 1.0f;
+	if (state.heldButtons & (1 << static_cast<int>(SimInput::Up)))
+		y += 1.0f;
+	if (state.heldButtons & (1 << static_cast<int>(SimInput::Down)))
+		y -= 1.0f;
+
+	if (x != 0.0f)
+		scaleValue *= tuning->SideWalkSpeedMod;
+
+	//cut movement speed in half for forward and backward movement
+	if (y != 0.0f)
+		scaleValue *= tuning->ForwardWalkSpeedMod;
+
+	//AddMovementInput clamps the combined input to length 1
+	float length = sqrtf(x * x + y * y) * scaleValue;
+	float scale = (length > 1.0f) ? scaleValue / length : scaleValue;
+
+	o_right = x * scale;
+	o_forward = y * scale;
+}
+
+const ZhengFighterState& ZhengFighterSim::GetState() const
+{
+	return state;
+}
+
+//i_tick is the next tick this fighter will simulate. Its timers are scheduled again from the deadlines in
+//i_state, so call this after the timer wheel has been reset to i_tick.
+void ZhengFighterSim::SetState(const ZhengFighterState& i_state, uint32_t i_tick)
+{
+	CancelAllTimers();
+	state = i_state;
+
+	if (state.dashing)
+	{
+		if (!state.dashEnding)
+			RestoreTimer(SimTimer_DashEnd, state.dashEndTick, i_tick);
+		else
+			RestoreTimer(SimTimer_DashEndingEnd, state.dashEndingEndTick, i_tick);
+	}
+
+	if (state.dashOnCooldown)
+		RestoreTimer(SimTimer_DashCooldownEnd, state.dashCooldownEndTick, i_tick);
+	if (state.attackEnding)
+		RestoreTimer(SimTimer_AttackEndingEnd, state.attackEndingEndTick, i_tick);
+	if (state.strumming)
+		RestoreTimer(SimTimer_StrumEnd, state.strumEndTick, i_tick);
+	if (state.blocking)
+		RestoreTimer(SimTimer_BlockEnd, state.blockEndTick, i_tick);
+}
+
+//Called by the wheel's owner when one of this fighter's timers fires
+void ZhengFighterSim::OnTimerDue(SimTimer i_timer)
+{
+	timerHandles[i_timer] = TIMER_INVALID_HANDLE;
+	dueTimers |= 1 << i_timer;
+}
+
+//A deadline that has already come is due right away, so it is seen by the next check just like a polled
+//deadline would be. Anything later waits on the wheel.
+void ZhengFighterSim::ScheduleTimer(SimTimer i_timer, uint32_t i_deadline)
+{
+	CancelTimer(i_timer);
+
+	if (i_deadline <= currentTick)
+		dueTimers |= 1 << i_timer;
+	else
+		timerHandles[i_timer] = timerWheel->Schedule(i_deadline, timerPayloadBase + i_timer);
+}
+
+void ZhengFighterSim::RestoreTimer(SimTimer i_timer, uint32_t i_deadline, uint32_t i_tick)
+{
+	if (i_deadline < i_tick)
+		dueTimers |= 1 << i_timer;
+	else
+		timerHandles[i_timer] = timerWheel->Schedule(i_deadline, timerPayloadBase + i_timer);
+}
+
+void ZhengFighterSim::CancelTimer(SimTimer i_timer)
+{
+	timerWheel->Cancel(timerHandles[i_timer]);
+	timerHandles[i_timer] = TIMER_INVALID_HANDLE;
+	dueTimers &= ~(1 << i_timer);
+}
+
+void ZhengFighterSim::CancelAllTimers()
+{
+	for (int i = 0; i < SIM_NUM_TIMERS; i++)
+		CancelTimer(static_cast<SimTimer>(i));
+}
+
+//Returns whether a timer is due, and consumes it if so
+bool ZhengFighterSim::TakeTimer(SimTimer i_timer)
+{
+	if (!(dueTimers & (1 << i_timer)))
+		return false;
+
+	dueTimers &= ~(1 << i_timer);
+	return true;
+}
+
+SimAttackComponent ZhengFighterSim::InputToComponent(SimInput i_input)
+{
+	switch (i_input)
+	{
+	case SimInput::Magical: return SimAttackComponent::Magical;
+	case SimInput::Pushback: return SimAttackComponent::Pushback;
+	case SimInput::Special: return SimAttackComponent::Special;
+	default: return SimAttackComponent::Physical;
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// ZhengRoundSim
+
+ZhengRoundSim::ZhengRoundSim()
+{
+	tuning = nullptr;
+	memset(&state, 0, sizeof(state));
+}
+
+void ZhengRoundSim::Initialize(const ZhengTuning* i_tuning)
+{
+	tuning = i_tuning;
+	memset(&state, 0, sizeof(state));
+}
+
+void ZhengRoundSim::BeginBattle()
+{
+	state.roundTicksRemaining = SecondsToTicks(tuning->RoundTime);
+	state.roundNumber = 0;
+	state.midBattle = true;
+	state.battleWinner = SIM_NO_FIGHTER;
+}
+
+void ZhengRoundSim::EndBattle()
+{
+	state.midBattle = false;
+}
+
+void ZhengRoundSim::BeginRound()
+{
+	state.roundTicksRemaining = SecondsToTicks(tuning->RoundTime);
+	state.midRound = true;
+}
+
+//Counts down the round clock. Returns true when time has run out.
+bool ZhengRoundSim::Step()
+{
+	if (!state.midBattle || !state.midRound)
+		return false;
+
+	if (state.roundTicksRemaining > 0)
+		state.roundTicksRemaining--;
+
+	return state.roundTicksRemaining == 0;
+}
+
+//A round is also over once at most one fighter is left standing
+bool ZhengRoundSim::CheckForEndOfRound(ZhengFighterSim* const* i_fighters, int i_numFighters) const
+{
+	return state.midRound && GetNumberOfRemainingFighters(i_fighters, i_numFighters) <= 1;
+}
+
+//Ends the round and returns the winner's index. The caller credits the win, then calls CheckForEndOfBattle.
+int ZhengRoundSim::EndRound(ZhengFighterSim* const* i_fighters, int i_numFighters)
+{
+	FinishRound();
+
+	return GetRoundWinner(i_fighters, i_numFighters);
+}
+
+//Ends the round for a caller that already knows who won it
+void ZhengRoundSim::FinishRound()
+{
+	state.midRound = false;
+	state.roundNumber++;
+}
+
+bool ZhengRoundSim::CheckForEndOfBattle(ZhengFighterSim* const* i_fighters, int i_numFighters)
+{
+	for (int i = 0; i < i_numFighters; i++)
+	{
+		if (DeclareBattleWinner(i, i_fighters[i]->GetState().roundsWon))
+			return true;
+	}
+
+	return false;
+}
+
+//Ends the battle if i_fighter has won enough rounds, for a caller that tracks who has won the most
+bool ZhengRoundSim::DeclareBattleWinner(int i_fighter, int i_roundsWon)
+{
+	if (i_roundsWon < tuning->NumRoundsToWin)
+		return false;
+
+	state.battleWinner = static_cast<uint8_t>(i_fighter);
+	state.midBattle = false;
+	return true;
+}
+
+bool ZhengRoundSim::IsBattleOver() const
+{
+	return state.battleWinner != SIM_NO_FIGHTER;
+}
+
+int ZhengRoundSim::GetNumberOfRemainingFighters(ZhengFighterSim* const* i_fighters, int i_numFighters)
+{
+	int remainingFighters = 0;
+
+	for (int i = 0; i < i_numFighters; i++)
+	{
+		if (i_fighters[i]->GetState().alive)
+			remainingFighters++;
+	}
+
+	return remainingFighters;
+}
+
+//The alive fighter with the most health, ties going to the lowest index. The 1st fighter if nobody is alive.
+int ZhengRoundSim::GetRoundWinner(ZhengFighterSim* const* i_fighters, int i_numFighters)
+{
+	int winner = -1;
+
+	for (int i = 0; i < i_numFighters; i++)
+	{
+		const ZhengFighterState& fighter = i_fighters[i]->GetState();
+		if (fighter.alive && (winner < 0 || fighter.health > i_fighters[winner]->GetState().health))
+		{
+			winner = i;
+		}
+	}
+
+	return winner < 0 ? 0 : winner;
+}
+
+const ZhengRoundState& ZhengRoundSim::GetState() const
+{
+	return state;
+}
+
+void ZhengRoundSim::SetState(const ZhengRoundState& i_state)
+{
+	state = i_state;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// ZhengSimulation
+//
+// A whole headless match: the fighter and round rules above plus a flat arena standing in for what
+// Unreal does in the game (character movement, facing, homing projectiles, knockback).
+
+ZhengSimulation::ZhengSimulation()
+{
+	numFighters = 0;
+	numHits = 0;
+	memset(&state, 0, sizeof(state));
+}
+
+void ZhengSimulation::Initialize(const ZhengTuning& i_tuning, int i_numFighters)
+{
+	tuning = i_tuning;
+	numFighters = (i_numFighters > SIM_MAX_FIGHTERS) ? SIM_MAX_FIGHTERS : i_numFighters;
+
+	//one wheel for every fighter's timers, a fighter never has more than one of each running
+	timerWheel.Initialize(numFighters * SIM_NUM_TIMERS, 0);
+
+	for (int i = 0; i < numFighters; i++)
+	{
+		fighters[i].Initialize(&tuning, &timerWheel, i * SIM_NUM_TIMERS);
+		fighterPointers[i] = &fighters[i];
+	}
+
+	roundSim.Initialize(&tuning);
+
+	memset(&state, 0, sizeof(state));
+	BeginBattle();
+}
+
+void ZhengSimulation::BeginBattle()
+{
+	for (int i = 0; i < numFighters; i++)
+		fighters[i].ResetForBattle();
+
+	roundSim.BeginBattle();
+	BeginRound();
+}
+
+void ZhengSimulation::BeginRound()
+{
+	//fighters start evenly spaced on a circle, facing the middle
+	for (int i = 0; i < numFighters; i++)
+	{
+		float angle = (6.28318530718f * i) / numFighters;
+		ZhengArenaFighter& body = state.bodies[i];
+
+		memset(&body, 0, sizeof(body));
+		body.x = cosf(angle) * tuning.SpawnDistance;
+		body.y = sinf(angle) * tuning.SpawnDistance;
+		body.yaw = angle + 3.14159265359f;
+		body.target = static_cast<uint8_t>((i + 1) % numFighters);
+
+		fighters[i].ResetForRound();
+	}
+
+	memset(state.projectiles, 0, sizeof(state.projectiles));
+	roundSim.BeginRound();
+}
+
+//Gets where the beat is at a given tick for a constant tempo
+SimBeat ZhengSimulation::GetBeatAtTick(uint32_t i_tick) const
+{
+	SimBeat beat;
+	uint32_t beatTicks = static_cast<uint32_t>((60.0f / tuning.BeatsPerMinute) * SIM_TICKS_PER_SECOND + 0.5f);
+	if (beatTicks == 0)
+		beatTicks = 1;
+
+	uint32_t intoBeat = i_tick % beatTicks;
+	beat.elapsed = intoBeat * SIM_TICK_SECONDS;
+	beat.remaining = (beatTicks - intoBeat) * SIM_TICK_SECONDS;
+
+	//headless there's no press time finer than the tick
+	beat.pressElapsed = beat.elapsed;
+	beat.pressRemaining = beat.remaining;
+	return beat;
+}
+
+//Advances the match by one tick with one input frame per fighter
+void ZhengSimulation::Step(const SimInputFrame* i_inputs)
+{
+	if (!roundSim.GetState().midBattle)
+		return;
+
+	SimBeat beat = GetBeatAtTick(state.tick);
+	numHits = 0;
+
+	//only the timers due this tick are touched, however many are running
+	timerWheel.AdvanceTo(state.tick, OnTimerFired, this);
+
+	for (int i = 0; i < numFighters; i++)
+	{
+		ZhengArenaFighter& body = state.bodies[i];
+		bool airborne = body.z > 0.0f;
+
+		//Rotation
+		if (!airborne && fighters[body.target].GetState().alive)
+		{
+			const ZhengArenaFighter& target = state.bodies[body.target];
+			body.yaw = atan2f(target.y - body.y, target.x - body.x);
+		}
+
+		uint32_t fighterEvents = fighters[i].Step(state.tick, i_inputs[i], beat, airborne);
+
+		if (fighterEvents & SimFighterEvent_AttackLaunched)
+			SpawnProjectile(i, fighters[i].GetState().launchedAttack);
+
+		MoveFighter(i);
+	}
+
+	StepProjectiles();
+
+	if (roundSim.Step() || roundSim.CheckForEndOfRound(fighterPointers, numFighters))
+	{
+		int winner = roundSim.EndRound(fighterPointers, numFighters);
+		fighters[winner].IncrementRoundsWon();
+
+		if (!roundSim.CheckForEndOfBattle(fighterPointers, numFighters))
+			BeginRound();
+	}
+
+	state.tick++;
+}
+
+void ZhengSimulation::MoveFighter(int i_fighter)
+{
+	ZhengArenaFighter& body = state.bodies[i_fighter];
+	ZhengFighterSim& fighter = fighters[i_fighter];
+
+	if (!fighter.GetState().alive)
+		return;
+
+	float forwardX = cosf(body.yaw);
+	float forwardY = sinf(body.yaw);
+	float rightX = -forwardY;
+	float rightY = forwardX;
+
+	if (body.z > 0.0f || body.vz > 0.0f)
+	{
+		//knocked back: keep flying until we land
+		body.vz -= tuning.Gravity * SIM_TICK_SECONDS;
+		body.z += body.vz * SIM_TICK_SECONDS;
+		if (body.z <= 0.0f)
+		{
+			body.z = 0.0f;
+			body.vz = 0.0f;
+			body.vx = 0.0f;
+			body.vy = 0.0f;
+		}
+	}
+	else
+	{
+		float right, forward, maxSpeed;
+		fighter.GetMovementInput(right, forward, maxSpeed);
+
+		body.vx = (rightX * right + forwardX * forward) * maxSpeed;
+		body.vy = (rightY * right + forwardY * forward) * maxSpeed;
+	}
+
+	body.x += body.vx * SIM_TICK_SECONDS;
+	body.y += body.vy * SIM_TICK_SECONDS;
+
+	if (body.x * body.x + body.y * body.y > tuning.ArenaRadius * tuning.ArenaRadius)
+		fighter.FallOffMap();
+}
+
+void ZhengSimulation::SpawnProjectile(int i_owner, const ZhengAttackInfo& i_attack)
+{
+	for (int i = 0; i < SIM_MAX_PROJECTILES; i++)
+	{
+		ZhengArenaProjectile& projectile = state.projectiles[i];
+		if (projectile.active)
+			continue;
+
+		const ZhengArenaFighter& body = state.bodies[i_owner];
+		projectile.active = true;
+		projectile.owner = static_cast<uint8_t>(i_owner);
+		projectile.target = body.target;
+		projectile.x = body.x + cosf(body.yaw) * 190.0f;
+		projectile.y = body.y + sinf(body.yaw) * 190.0f;
+		projectile.ticksLeft = SecondsToTicks(tuning.AttackLifetime);
+		projectile.attack = i_attack;
+		return;
+	}
+}
+
+//Hands a fired timer back to the fighter that scheduled it
+void ZhengSimulation::OnTimerFired(void* i_context, uint32_t i_payload)
+{
+	ZhengSimulation* simulation = static_cast<ZhengSimulation*>(i_context);
+	simulation->fighters[i_payload / SIM_NUM_TIMERS].OnTimerDue(static_cast<SimTimer>(i_payload % SIM_NUM_TIMERS));
+}
+
+void ZhengSimulation::StepProjectiles()
+{
+	float hitRadiusSquared = tuning.AttackHitRadius * tuning.AttackHitRadius;
+	float step = tuning.AttackSpeed * SIM_TICK_SECONDS;
+
+	for (int i = 0; i < SIM_MAX_PROJECTILES; i++)
+	{
+		ZhengArenaProjectile& projectile = state.projectiles[i];
+		if (!projectile.active)
+			continue;
+
+		//homes straight in on its target
+		ZhengArenaFighter& target = state.bodies[projectile.target];
+		float dx = target.x - projectile.x;
+		float dy = target.y - projectile.y;
+		float distanceSquared = dx * dx + dy * dy;
+
+		if (distanceSquared <= hitRadiusSquared)
+		{
+			projectile.active = false;
+			if (fighters[projectile.target].GetState().alive)
+				ResolveHit(projectile.owner, projectile.target, projectile.attack);
+			continue;
+		}
+
+		float distance = sqrtf(distanceSquared);
+		float move = (step < distance) ? step : distance;
+		projectile.x += dx / distance * move;
+		projectile.y += dy / distance * move;
+
+		if (--projectile.ticksLeft == 0)
+			projectile.active = false;
+	}
+}
+
+void ZhengSimulation::ResolveHit(int i_owner, int i_target, const ZhengAttackInfo& i_attack)
+{
+	ZhengHitResult result = fighters[i_target].ApplyHit(i_attack);
+
+	if (numHits < SIM_MAX_HITS_PER_TICK)
+	{
+		ZhengHitRecord& hit = hits[numHits++];
+		hit.attacker = static_cast<uint8_t>(i_owner);
+		hit.target = static_cast<uint8_t>(i_target);
+		hit.result = result;
+	}
+
+	if (result.blocked)
+		return;
+
+	//pushed straight back from where the fighter is facing, and up a bit
+	ZhengArenaFighter& body = state.bodies[i_target];
+	float launch = -static_cast<float>(result.pushbackCount) * tuning.PushbackDistance;
+	body.vx = cosf(body.yaw) * launch;
+	body.vy = sinf(body.yaw) * launch;
+	body.vz = 50.0f + 150.0f * result.pushbackCount;
+	body.z = 0.001f;
+}
+
+//The most bytes SaveState can write for this many fighters, to size snapshot buffers up front
+size_t ZhengSimulation::GetMaxStateSize() const
+{
+	return sizeof(uint32_t) + sizeof(ZhengRoundState) + numFighters * (sizeof(ZhengPackedFighterState) + sizeof(ZhengArenaFighter)) +
+		sizeof(uint8_t) + SIM_MAX_PROJECTILES * (sizeof(uint8_t) + sizeof(ZhengArenaProjectile));
+}
+
+//Writes everything Step can change into o_buffer. Fighters are written packed, and only the fighters in play
+//and the live projectiles are written, so a duel snapshot stays around a hundred bytes. Returns the bytes written, 0 if the buffer is too small.
+size_t ZhengSimulation::SaveState(void* o_buffer, size_t i_bufferSize) const
+{
+	if (i_bufferSize < GetMaxStateSize())
+		return 0;
+
+	unsigned char* out = static_cast<unsigned char*>(o_buffer);
+
+	memcpy(out, &state.tick, sizeof(uint32_t));
+	out += sizeof(uint32_t);
+
+	memcpy(out, &roundSim.GetState(), sizeof(ZhengRoundState));
+	out += sizeof(ZhengRoundState);
+
+	for (int i = 0; i < numFighters; i++)
+	{
+		ZhengPackedFighterState packed;
+		PackFighterState(fighters[i].GetState(), state.tick, packed);
+		memcpy(out, &packed, sizeof(packed));
+		out += sizeof(packed);
+		memcpy(out, &state.bodies[i], sizeof(ZhengArenaFighter));
+		out += sizeof(ZhengArenaFighter);
+	}
+
+	unsigned char* projectileCount = out++;
+	*projectileCount = 0;
+
+	//slots are kept so projectiles spawned after a restore land in the same slots as before
+	for (int i = 0; i < SIM_MAX_PROJECTILES; i++)
+	{
+		if (!state.projectiles[i].active)
+			continue;
+
+		*out++ = static_cast<unsigned char>(i);
+		memcpy(out, &state.projectiles[i], sizeof(ZhengArenaProjectile));
+		out += sizeof(ZhengArenaProjectile);
+		(*projectileCount)++;
+	}
+
+	return out - static_cast<unsigned char*>(o_buffer);
+}
+
+//Puts the match back exactly as SaveState found it. The buffer may come from a file, so everything in it
+//is checked before any of it is used, and a bad buffer leaves the match untouched.
+bool ZhengSimulation::LoadState(const void* i_buffer, size_t i_size)
+{
+	const unsigned char* in = static_cast<const unsigned char*>(i_buffer);
+	size_t fixedSize = sizeof(uint32_t) + sizeof(ZhengRoundState) + numFighters * (sizeof(ZhengPackedFighterState) + sizeof(ZhengArenaFighter)) + sizeof(uint8_t);
+
+	if (i_size < fixedSize)
+	{
+		printf("Simulation state is too small to load.\n");
+		return false;
+	}
+
+	uint32_t tick;
+	memcpy(&tick, in, sizeof(uint32_t));
+	in += sizeof(uint32_t);
+
+	ZhengRoundState round;
+	memcpy(&round, in, sizeof(ZhengRoundState));
+	in += sizeof(ZhengRoundState);
+
+	if (round.battleWinner != SIM_NO_FIGHTER && round.battleWinner >= numFighters)
+	{
+		printf("Simulation state has an invalid round.\n");
+		return false;
+	}
+
+	ZhengFighterState fighterStates[SIM_MAX_FIGHTERS];
+	ZhengArenaFighter bodies[SIM_MAX_FIGHTERS];
+
+	for (int i = 0; i < numFighters; i++)
+	{
+		ZhengPackedFighterState packed;
+		memcpy(&packed, in, sizeof(packed));
+		in += sizeof(packed);
+
+		memcpy(&bodies[i], in, sizeof(ZhengArenaFighter));
+		in += sizeof(ZhengArenaFighter);
+
+		if (!UnpackFighterState(packed, tick, fighterStates[i]) || bodies[i].target >= numFighters)
+		{
+			printf("Simulation state has an invalid fighter.\n");
+			return false;
+		}
+	}
+
+	uint8_t numProjectiles = *in++;
+	if (i_size < fixedSize + numProjectiles * (sizeof(uint8_t) + sizeof(ZhengArenaProjectile)))
+	{
+		printf("Simulation state is missing projectiles.\n");
+		return false;
+	}
+
+	ZhengArenaProjectile projectiles[SIM_MAX_PROJECTILES];
+	memset(projectiles, 0, sizeof(projectiles));
+
+	for (int i = 0; i < numProjectiles; i++)
+	{
+		uint8_t slot = *in++;
+		ZhengArenaProjectile projectile;
+		memcpy(&projectile, in, sizeof(ZhengArenaProjectile));
+		in += sizeof(ZhengArenaProjectile);
+
+		if (slot >= SIM_MAX_PROJECTILES || (projectile.active && (projectile.owner >= numFighters || projectile.target >= numFighters)))
+		{
+			printf("Simulation state has an invalid projectile.\n");
+			return false;
+		}
+
+		projectiles[slot] = projectile;
+	}
+
+	//everything checks out, now replace the match
+	state.tick = tick;
+	roundSim.SetState(round);
+
+	//the fighters schedule their running timers again as they are restored
+	timerWheel.Reset(state.tick);
+
+	for (int i = 0; i < numFighters; i++)
+	{
+		fighters[i].SetState(fighterStates[i], state.tick);
+		state.bodies[i] = bodies[i];
+	}
+
+	memcpy(state.projectiles, projectiles, sizeof(projectiles));
+
+	return true;
+}
+
+//FNV-1a over the saved state. Two peers that agree on every input must agree on this.
+uint32_t ZhengSimulation::GetChecksum() const
+{
+	unsigned char buffer[sizeof(uint32_t) + sizeof(ZhengRoundState) + SIM_MAX_FIGHTERS * (sizeof(ZhengPackedFighterState) + sizeof(ZhengArenaFighter)) +
+		sizeof(uint8_t) + SIM_MAX_PROJECTILES * (sizeof(uint8_t) + sizeof(ZhengArenaProjectile))];
+	size_t size = SaveState(buffer, sizeof(buffer));
+
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= buffer[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+//Hits that landed during the last Step, in the order they were resolved
+int ZhengSimulation::GetNumHits() const
+{
+	return numHits;
+}
+
+const ZhengHitRecord& ZhengSimulation::GetHit(int i_hit) const
+{
+	return hits[i_hit];
+}
+
+int ZhengSimulation::GetNumFighters() const
+{
+	return numFighters;
+}
+
+const ZhengFighterSim& ZhengSimulation::GetFighter(int i_fighter) const
+{
+	return fighters[i_fighter];
+}
+
+const ZhengRoundSim& ZhengSimulation::GetRound() const
+{
+	return roundSim;
+}
+
+const ZhengArenaState& ZhengSimulation::GetArena() const
+{
+	return state;
+}
+
+const ZhengTuning& ZhengSimulation::GetTuning() const
+{
+	return tuning;
+}
@@ -0,0 +1,140 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "ZhengSpatialGrid.h"
+
+#include <math.h>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+// ZhengSpatialGrid
+//
+// Uniform grid over the arena floor, hashed into a fixed number of buckets so it doesn't care how big
+// the arena is. Rebuilt from scratch each frame with a counting sort, which for a few dozen fighters
+// is cheaper than keeping it up to date. Nearest-neighbour queries search outward one ring of cells at
+// a time and stop as soon as nothing further out could be closer, so they only look at the fighters
+// nearby rather than at everyone.
+
+const uint32_t GRID_BUCKET_MASK = SPATIAL_GRID_BUCKETS - 1;
+
+ZhengSpatialGrid::ZhengSpatialGrid()
+{
+	cellSize = 1.0f;
+	count = 0;
+	minCellX = maxCellX = minCellY = maxCellY = 0;
+	memset(bucketStart, 0, sizeof(bucketStart));
+}
+
+//Sorts the fighters into cells. Only those with i_valid set can be found by FindNearest.
+void ZhengSpatialGrid::Build(const float* i_x, const float* i_y, const bool* i_valid, int i_count, float i_cellSize)
+{
+	count = (i_count < SIM_MAX_FIGHTERS) ? i_count : SIM_MAX_FIGHTERS;
+	cellSize = (i_cellSize > 0.0f) ? i_cellSize : 1.0f;
+
+	uint16_t bucketCount[SPATIAL_GRID_BUCKETS] = {};
+	bool any = false;
+
+	for (int i = 0; i < count; i++)
+	{
+		x[i] = i_x[i];
+		y[i] = i_y[i];
+		valid[i] = i_valid[i];
+		cellX[i] = static_cast<int32_t>(floorf(x[i] / cellSize));
+		cellY[i] = static_cast<int32_t>(floorf(y[i] / cellSize));
+
+		if (!valid[i])
+			continue;
+
+		bucketCount[HashCell(cellX[i], cellY[i])]++;
+
+		//the occupied cells, so searches know when they've covered everything
+		if (!any || cellX[i] < minCellX) minCellX = cellX[i];
+		if (!any || cellX[i] > maxCellX) maxCellX = cellX[i];
+		if (!any || cellY[i] < minCellY) minCellY = cellY[i];
+		if (!any || cellY[i] > maxCellY) maxCellY = cellY[i];
+		any = true;
+	}
+
+	if (!any)
+	{
+		minCellX = maxCellX = minCellY = maxCellY = 0;
+	}
+
+	bucketStart[0] = 0;
+	for (int i = 0; i < SPATIAL_GRID_BUCKETS; i++)
+		bucketStart[i + 1] = static_cast<uint16_t>(bucketStart[i] + bucketCount[i]);
+
+	//fill in index order, so every bucket lists its fighters lowest index first
+	uint16_t fill[SPATIAL_GRID_BUCKETS];
+	memcpy(fill, bucketStart, sizeof(fill));
+	for (int i = 0; i < count; i++)
+	{
+		if (valid[i])
+			entries[fill[HashCell(cellX[i], cellY[i])]++] = static_cast<uint8_t>(i);
+	}
+}
+
+//The closest valid fighter to i_fighter other than itself, ties going to the lowest index. -1 if there are none.
+int ZhengSpatialGrid::FindNearest(int i_fighter) const
+{
+	if (i_fighter < 0 || i_fighter >= count)
+		return -1;
+
+	const float fromX = x[i_fighter];
+	const float fromY = y[i_fighter];
+	const int32_t centerX = cellX[i_fighter];
+	const int32_t centerY = cellY[i_fighter];
+
+	//far enough out to cover every occupied cell from here
+	int32_t maxRing = 0;
+	maxRing = (centerX - minCellX > maxRing) ? centerX - minCellX : maxRing;
+	maxRing = (maxCellX - centerX > maxRing) ? maxCellX - centerX : maxRing;
+	maxRing = (centerY - minCellY > maxRing) ? centerY - minCellY : maxRing;
+	maxRing = (maxCellY - centerY > maxRing) ? maxCellY - centerY : maxRing;
+
+	int best = -1;
+	float bestDistanceSquared = 0.0f;
+
+	for (int32_t ring = 0; ring <= maxRing; ring++)
+	{
+		for (int32_t dy = -ring; dy <= ring; dy++)
+		{
+			//the top and bottom rows of the ring take every cell, the rows between only the two ends
+			int32_t step = (dy == -ring || dy == ring) ? 1 : 2 * ring;
+			for (int32_t dx = -ring; dx <= ring; dx += step)
+			{
+				uint32_t bucket = HashCell(centerX + dx, centerY + dy);
+
+				for (uint16_t entry = bucketStart[bucket]; entry < bucketStart[bucket + 1]; entry++)
+				{
+					int other = entries[entry];
+					if (other == i_fighter)
+						continue;
+
+					//buckets can hold other cells too; they're still real fighters, so just measure them
+					float ox = x[other] - fromX;
+					float oy = y[other] - fromY;
+					float distanceSquared = ox * ox + oy * oy;
+
+					if (best < 0 || distanceSquared < bestDistanceSquared || (distanceSquared == bestDistanceSquared && other < best))
+					{
+						best = other;
+						bestDistanceSquared = distanceSquared;
+					}
+				}
+			}
+		}
+
+		//everything beyond this ring is at least ring cells away
+		float reach = ring * cellSize;
+		if (best >= 0 && bestDistanceSquared <= reach * reach)
+			break;
+	}
+
+	return best;
+}
+
+uint32_t ZhengSpatialGrid::HashCell(int32_t i_cellX, int32_t i_cellY)
+{
+	uint32_t hash = static_cast<uint32_t>(i_cellX) * 73856093u ^ static_cast<uint32_t>(i_cellY) * 19349663u;
+	return (hash ^ (hash >> 16)) & GRID_BUCKET_MASK;
+}